@@ -20,7 +20,8 @@ using ksz_type       = std::uint32_t;
 using value_sz_type  = std::uint32_t;
 using value_pos_type = off64_t;
 
-using file_id_type = std::uint64_t;
+using file_id_type    = std::uint64_t;
+using file_index_type = std::uint32_t; // position of a data file in the file table of the datadir
 
 using key_type   = std::string;
 using value_type = std::string;
@@ -0,0 +1,1013 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Benchmark with the core workloads of YCSB (Cooper et al., "Benchmarking Cloud Serving Systems with YCSB").
+// The store is loaded with --records keys, then --threads threads run the operation mix of the workload
+// for --operations operations or --duration seconds. The results are printed as JSON.
+// With --startup, the store is generated instead and the time and memory it takes to open it are measured.
+
+#include "bitcask.h"
+#include "hash.h"
+#include "histogram.hpp"
+#include "lockstats.h"
+#include "tracing.h"
+#include "datafile.h"
+#include "recordheader.h"
+#include "file.h"
+#include "config.h"
+
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <charconv>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bitcask {
+namespace bench {
+
+using clock_type = std::chrono::steady_clock;
+
+enum class operation
+{
+	read,
+	update,
+	insert,
+	scan,
+	read_modify_write,
+};
+
+constexpr auto operation_count = std::size_t{ 5u };
+
+constexpr std::array<std::string_view, operation_count> operation_names{ "read", "update", "insert", "scan", "read_modify_write" };
+
+enum class key_distribution
+{
+	uniform,
+	zipfian, // a few keys are hot, spread over the key space
+	latest,  // the most recently inserted keys are hot
+};
+
+// Proportions of the operations, in the order of the operation enum.
+struct workload final
+{
+	char                                 name;
+	std::array<double, operation_count>  mix;
+	key_distribution                     distribution;
+};
+
+const auto workloads = std::array<workload, 6>{ {
+	{ 'a', { 0.50, 0.50, 0.00, 0.00, 0.00 }, key_distribution::zipfian }, // update heavy
+	{ 'b', { 0.95, 0.05, 0.00, 0.00, 0.00 }, key_distribution::zipfian }, // read mostly
+	{ 'c', { 1.00, 0.00, 0.00, 0.00, 0.00 }, key_distribution::zipfian }, // read only
+	{ 'd', { 0.95, 0.00, 0.05, 0.00, 0.00 }, key_distribution::latest },  // read latest
+	{ 'e', { 0.00, 0.00, 0.05, 0.95, 0.00 }, key_distribution::zipfian }, // short ranges
+	{ 'f', { 0.50, 0.00, 0.00, 0.00, 0.50 }, key_distribution::zipfian }, // read-modify-write
+} };
+
+// A size that is fixed, or uniformly distributed between min and max.
+struct size_range final
+{
+	std::size_t min;
+	std::size_t max;
+
+	std::string to_string() const
+	{
+		return this->min == this->max ? fmt::format("{}", this->min) : fmt::format("{}-{}", this->min, this->max);
+	}
+};
+
+struct settings final
+{
+	workload                        load{ workloads[0] };
+	std::optional<key_distribution> distribution{};
+	std::size_t                     records{ 100000u };
+	std::size_t                     operations{ 1000000u };
+	std::chrono::seconds            duration{}; // if set, the run ends after this time instead of after the operations
+	std::size_t                     threads{ 1u };
+	std::size_t                     key_size{ 24u };
+	size_range                      value_size{ 100u, 100u };
+	std::size_t                     max_scan_length{ 100u };
+	std::uint64_t                   seed{ 1u };
+	std::filesystem::path           directory{ "/tmp/bitcask_bench" };
+	std::filesystem::path           output{}; // stdout if empty
+	bool                            lock_stats{};
+	options                         store{};
+	off64_t                         max_file_size{};
+
+	// --startup
+	bool        startup{};
+	std::size_t files{ 16u };   // data files of the generated store
+	bool        hints{};        // hint files for all but the active file
+	double      garbage{};      // fraction of the records on disk that are overwritten versions
+	bool        cold{};         // open with the store evicted from the page cache
+};
+
+// Zipfian distributed integers in [0, n), item 0 being the most popular (Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases"), as in YCSB.
+class zipfian_generator final
+{
+	static constexpr auto theta = 0.99;
+
+	std::uint64_t n_;
+	double        zeta_n_;
+	double        alpha_;
+	double        eta_;
+
+	static double zeta(std::uint64_t n)
+	{
+		auto sum = 0.0;
+		for (auto i = std::uint64_t{ 1u }; i <= n; ++i)
+		{
+			sum += 1.0 / std::pow(static_cast<double>(i), theta);
+		}
+		return sum;
+	}
+
+public:
+	explicit zipfian_generator(std::uint64_t n)
+	    : n_{ std::max(n, std::uint64_t{ 2u }) }
+	    , zeta_n_{ zeta(this->n_) }
+	    , alpha_{ 1.0 / (1.0 - theta) }
+	    , eta_{ (1.0 - std::pow(2.0 / static_cast<double>(this->n_), 1.0 - theta)) / (1.0 - zeta(2u) / this->zeta_n_) }
+	{
+	}
+
+	template<typename Rng>
+	std::uint64_t operator()(Rng& rng) const
+	{
+		const auto u  = std::uniform_real_distribution<double>{}(rng);
+		const auto uz = u * this->zeta_n_;
+		if (uz < 1.0)
+		{
+			return 0u;
+		}
+		if (uz < 1.0 + std::pow(0.5, theta))
+		{
+			return 1u;
+		}
+		const auto item = static_cast<std::uint64_t>(static_cast<double>(this->n_) * std::pow(this->eta_ * u - this->eta_ + 1.0, this->alpha_));
+		return std::min(item, this->n_ - 1u);
+	}
+};
+
+constexpr auto key_prefix = std::string_view{ "user" };
+
+// Keys of a fixed size, "user" followed by the zero padded key number. A number with more digits than fit is not
+// cut off, the key is longer instead, see key_size_needed.
+std::string make_key(std::uint64_t number, std::size_t size)
+{
+	return fmt::format("{}{:0{}}", key_prefix, number, size > key_prefix.size() ? size - key_prefix.size() : 0u);
+}
+
+// The key size that holds every key number up to `max_number`.
+std::size_t key_size_needed(std::uint64_t max_number)
+{
+	return key_prefix.size() + fmt::formatted_size("{}", max_number);
+}
+
+// Latencies in nanoseconds per operation, recorded per thread and merged after the run.
+struct latencies final
+{
+	std::array<histogram, operation_count> ns{};
+
+	void merge(const latencies& other)
+	{
+		for (auto i = std::size_t{}; i < operation_count; ++i)
+		{
+			this->ns[i].merge(other.ns[i]);
+		}
+	}
+};
+
+class runner final
+{
+	const settings&             settings_;
+	const workload              workload_;
+	const key_distribution      distribution_;
+	bitcask                     store_;
+	zipfian_generator           zipfian_;
+	std::string                 value_source_; // values are slices of this random text
+	std::atomic<std::uint64_t>  inserted_;     // keys [0, inserted_) exist
+	std::atomic<std::uint64_t>  issued_;       // operations started by all threads
+	std::atomic<bool>           stop_;
+
+	std::string_view make_value(std::mt19937_64& rng) const
+	{
+		const auto size   = std::uniform_int_distribution<std::size_t>{ this->settings_.value_size.min, this->settings_.value_size.max }(rng);
+		const auto offset = std::uniform_int_distribution<std::size_t>{ 0u, this->value_source_.size() - size }(rng);
+		return std::string_view{ this->value_source_ }.substr(offset, size);
+	}
+
+	std::uint64_t choose_key(std::mt19937_64& rng) const
+	{
+		const auto count = std::max(this->inserted_.load(std::memory_order_relaxed), std::uint64_t{ 1u });
+		switch (this->distribution_)
+		{
+		case key_distribution::uniform:
+			return std::uniform_int_distribution<std::uint64_t>{ 0u, count - 1u }(rng);
+		case key_distribution::zipfian:
+		{
+			// scrambled, so that the popular keys are not all at the start of the key space
+			const auto item = this->zipfian_(rng);
+			return wyhash(&item, sizeof(item), 0u) % count;
+		}
+		case key_distribution::latest:
+		{
+			const auto offset = this->zipfian_(rng);
+			return offset < count ? count - 1u - offset : count - 1u;
+		}
+		}
+		return 0u;
+	}
+
+	operation choose_operation(std::mt19937_64& rng) const
+	{
+		auto r = std::uniform_real_distribution<double>{}(rng);
+		for (auto i = std::size_t{}; i < operation_count; ++i)
+		{
+			if (r < this->workload_.mix[i])
+			{
+				return static_cast<operation>(i);
+			}
+			r -= this->workload_.mix[i];
+		}
+		return operation::read;
+	}
+
+	void execute(operation op, std::mt19937_64& rng)
+	{
+		switch (op)
+		{
+		case operation::read:
+			(void)(this->store_.get(make_key(this->choose_key(rng), this->settings_.key_size)));
+			break;
+		case operation::update:
+			this->store_.put(make_key(this->choose_key(rng), this->settings_.key_size), this->make_value(rng));
+			break;
+		case operation::insert:
+		{
+			// Other threads may choose the key before it is written, such a read finds nothing, as in YCSB.
+			const auto number = this->inserted_.fetch_add(1u, std::memory_order_relaxed);
+			this->store_.put(make_key(number, this->settings_.key_size), this->make_value(rng));
+			break;
+		}
+		case operation::scan:
+		{
+			const auto length = std::uniform_int_distribution<std::size_t>{ 1u, this->settings_.max_scan_length }(rng);
+			auto       n      = std::size_t{};
+			this->store_.scan(make_key(this->choose_key(rng), this->settings_.key_size), {}, [&](const auto&, const auto&) {
+				return ++n < length;
+			});
+			break;
+		}
+		case operation::read_modify_write:
+		{
+			const auto key = make_key(this->choose_key(rng), this->settings_.key_size);
+			(void)(this->store_.get(key));
+			this->store_.put(key, this->make_value(rng));
+			break;
+		}
+		}
+	}
+
+	void run_thread(std::size_t index, latencies& samples)
+	{
+		auto rng = std::mt19937_64{ this->settings_.seed + index };
+
+		const auto deadline = clock_type::now() + this->settings_.duration;
+
+		for (auto n = std::uint64_t{};; ++n)
+		{
+			if (this->settings_.duration.count())
+			{
+				if (this->stop_.load(std::memory_order_relaxed) || ((n % 64u) == 0u && clock_type::now() >= deadline))
+				{
+					this->stop_.store(true, std::memory_order_relaxed);
+					return;
+				}
+			}
+			else if (this->issued_.fetch_add(1u, std::memory_order_relaxed) >= this->settings_.operations)
+			{
+				return;
+			}
+
+			const auto op    = this->choose_operation(rng);
+			const auto start = clock_type::now();
+			this->execute(op, rng);
+			const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start);
+
+			samples.ns[static_cast<std::size_t>(op)].record(static_cast<std::uint64_t>(elapsed.count()));
+		}
+	}
+
+	// Runs `fn(index)` on the given number of threads, returns the elapsed time.
+	template<typename Fn>
+	static std::chrono::duration<double> parallel(std::size_t threads, Fn&& fn)
+	{
+		const auto start = clock_type::now();
+		{
+			auto workers = std::vector<std::jthread>{};
+			for (auto i = std::size_t{}; i < threads; ++i)
+			{
+				workers.emplace_back([&fn, i] { fn(i); });
+			}
+		}
+		return clock_type::now() - start;
+	}
+
+public:
+	explicit runner(const settings& s)
+	    : settings_{ s }
+	    , workload_{ s.load }
+	    , distribution_{ s.distribution.value_or(s.load.distribution) }
+	    , store_{ (bitcask::clear(s.directory), s.directory), s.store }
+	    , zipfian_{ s.records }
+	    , value_source_{}
+	    , inserted_{}
+	    , issued_{}
+	    , stop_{}
+	{
+		if (s.max_file_size)
+		{
+			this->store_.max_file_size(s.max_file_size);
+		}
+
+		auto rng = std::mt19937_64{ s.seed };
+		auto dis = std::uniform_int_distribution<int>{ ' ', '~' };
+		this->value_source_.resize(std::max(s.value_size.max * 2u, std::size_t{ 1024u * 1024u }));
+		std::generate(this->value_source_.begin(), this->value_source_.end(), [&] { return static_cast<char>(dis(rng)); });
+	}
+
+	// Inserts the records, returns the elapsed time.
+	std::chrono::duration<double> load()
+	{
+		const auto threads = this->settings_.threads;
+		const auto records = this->settings_.records;
+		const auto elapsed = parallel(threads, [&](std::size_t index) {
+			auto rng = std::mt19937_64{ this->settings_.seed + threads + index };
+			for (auto number = index; number < records; number += threads)
+			{
+				this->store_.put(make_key(number, this->settings_.key_size), this->make_value(rng));
+			}
+		});
+		this->inserted_.store(records, std::memory_order_relaxed);
+		return elapsed;
+	}
+
+	// Overwrites random keys, so that the data files hold `count` records that are garbage. Returns the elapsed time.
+	std::chrono::duration<double> overwrite(std::uint64_t count)
+	{
+		const auto threads = this->settings_.threads;
+		const auto records = std::max(this->settings_.records, std::size_t{ 1u });
+		return parallel(threads, [&](std::size_t index) {
+			auto rng = std::mt19937_64{ this->settings_.seed + 2u * threads + index };
+			for (auto n = std::uint64_t{ index }; n < count; n += threads)
+			{
+				const auto number = std::uniform_int_distribution<std::uint64_t>{ 0u, records - 1u }(rng);
+				this->store_.put(make_key(number, this->settings_.key_size), this->make_value(rng));
+			}
+		});
+	}
+
+	std::chrono::duration<double> run(latencies& samples)
+	{
+		auto per_thread = std::vector<latencies>(this->settings_.threads);
+
+		const auto elapsed = parallel(this->settings_.threads, [&](std::size_t index) { this->run_thread(index, per_thread[index]); });
+
+		for (auto& s : per_thread)
+		{
+			samples.merge(s);
+		}
+		return elapsed;
+	}
+};
+
+// ---- --startup
+
+// The data files of the store, in the order in which the store opens them. The last one is the active file.
+std::set<std::string> data_files(const std::filesystem::path& directory)
+{
+	auto names = std::set<std::string>{};
+	for (const auto& entry : std::filesystem::directory_iterator{ directory })
+	{
+		auto name = entry.path().filename().string();
+		if (entry.is_regular_file() && std::regex_match(name, datafile::name_regex))
+		{
+			names.insert(std::move(name));
+		}
+	}
+	return names;
+}
+
+// Writes hint files for the data files, except for the active file. Returns the number of hint files.
+std::size_t write_hints(const std::filesystem::path& directory)
+{
+	const auto names = data_files(directory);
+	auto       count = std::size_t{};
+	for (auto it = names.begin(); it != names.end() && std::next(it) != names.end(); ++it)
+	{
+		datafile{ file::open(directory / *it, O_RDONLY, 0664), file_index_type{} }.write_hint();
+		count += std::filesystem::exists(datafile::hint_path(directory / *it)) ? 1u : 0u;
+	}
+	return count;
+}
+
+// Evicts the files of the store from the page cache. Dirty pages are not evicted, so they are written back first.
+void drop_cache(const std::filesystem::path& directory)
+{
+	::sync();
+	for (const auto& entry : std::filesystem::directory_iterator{ directory })
+	{
+		if (entry.is_regular_file())
+		{
+			file::open(entry.path(), O_RDONLY, 0664)->advise(0, 0, POSIX_FADV_DONTNEED);
+		}
+	}
+}
+
+// A value of /proc/self/status in bytes, e.g. "VmHWM". Zero if it is not there.
+std::uint64_t proc_status_bytes(std::string_view field)
+{
+	auto in   = std::ifstream{ "/proc/self/status" };
+	auto line = std::string{};
+	while (std::getline(in, line))
+	{
+		if (line.starts_with(field) && line.size() > field.size() && line[field.size()] == ':')
+		{
+			return std::strtoull(line.c_str() + field.size() + 1u, nullptr, 10) * 1024u;
+		}
+	}
+	return 0u;
+}
+
+// A counter of /proc/self/io, e.g. "rchar". Zero if it is not there.
+std::uint64_t proc_io(std::string_view field)
+{
+	auto in   = std::ifstream{ "/proc/self/io" };
+	auto line = std::string{};
+	while (std::getline(in, line))
+	{
+		if (line.starts_with(field) && line.size() > field.size() && line[field.size()] == ':')
+		{
+			return std::strtoull(line.c_str() + field.size() + 1u, nullptr, 10);
+		}
+	}
+	return 0u;
+}
+
+// Measured in a child process, so that the memory of the generator does not count.
+struct startup_result final
+{
+	double        seconds;
+	std::uint64_t rss_before;    // bytes resident before the open
+	std::uint64_t peak_rss;      // bytes resident at most, during or after the open
+	bool          peak_reset;    // false if the kernel could not reset the peak, which then includes the time before the open
+	std::uint64_t read_calls;    // bytes read through read system calls, including from the page cache (rchar)
+	std::uint64_t read_storage;  // bytes the open caused to be fetched from storage (read_bytes)
+	std::uint64_t keys;
+	std::uint64_t keydir_memory; // see keydir_stats::memory_usage
+	std::size_t   files;
+	std::uint64_t data_bytes;
+};
+
+startup_result measure_open(const settings& s)
+{
+	// the peak RSS of the parent is inherited at fork, writing 5 to clear_refs resets it
+	auto       result = startup_result{};
+	const auto reset  = [] {
+		auto out = std::ofstream{ "/proc/self/clear_refs" };
+		out << "5";
+		out.flush();
+		return static_cast<bool>(out);
+	}();
+
+	result.peak_reset       = reset;
+	result.rss_before       = proc_status_bytes("VmRSS");
+	const auto read_calls   = proc_io("rchar");
+	const auto read_storage = proc_io("read_bytes");
+	const auto start        = clock_type::now();
+	const auto store        = bitcask{ s.directory, s.store };
+	result.seconds          = std::chrono::duration<double>{ clock_type::now() - start }.count();
+	result.read_calls       = proc_io("rchar") - read_calls;
+	result.read_storage     = proc_io("read_bytes") - read_storage;
+	result.peak_rss         = proc_status_bytes("VmHWM");
+
+	const auto m         = store.metrics();
+	result.keys          = m.keydir.keys;
+	result.keydir_memory = m.keydir.memory_usage;
+	result.files         = m.data.files;
+	result.data_bytes    = m.data.bytes;
+	return result;
+}
+
+startup_result measure_open_in_child(const settings& s)
+{
+	int fds[2];
+	if (::pipe(fds) != 0)
+	{
+		throw std::runtime_error{ "pipe failed" };
+	}
+
+	const auto pid = ::fork();
+	if (pid < 0)
+	{
+		throw std::runtime_error{ "fork failed" };
+	}
+	if (pid == 0)
+	{
+		::close(fds[0]);
+		auto status = 1;
+		try
+		{
+			const auto result = measure_open(s);
+			status            = ::write(fds[1], &result, sizeof(result)) == sizeof(result) ? 0 : 1;
+		}
+		catch (const std::exception& e)
+		{
+			fmt::print(stderr, "error: open: {}\n", e.what());
+		}
+		::_exit(status);
+	}
+
+	::close(fds[1]);
+	auto       result = startup_result{};
+	const auto n      = ::read(fds[0], &result, sizeof(result));
+	::close(fds[0]);
+
+	auto status = 0;
+	::waitpid(pid, &status, 0);
+	if (n != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		throw std::runtime_error{ "the process that opened the store failed" };
+	}
+	return result;
+}
+
+void print_startup_results(std::ostream&                 out,
+                           const settings&               s,
+                           std::uint64_t                 garbage_records,
+                           std::size_t                   hint_files,
+                           std::chrono::duration<double> generate_time,
+                           const startup_result&         r)
+{
+	fmt::print(out, "{{\n");
+	fmt::print(out, R"(  "mode": "startup",)" "\n");
+	fmt::print(out, R"(  "records": {},)" "\n", s.records);
+	fmt::print(out, R"(  "garbage_records": {},)" "\n", garbage_records);
+	fmt::print(out, R"(  "key_size": {},)" "\n", s.key_size);
+	fmt::print(out, R"(  "value_size": "{}",)" "\n", s.value_size.to_string());
+	fmt::print(out, R"(  "files": {},)" "\n", r.files);
+	fmt::print(out, R"(  "hint_files": {},)" "\n", hint_files);
+	fmt::print(out, R"(  "data_bytes": {},)" "\n", r.data_bytes);
+	fmt::print(out, R"(  "cold": {},)" "\n", s.cold);
+	fmt::print(out, R"(  "generate": {{"seconds": {:.3f}}},)" "\n", generate_time.count());
+	fmt::print(out,
+	           R"(  "open": {{"seconds": {:.6f}, "keys": {}, "keydir_memory_bytes": {}, "rss_before_bytes": {}, "peak_rss_bytes": {}, )"
+	           R"("peak_rss_reset": {}, "read_call_bytes": {}, "read_storage_bytes": {}}})"
+	           "\n",
+	           r.seconds,
+	           r.keys,
+	           r.keydir_memory,
+	           r.rss_before,
+	           r.peak_rss,
+	           r.peak_reset,
+	           r.read_calls,
+	           r.read_storage);
+	fmt::print(out, "}}\n");
+}
+
+// Generates the store and measures opening it, see --startup.
+void run_startup(settings s)
+{
+	const auto garbage_records =
+	    static_cast<std::uint64_t>(std::llround(static_cast<double>(s.records) * s.garbage / (1.0 - s.garbage)));
+
+	// spread the records over the requested number of files
+	const auto record_size = record_header::size + s.key_size + (s.value_size.min + s.value_size.max) / 2u;
+	const auto data_bytes  = (s.records + garbage_records) * record_size;
+	s.max_file_size        = static_cast<off64_t>(std::max(data_bytes / s.files, std::uint64_t{ 1u }));
+
+	auto generate_time = std::chrono::duration<double>{};
+	{
+		auto r = runner{ s };
+		fmt::print(stderr, "generating {} records and {} garbage records\n", s.records, garbage_records);
+		generate_time = r.load();
+		generate_time += r.overwrite(garbage_records);
+	}
+
+	const auto hint_files = s.hints ? write_hints(s.directory) : std::size_t{};
+	if (s.cold)
+	{
+		drop_cache(s.directory);
+	}
+
+	fmt::print(stderr, "opening\n");
+	const auto result = measure_open_in_child(s);
+
+	if (s.output.empty())
+	{
+		print_startup_results(std::cout, s, garbage_records, hint_files, generate_time, result);
+	}
+	else
+	{
+		auto out = std::ofstream{ s.output };
+		print_startup_results(out, s, garbage_records, hint_files, generate_time, result);
+	}
+}
+
+void print_latency(std::ostream& out, const histogram& h)
+{
+	fmt::print(out,
+	           R"({{"count": {}, "mean": {:.0f}, "p50": {}, "p90": {}, "p99": {}, "p99.9": {}, "max": {}}})",
+	           h.count(),
+	           h.mean(),
+	           h.percentile(50.0),
+	           h.percentile(90.0),
+	           h.percentile(99.0),
+	           h.percentile(99.9),
+	           h.max());
+}
+
+void print_results(std::ostream&                 out,
+                   const settings&               s,
+                   std::chrono::duration<double> load_time,
+                   std::chrono::duration<double> run_time,
+                   const latencies&              samples)
+{
+	auto operations = std::uint64_t{};
+	for (const auto& h : samples.ns)
+	{
+		operations += h.count();
+	}
+
+	const auto distribution = s.distribution.value_or(s.load.distribution);
+
+	fmt::print(out, "{{\n");
+	fmt::print(out, R"(  "workload": "{}",)" "\n", s.load.name);
+	fmt::print(out,
+	           R"(  "distribution": "{}",)"
+	           "\n",
+	           distribution == key_distribution::uniform   ? "uniform"
+	           : distribution == key_distribution::zipfian ? "zipfian"
+	                                                       : "latest");
+	fmt::print(out, R"(  "records": {},)" "\n", s.records);
+	fmt::print(out, R"(  "threads": {},)" "\n", s.threads);
+	fmt::print(out, R"(  "key_size": {},)" "\n", s.key_size);
+	fmt::print(out, R"(  "value_size": "{}",)" "\n", s.value_size.to_string());
+	fmt::print(out, R"(  "load": {{"seconds": {:.3f}, "ops_per_sec": {:.0f}}},)" "\n", load_time.count(), static_cast<double>(s.records) / load_time.count());
+	fmt::print(out,
+	           R"(  "run": {{"seconds": {:.3f}, "operations": {}, "ops_per_sec": {:.0f}}},)"
+	           "\n",
+	           run_time.count(),
+	           operations,
+	           static_cast<double>(operations) / run_time.count());
+	fmt::print(out, R"(  "latency_ns": {{)");
+
+	auto first = true;
+	for (auto i = std::size_t{}; i < operation_count; ++i)
+	{
+		if (!samples.ns[i].count())
+		{
+			continue;
+		}
+		fmt::print(out, "{}\n    \"{}\": ", first ? "" : ",", operation_names[i]);
+		print_latency(out, samples.ns[i]);
+		first = false;
+	}
+	fmt::print(out, "\n  }}\n}}\n");
+}
+
+void usage()
+{
+	fmt::print(stderr,
+	           "usage: bitcask_bench [options]\n"
+	           "  --workload=a|b|c|d|e|f        YCSB core workload (default a)\n"
+	           "  --distribution=uniform|zipfian|latest\n"
+	           "                                key choice, default as in YCSB for the workload\n"
+	           "  --records=N                   keys loaded before the run (default 100000)\n"
+	           "  --operations=N                operations in the run (default 1000000)\n"
+	           "  --duration=SECONDS            run for a time instead of a number of operations\n"
+	           "  --threads=N                   (default 1)\n"
+	           "  --key-size=N                  bytes (default 24), at least 4 plus the digits of the largest key number\n"
+	           "  --value-size=N|MIN-MAX        bytes, fixed or uniformly distributed (default 100)\n"
+	           "  --max-scan-length=N           workload e (default 100)\n"
+	           "  --seed=N                      (default 1)\n"
+	           "  --dir=PATH                    store directory, cleared first (default /tmp/bitcask_bench)\n"
+	           "  --output=FILE                 JSON results (default stdout)\n"
+	           "  --lock-stats                  print the lock statistics of the run, needs a build with BITCASK_LOCK_STATS\n"
+	           "  --trace=FILE                  Chrome trace of sampled operations of the load and the run\n"
+	           "  --trace-sample-rate=N         trace one in N operations per thread (default 1000)\n"
+	           "startup mode:\n"
+	           "  --startup                     generate a store of --records keys and measure opening it\n"
+	           "  --files=N                     data files of the generated store (default 16)\n"
+	           "  --hints                       write hint files for all but the active data file\n"
+	           "  --garbage=RATIO               fraction of the records on disk that are overwritten versions (default 0)\n"
+	           "  --cold                        evict the store from the page cache before opening it\n"
+	           "store options:\n"
+	           "  --keydir=hashed|concurrent|ordered|compact|hash_only|mapped\n"
+	           "  --value-cache=BYTES  --max-file-size=BYTES\n"
+	           "  --filter  --preallocate  --writer-thread  --direct-merge-io  --direct-cold-reads\n");
+}
+
+std::size_t parse_number(std::string_view name, std::string_view text)
+{
+	auto value        = std::size_t{};
+	const auto [p, e] = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (e != std::errc{} || p != text.data() + text.size())
+	{
+		throw std::runtime_error{ fmt::format("--{}: not a number: {}", name, text) };
+	}
+	return value;
+}
+
+// A number in [0, 1).
+double parse_ratio(std::string_view name, std::string_view text)
+{
+	auto value        = 0.0;
+	const auto [p, e] = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (e != std::errc{} || p != text.data() + text.size() || value < 0.0 || value >= 1.0)
+	{
+		throw std::runtime_error{ fmt::format("--{}: not a number in [0, 1): {}", name, text) };
+	}
+	return value;
+}
+
+settings parse_command_line(int argc, char** argv)
+{
+	auto s = settings{};
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		const auto arg = std::string_view{ argv[i] };
+		if (!arg.starts_with("--"))
+		{
+			throw std::runtime_error{ fmt::format("unexpected argument: {}", arg) };
+		}
+
+		const auto eq    = arg.find('=');
+		const auto name  = arg.substr(2u, eq == std::string_view::npos ? std::string_view::npos : eq - 2u);
+		const auto value = eq == std::string_view::npos ? std::string_view{} : arg.substr(eq + 1u);
+
+		if (name == "workload")
+		{
+			const auto it = std::find_if(workloads.begin(), workloads.end(), [&](const auto& w) { return value.size() == 1u && w.name == value[0]; });
+			if (it == workloads.end())
+			{
+				throw std::runtime_error{ fmt::format("--workload: unknown workload: {}", value) };
+			}
+			s.load = *it;
+		}
+		else if (name == "distribution")
+		{
+			const auto distributions = std::map<std::string_view, key_distribution>{
+				{ "uniform", key_distribution::uniform }, { "zipfian", key_distribution::zipfian }, { "latest", key_distribution::latest }
+			};
+			const auto it = distributions.find(value);
+			if (it == distributions.end())
+			{
+				throw std::runtime_error{ fmt::format("--distribution: unknown distribution: {}", value) };
+			}
+			s.distribution = it->second;
+		}
+		else if (name == "records")
+		{
+			s.records = parse_number(name, value);
+		}
+		else if (name == "operations")
+		{
+			s.operations = parse_number(name, value);
+		}
+		else if (name == "duration")
+		{
+			s.duration = std::chrono::seconds{ parse_number(name, value) };
+		}
+		else if (name == "threads")
+		{
+			s.threads = std::max(parse_number(name, value), std::size_t{ 1u });
+		}
+		else if (name == "key-size")
+		{
+			s.key_size = parse_number(name, value);
+		}
+		else if (name == "value-size")
+		{
+			const auto dash = value.find('-');
+			s.value_size.min = parse_number(name, value.substr(0u, dash));
+			s.value_size.max = dash == std::string_view::npos ? s.value_size.min : parse_number(name, value.substr(dash + 1u));
+			if (s.value_size.min > s.value_size.max)
+			{
+				throw std::runtime_error{ "--value-size: MIN exceeds MAX" };
+			}
+		}
+		else if (name == "max-scan-length")
+		{
+			s.max_scan_length = std::max(parse_number(name, value), std::size_t{ 1u });
+		}
+		else if (name == "seed")
+		{
+			s.seed = parse_number(name, value);
+		}
+		else if (name == "dir")
+		{
+			s.directory = value;
+		}
+		else if (name == "output")
+		{
+			s.output = value;
+		}
+		else if (name == "lock-stats")
+		{
+			s.lock_stats = true;
+		}
+		else if (name == "trace")
+		{
+			s.store.tracer = std::make_shared<chrome_trace_writer>(std::filesystem::path{ value });
+		}
+		else if (name == "trace-sample-rate")
+		{
+			s.store.trace_sample_rate = static_cast<std::uint32_t>(std::max(parse_number(name, value), std::size_t{ 1u }));
+		}
+		else if (name == "startup")
+		{
+			s.startup = true;
+		}
+		else if (name == "files")
+		{
+			s.files = std::max(parse_number(name, value), std::size_t{ 1u });
+		}
+		else if (name == "hints")
+		{
+			s.hints = true;
+		}
+		else if (name == "garbage")
+		{
+			s.garbage = parse_ratio(name, value);
+		}
+		else if (name == "cold")
+		{
+			s.cold = true;
+		}
+		else if (name == "keydir")
+		{
+			const auto modes = std::map<std::string_view, keydir_mode>{
+				{ "hashed", keydir_mode::hashed },   { "concurrent", keydir_mode::concurrent }, { "ordered", keydir_mode::ordered },
+				{ "compact", keydir_mode::compact }, { "hash_only", keydir_mode::hash_only },   { "mapped", keydir_mode::mapped }
+			};
+			const auto it = modes.find(value);
+			if (it == modes.end())
+			{
+				throw std::runtime_error{ fmt::format("--keydir: unknown mode: {}", value) };
+			}
+			s.store.keydir = it->second;
+		}
+		else if (name == "value-cache")
+		{
+			s.store.value_cache_size = parse_number(name, value);
+		}
+		else if (name == "max-file-size")
+		{
+			s.max_file_size = static_cast<off64_t>(parse_number(name, value));
+		}
+		else if (name == "filter")
+		{
+			s.store.negative_lookup_filter = true;
+		}
+		else if (name == "preallocate")
+		{
+			s.store.preallocate_data_files = true;
+		}
+		else if (name == "writer-thread")
+		{
+			s.store.writer_thread = true;
+		}
+		else if (name == "direct-merge-io")
+		{
+			s.store.direct_merge_io = true;
+		}
+		else if (name == "direct-cold-reads")
+		{
+			s.store.direct_cold_reads = true;
+		}
+		else if (name == "help")
+		{
+			usage();
+			std::exit(0);
+		}
+		else
+		{
+			throw std::runtime_error{ fmt::format("unknown option: --{}", name) };
+		}
+	}
+
+	// Inserts during a timed run are not known in advance, their keys are longer if they need more digits.
+	auto max_number = std::max(s.records, std::size_t{ 1u }) - 1u;
+	if (!s.startup && s.load.mix[static_cast<std::size_t>(operation::insert)] > 0.0 && !s.duration.count())
+	{
+		max_number += s.operations;
+	}
+	if (s.key_size < key_size_needed(max_number))
+	{
+		throw std::runtime_error{ fmt::format("--key-size: {} bytes cannot hold the key number {}, at least {} are needed",
+		                                      s.key_size,
+		                                      max_number,
+		                                      key_size_needed(max_number)) };
+	}
+
+	if (!s.startup && s.load.mix[static_cast<std::size_t>(operation::scan)] > 0.0 && s.store.keydir != keydir_mode::ordered
+	    && s.store.keydir != keydir_mode::compact)
+	{
+		throw std::runtime_error{ "workload e scans, which requires --keydir=ordered or --keydir=compact" };
+	}
+
+#ifndef BITCASK_THREAD_SAFE
+	if (s.threads > 1u)
+	{
+		throw std::runtime_error{ "more than one thread requires a build with BITCASK_THREAD_SAFE" };
+	}
+#endif
+
+	return s;
+}
+
+} // namespace bench
+} // namespace bitcask
+
+int main(int argc, char** argv)
+{
+	using namespace bitcask::bench;
+
+	try
+	{
+		const auto s = parse_command_line(argc, argv);
+		if (s.startup)
+		{
+			run_startup(s);
+			return 0;
+		}
+
+		auto r = runner{ s };
+
+		fmt::print(stderr, "loading {} records\n", s.records);
+		const auto load_time = r.load();
+
+		fmt::print(stderr, "running workload {}\n", s.load.name);
+		bitcask::reset_lock_statistics();
+		auto       samples  = latencies{};
+		const auto run_time = r.run(samples);
+
+		if (s.lock_stats)
+		{
+			fmt::print(stderr, "{}", bitcask::format_lock_statistics(bitcask::lock_statistics()));
+		}
+
+		if (s.output.empty())
+		{
+			print_results(std::cout, s, load_time, run_time, samples);
+		}
+		else
+		{
+			auto out = std::ofstream{ s.output };
+			print_results(out, s, load_time, run_time, samples);
+		}
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		fmt::print(stderr, "error: {}\n", e.what());
+		usage();
+		return 1;
+	}
+}
@@ -8,20 +8,316 @@
 #include "bitcask.h"
 #include "datadir.h"
 #include "keydir.h"
+#include "writequeue.h"
+#include "epoch.hpp"
+#include "perthread.hpp"
+#include "tracing.h"
+#include "locktypes.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 namespace bitcask {
 
+namespace {
+
+// The smallest string that is greater than all strings starting with `prefix`.
+// Empty if there is no such string (i.e. the scan has no upper bound).
+std::string prefix_successor(std::string_view prefix)
+{
+	auto result = std::string{ prefix };
+	while (!result.empty())
+	{
+		auto& last = reinterpret_cast<unsigned char&>(result.back());
+		if (last != 0xffu)
+		{
+			++last;
+			break;
+		}
+		result.pop_back();
+	}
+	return result;
+}
+
+// Samples one in `rate` operations of the calling thread.
+bool sample_trace(std::uint32_t rate)
+{
+	thread_local auto operations = std::uint32_t{};
+	return ++operations % rate == 0u;
+}
+
+// Numbers the threads in the traces.
+std::uint32_t trace_thread_id()
+{
+	static auto             next = std::atomic<std::uint32_t>{};
+	thread_local const auto id   = next.fetch_add(1u, std::memory_order_relaxed) + 1u;
+	return id;
+}
+
+// The counters of one thread, see bitcask::metrics.
+struct thread_counters final
+{
+	local_counter gets{};
+	local_counter get_misses{};
+	local_counter puts{};
+	local_counter dels{};
+	local_counter bytes_read{};
+	local_counter bytes_written{};
+};
+
+// The latencies recorded by one thread. The lock is only contended while bitcask::latencies merges them.
+struct thread_latencies final
+{
+	mutable locker guard{ "bitcask.latencies" };
+	latency_stats  stats{};
+};
+
+} // namespace
+
 class bitcask::impl
 {
-	datadir datadir_;
-	keydir  keydir_;
+	datadir                      datadir_;
+	keydir                       keydir_;
+	std::unique_ptr<valuecache>  cache_;
+	io_mode                      cold_read_mode_; // for values that are not in the value cache
+	bool                         check_keys_;
+	bool                         persist_keydir_;
+	std::unique_ptr<write_queue> writer_;
+	recovery_report              recovery_;
+
+	per_thread<thread_counters>                   counters_;
+	std::unique_ptr<per_thread<thread_latencies>> latencies_; // none unless options::record_latencies
+	std::shared_ptr<trace_hook>                   tracer_;
+	std::uint32_t                                 trace_sample_rate_;
+
+	// With keydir_mode::hash_only, the keydir does not read the key back if only one entry has its hash,
+	// so the key of the record is checked here. The key is read together with the value, and the cache
+	// holds records (key and value) instead of values.
+	std::optional<value_type> get_checked(const std::string_view& key)
+	{
+		const auto info = traced_phase(trace_phase::keydir, [&] { return this->keydir_.get_unchecked(key); });
+		if (!info)
+		{
+			return std::nullopt;
+		}
+
+		auto record = std::optional<value_type>{};
+		if (this->cache_)
+		{
+			record = traced_phase(trace_phase::cache, [&] { return this->cache_->get(info->file_id, info->value_pos); });
+		}
+		if (!record)
+		{
+			record = this->datadir_.get_record(info.value(), this->cold_read_mode_);
+			this->counters_.local().bytes_read.add(record->size());
+			if (this->cache_)
+			{
+				traced_phase(trace_phase::cache, [&] { this->cache_->put(info->file_id, info->value_pos, record.value()); });
+			}
+		}
+
+		if (std::string_view{ record.value() }.substr(0u, info->ksz) != key)
+		{
+			return std::nullopt;
+		}
+		record->erase(0u, info->ksz);
+		return record;
+	}
+
+	template<typename Fn>
+	auto timed(histogram latency_stats::*which, Fn&& fn)
+	{
+		if (!this->latencies_)
+		{
+			return fn();
+		}
+
+		const auto start  = std::chrono::steady_clock::now();
+		auto       result = fn();
+		const auto ns     = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+		auto&      local = this->latencies_->local();
+		const auto lock  = local.guard.lock();
+		(void)(lock);
+		(local.stats.*which).record(static_cast<std::uint64_t>(ns));
+
+		return result;
+	}
+
+	// Traces one in trace_sample_rate_ operations of each thread.
+	template<typename Fn>
+	auto traced(std::string_view operation, const std::string_view& key, Fn&& fn)
+	{
+		if (!this->tracer_ || !sample_trace(this->trace_sample_rate_) || current_trace())
+		{
+			return fn();
+		}
+
+		auto trace = operation_trace{ .operation = operation,
+			                          .key       = std::string{ key },
+			                          .thread    = trace_thread_id(),
+			                          .start     = std::chrono::steady_clock::now(),
+			                          .duration  = {},
+			                          .spans     = {} };
+		trace.spans.reserve(16u);
+
+		current_trace() = &trace;
+		auto result     = [&] {
+			try
+			{
+				return fn();
+			}
+			catch (...)
+			{
+				current_trace() = nullptr;
+				throw;
+			}
+		}();
+		current_trace() = nullptr;
+
+		trace.duration = std::chrono::steady_clock::now() - trace.start;
+		try
+		{
+			this->tracer_->on_operation(trace);
+		}
+		catch (...)
+		{
+			// the operation has succeeded, only its trace is lost
+		}
+		return result;
+	}
+
+	std::optional<value_type> lookup(const std::string_view& key)
+	{
+		if (this->check_keys_)
+		{
+			return this->get_checked(key);
+		}
+
+		const auto info = traced_phase(trace_phase::keydir, [&] { return this->keydir_.get(key); });
+		if (info)
+		{
+			if (!this->cache_ || !info->value_sz)
+			{
+				this->counters_.local().bytes_read.add(info->value_sz);
+				return this->datadir_.get(info.value(), this->cold_read_mode_);
+			}
+
+			auto value = traced_phase(trace_phase::cache, [&] { return this->cache_->get(info->file_id, info->value_pos); });
+			if (!value)
+			{
+				value = this->datadir_.get(info.value(), this->cold_read_mode_);
+				traced_phase(trace_phase::cache, [&] { this->cache_->put(info->file_id, info->value_pos, value.value()); });
+				this->counters_.local().bytes_read.add(value->size());
+			}
+			return value;
+		}
+		else
+		{
+			return std::nullopt;
+		}
+	}
+
+	bool write(const std::string_view& key, const std::string_view& value)
+	{
+		if (this->writer_)
+		{
+			return traced_phase(trace_phase::queue, [&] { return this->writer_->put(key, value).get(); });
+		}
+
+		const auto version = traced_phase(trace_phase::keydir, [&] { return this->keydir_.next_version(); });
+		auto       info    = this->datadir_.put(key, value, version);
+		return traced_phase(trace_phase::keydir, [&] { return this->keydir_.put(key, std::move(info)); });
+	}
+
+	bool erase(const std::string_view& key)
+	{
+		if (this->writer_)
+		{
+			// The writer skips the tombstone for keys that are known to be absent, assume it does for all absent keys.
+			const auto deleted = traced_phase(trace_phase::queue, [&] { return this->writer_->del(key).get(); });
+			if (deleted)
+			{
+				this->counters_.local().bytes_written.add(key.size());
+			}
+			return deleted;
+		}
+
+		// No need to write a tombstone for a key that is known to be absent.
+		if (!traced_phase(trace_phase::keydir, [&] { return this->keydir_.may_contain(key); }))
+		{
+			return false;
+		}
+
+		this->datadir_.del(key, traced_phase(trace_phase::keydir, [&] { return this->keydir_.next_version(); }));
+		this->counters_.local().bytes_written.add(key.size());
+		return traced_phase(trace_phase::keydir, [&] { return this->keydir_.del(key); });
+	}
+
+	keydir_context make_keydir_context(const std::filesystem::path& directory, const options& opts)
+	{
+		return keydir_context{ .directory   = directory,
+			                   .fingerprint = opts.keydir == keydir_mode::mapped ? this->datadir_.fingerprint() : 0u,
+			                   .read_key    = [this](const keydir_info& info) { return this->datadir_.get_key(info); } };
+	}
 
 public:
-	explicit impl(const std::filesystem::path& directory)
-	    : datadir_{ directory }
-	    , keydir_{}
+	explicit impl(const std::filesystem::path& directory, const options& opts)
+	    : datadir_{ directory, opts }
+	    , keydir_{ opts, this->make_keydir_context(directory, opts) }
+	    , cache_{ opts.value_cache_size ? std::make_unique<valuecache>(opts.value_cache_size) : nullptr }
+	    , cold_read_mode_{ opts.direct_cold_reads ? io_mode::direct : io_mode::cached }
+	    , check_keys_{ opts.keydir == keydir_mode::hash_only }
+	    , persist_keydir_{ opts.keydir == keydir_mode::mapped }
+	    , writer_{}
+	    , recovery_{}
+	    , counters_{}
+	    , latencies_{ opts.record_latencies ? std::make_unique<per_thread<thread_latencies>>() : nullptr }
+	    , tracer_{ opts.tracer }
+	    , trace_sample_rate_{ std::max(opts.trace_sample_rate, std::uint32_t{ 1u }) }
+	{
+		if (!this->keydir_.restored())
+		{
+			this->recovery_ = this->datadir_.build_keydir(this->keydir_);
+		}
+		else
+		{
+			// the files are numbered in the order of their ids, which a merge changes
+			this->datadir_.reindex_keydir(this->keydir_);
+		}
+
+		if (opts.writer_thread)
+		{
+			this->writer_ = std::make_unique<write_queue>(this->datadir_, this->keydir_);
+		}
+	}
+
+	~impl() noexcept
 	{
-		this->datadir_.build_keydir(this->keydir_);
+		// apply the queued writes before the keydir is persisted
+		this->writer_.reset();
+
+		try
+		{
+			this->datadir_.trim();
+		}
+		catch (...)
+		{
+			// The zeros are skipped on the next open
+		}
+
+		if (this->persist_keydir_)
+		{
+			try
+			{
+				this->keydir_.persist(this->datadir_.fingerprint());
+			}
+			catch (...)
+			{
+				// The keydir file stays marked dirty and is rebuilt on the next open.
+			}
+		}
 	}
 
 	off64_t max_file_size() const
@@ -41,26 +337,57 @@ public:
 
 	std::optional<value_type> get(const std::string_view& key)
 	{
-		const auto info = this->keydir_.get(key);
-		if (info)
-		{
-			return this->datadir_.get(info.value());
-		}
-		else
+		auto value = this->timed(&latency_stats::get, [&] { return this->traced("get", key, [&] { return this->lookup(key); }); });
+
+		auto& counters = this->counters_.local();
+		counters.gets.add();
+		if (!value)
 		{
-			return std::nullopt;
+			counters.get_misses.add();
 		}
+		return value;
 	}
 
 	bool put(const std::string_view& key, const std::string_view& value)
 	{
-		return this->keydir_.put(key, this->datadir_.put(key, value, this->keydir_.next_version()));
+		const auto inserted =
+		    this->timed(&latency_stats::put, [&] { return this->traced("put", key, [&] { return this->write(key, value); }); });
+
+		auto& counters = this->counters_.local();
+		counters.puts.add();
+		counters.bytes_written.add(key.size() + value.size());
+		return inserted;
 	}
 
 	bool del(const std::string_view& key)
 	{
-		this->datadir_.del(key, this->keydir_.next_version());
-		return this->keydir_.del(key);
+		const auto deleted = this->timed(&latency_stats::del, [&] { return this->traced("del", key, [&] { return this->erase(key); }); });
+		this->counters_.local().dels.add();
+		return deleted;
+	}
+
+	std::future<bool> put_async(const std::string_view& key, const std::string_view& value)
+	{
+		if (this->writer_)
+		{
+			return this->writer_->put(key, value);
+		}
+
+		auto result = std::promise<bool>{};
+		result.set_value(this->put(key, value));
+		return result.get_future();
+	}
+
+	std::future<bool> del_async(const std::string_view& key)
+	{
+		if (this->writer_)
+		{
+			return this->writer_->del(key);
+		}
+
+		auto result = std::promise<bool>{};
+		result.set_value(this->del(key));
+		return result.get_future();
 	}
 
 	bool traverse(std::function<bool(const std::string_view& key, const std::string_view& value)> callback)
@@ -68,6 +395,82 @@ public:
 		return this->keydir_.traverse([&](const auto& key, const auto& info) { return callback(key, this->datadir_.get(info)); });
 	}
 
+	bool scan(const std::string_view&                                                         begin,
+	          const std::string_view&                                                         end,
+	          std::function<bool(const std::string_view& key, const std::string_view& value)> callback)
+	{
+		return this->keydir_.scan(begin, end, [&](const auto& key, const auto& info) { return callback(key, this->datadir_.get(info)); });
+	}
+
+	bool scan_prefix(const std::string_view& prefix, std::function<bool(const std::string_view& key, const std::string_view& value)> callback)
+	{
+		return this->scan(prefix, prefix_successor(prefix), callback);
+	}
+
+	keydir_stats keydir_statistics() const
+	{
+		return this->keydir_.statistics();
+	}
+
+	valuecache::stats value_cache_stats() const
+	{
+		return this->cache_ ? this->cache_->statistics() : valuecache::stats{};
+	}
+
+	latency_stats latencies() const
+	{
+		auto result = latency_stats{};
+		if (this->latencies_)
+		{
+			this->latencies_->for_each([&](const thread_latencies& local) {
+				const auto lock = local.guard.lock();
+				(void)(lock);
+				result.merge(local.stats);
+			});
+		}
+		return result;
+	}
+
+	store_metrics metrics() const
+	{
+		auto result = store_metrics{ .gets          = 0u,
+			                         .get_misses    = 0u,
+			                         .puts          = 0u,
+			                         .dels          = 0u,
+			                         .bytes_read    = 0u,
+			                         .bytes_written = 0u,
+			                         .keydir        = this->keydir_.statistics(),
+			                         .data          = this->datadir_.statistics(),
+			                         .value_cache   = this->value_cache_stats(),
+			                         .latencies     = std::nullopt,
+			                         .locks         = lock_statistics() };
+
+		this->counters_.for_each([&](const thread_counters& local) {
+			result.gets += local.gets.get();
+			result.get_misses += local.get_misses.get();
+			result.puts += local.puts.get();
+			result.dels += local.dels.get();
+			result.bytes_read += local.bytes_read.get();
+			result.bytes_written += local.bytes_written.get();
+		});
+
+		if (this->latencies_)
+		{
+			result.latencies = this->latencies();
+		}
+		return result;
+	}
+
+	recovery_report recovery() const
+	{
+		return this->recovery_;
+	}
+
+	void warm(const warm_policy& policy)
+	{
+		return this->datadir_.warm(policy);
+	}
+
 	void merge()
 	{
 		return this->datadir_.merge(this->keydir_);
@@ -79,13 +482,16 @@ public:
 	}
 };
 
-bitcask::bitcask(const std::filesystem::path& directory)
-    : pimpl_{ std::make_unique<impl>(directory) }
+bitcask::bitcask(const std::filesystem::path& directory, const options& opts)
+    : pimpl_{ std::make_unique<impl>(directory, opts) }
 {
 }
 
 bitcask::~bitcask() noexcept
 {
+	// what the store has retired is freed now, rather than with the retirements of another store
+	this->pimpl_.reset();
+	epoch_domain::instance().collect();
 }
 
 off64_t bitcask::max_file_size() const
@@ -118,11 +524,63 @@ bool bitcask::del(const std::string_view& key)
 	return this->pimpl_->del(key);
 }
 
+std::future<bool> bitcask::put_async(const std::string_view& key, const std::string_view& value)
+{
+	return this->pimpl_->put_async(key, value);
+}
+
+std::future<bool> bitcask::del_async(const std::string_view& key)
+{
+	return this->pimpl_->del_async(key);
+}
+
 bool bitcask::traverse(std::function<bool(const std::string_view&, const std::string_view&)> callback)
 {
 	return this->pimpl_->traverse(callback);
 }
 
+bool bitcask::scan(const std::string_view&                                               begin,
+                   const std::string_view&                                               end,
+                   std::function<bool(const std::string_view&, const std::string_view&)> callback)
+{
+	return this->pimpl_->scan(begin, end, callback);
+}
+
+bool bitcask::scan_prefix(const std::string_view& prefix, std::function<bool(const std::string_view&, const std::string_view&)> callback)
+{
+	return this->pimpl_->scan_prefix(prefix, callback);
+}
+
+keydir_stats bitcask::keydir_statistics() const
+{
+	return this->pimpl_->keydir_statistics();
+}
+
+valuecache::stats bitcask::value_cache_stats() const
+{
+	return this->pimpl_->value_cache_stats();
+}
+
+latency_stats bitcask::latencies() const
+{
+	return this->pimpl_->latencies();
+}
+
+store_metrics bitcask::metrics() const
+{
+	return this->pimpl_->metrics();
+}
+
+recovery_report bitcask::recovery() const
+{
+	return this->pimpl_->recovery();
+}
+
+void bitcask::warm(const warm_policy& policy)
+{
+	return this->pimpl_->warm(policy);
+}
+
 void bitcask::merge()
 {
 	return this->pimpl_->merge();
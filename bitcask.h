@@ -8,11 +8,17 @@
 #pragma once
 
 #include "basictypes.h"
+#include "options.h"
+#include "valuecache.h"
+#include "keydir.h"
+#include "recovery.h"
+#include "metrics.h"
 
 #include <filesystem>
 #include <memory>
 #include <optional>
 #include <functional>
+#include <future>
 
 namespace bitcask {
 
@@ -22,7 +28,7 @@ class bitcask final
 	std::unique_ptr<impl> pimpl_;
 
 public:
-	explicit bitcask(const std::filesystem::path& directory);
+	explicit bitcask(const std::filesystem::path& directory, const options& opts = options{});
 	~bitcask() noexcept;
 
 	bitcask(bitcask&&)            = default;
@@ -44,8 +50,45 @@ public:
 	/// Returns true if the key was deleted, false if the key did not exist.
 	bool del(const std::string_view& key);
 
+	/// Like put, but with options::writer_thread, returns as soon as the request is queued.
+	/// The write is visible to get once the future is ready.
+	std::future<bool> put_async(const std::string_view& key, const std::string_view& value);
+
+	/// Like del, but with options::writer_thread, returns as soon as the request is queued.
+	std::future<bool> del_async(const std::string_view& key);
+
 	bool traverse(std::function<bool(const std::string_view& key, const std::string_view& value)> callback);
 
+	/// Visits the keys in [begin, end) in key order. An empty `end` means no upper bound.
+	/// Requires keydir_mode::ordered or keydir_mode::compact.
+	bool scan(const std::string_view&                                                         begin,
+	          const std::string_view&                                                         end,
+	          std::function<bool(const std::string_view& key, const std::string_view& value)> callback);
+
+	/// Visits the keys that start with `prefix` in key order.
+	/// Requires keydir_mode::ordered or keydir_mode::compact.
+	bool scan_prefix(const std::string_view& prefix, std::function<bool(const std::string_view& key, const std::string_view& value)> callback);
+
+	/// Number of keys and memory used by the keydir.
+	keydir_stats keydir_statistics() const;
+
+	/// Hit/miss counters of the value cache. All zero if the cache is disabled.
+	valuecache::stats value_cache_stats() const;
+
+	/// Empty histograms unless options::record_latencies is set.
+	latency_stats latencies() const;
+
+	/// Counters and sizes for monitoring, see to_prometheus. Cheap enough to be taken every few seconds.
+	store_metrics metrics() const;
+
+	/// Damaged records that were skipped when the store was opened, e.g. an append that was torn by a crash.
+	recovery_report recovery() const;
+
+	/// Asks the kernel to read the selected data files into the page cache, in the background,
+	/// e.g. right after opening, so that the first gets do not all wait for the disk.
+	/// Merge drops the files it has compacted from the page cache by itself.
+	void warm(const warm_policy& policy = warm_policy{});
+
 	// maintenance
 	void merge();
 
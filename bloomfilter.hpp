@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// Split block Bloom filter: every key sets one bit in each of the 8 words of a single 32 byte block,
+// so a lookup touches one cache line. The words are atomics, so that lookups may run concurrently
+// with insertions without taking a lock.
+class bloom_filter final
+{
+	static constexpr auto words_per_block = 8u;
+	static constexpr auto bits_per_key    = 16u;
+
+	struct alignas(32) block
+	{
+		std::array<std::atomic<std::uint32_t>, words_per_block> words;
+	};
+
+	std::size_t              capacity_;
+	std::size_t              mask_;
+	std::unique_ptr<block[]> blocks_;
+
+	static std::uint32_t bit(std::uint64_t hash, unsigned word)
+	{
+		static constexpr auto salts = std::array<std::uint32_t, words_per_block>{
+			0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+		};
+		return std::uint32_t{ 1u } << ((static_cast<std::uint32_t>(hash) * salts[word]) >> 27);
+	}
+
+	const block& block_for(std::uint64_t hash) const
+	{
+		return this->blocks_[(hash >> 32) & this->mask_];
+	}
+
+	block& block_for(std::uint64_t hash)
+	{
+		return this->blocks_[(hash >> 32) & this->mask_];
+	}
+
+public:
+	/// The filter keeps its false positive rate below 1% up to `capacity` keys.
+	explicit bloom_filter(std::size_t capacity)
+	    : capacity_{ std::bit_ceil(std::max(capacity, std::size_t{ 1024u })) }
+	    , mask_{ this->capacity_ * bits_per_key / (words_per_block * 32u) - 1u }
+	    , blocks_{ std::make_unique<block[]>(this->mask_ + 1u) }
+	{
+	}
+
+	std::size_t capacity() const noexcept
+	{
+		return this->capacity_;
+	}
+
+	std::size_t memory_usage() const noexcept
+	{
+		return (this->mask_ + 1u) * sizeof(block);
+	}
+
+	void insert(std::uint64_t hash) noexcept
+	{
+		auto& b = this->block_for(hash);
+		for (auto i = 0u; i < words_per_block; ++i)
+		{
+			b.words[i].fetch_or(bit(hash, i), std::memory_order_relaxed);
+		}
+	}
+
+	bool may_contain(std::uint64_t hash) const noexcept
+	{
+		const auto& b = this->block_for(hash);
+		for (auto i = 0u; i < words_per_block; ++i)
+		{
+			const auto mask = bit(hash, i);
+			if ((b.words[i].load(std::memory_order_relaxed) & mask) != mask)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void clear() noexcept
+	{
+		for (auto i = std::size_t{}; i <= this->mask_; ++i)
+		{
+			for (auto& word : this->blocks_[i].words)
+			{
+				word.store(0u, std::memory_order_relaxed);
+			}
+		}
+	}
+};
+
+} // namespace bitcask
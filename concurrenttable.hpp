@@ -0,0 +1,247 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "epoch.hpp"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <algorithm>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// Chained hash table that can be read without locking while one writer modifies it.
+// Nodes are immutable once published: an update links in a copy and retires the original, a resize copies
+// all nodes into a new bucket array. Readers pin the epoch (see epoch.hpp) while they walk a chain, so
+// unlinked nodes and replaced bucket arrays are freed only after all readers have left them.
+// Writers must be serialized by the caller. Values are copied out, so Value should be small.
+template<typename Value>
+class concurrent_hash_table final
+{
+	struct node final
+	{
+		std::uint64_t      hash;
+		std::atomic<node*> next;
+		Value              value;
+		std::uint32_t      key_size;
+
+		std::string_view key() const noexcept
+		{
+			return std::string_view{ reinterpret_cast<const char*>(this + 1), this->key_size };
+		}
+	};
+
+	struct bucket_array final
+	{
+		std::size_t                           mask;
+		std::unique_ptr<std::atomic<node*>[]> heads;
+
+		explicit bucket_array(std::size_t count)
+		    : mask{ count - 1u }
+		    , heads{ std::make_unique<std::atomic<node*>[]>(count) }
+		{
+		}
+
+		std::atomic<node*>& head(std::uint64_t hash) const noexcept
+		{
+			return this->heads[hash & this->mask];
+		}
+	};
+
+	static constexpr auto min_buckets = std::size_t{ 16u };
+
+	std::atomic<bucket_array*> buckets_;
+	std::size_t                size_;
+	std::size_t                key_bytes_;
+
+	static node* make_node(std::uint64_t hash, const std::string_view& key, const Value& value, node* next)
+	{
+		auto memory = static_cast<char*>(::operator new(sizeof(node) + key.size()));
+		std::copy(key.begin(), key.end(), memory + sizeof(node));
+		return new (memory) node{ .hash = hash, .next = next, .value = value, .key_size = static_cast<std::uint32_t>(key.size()) };
+	}
+
+	static void free_node(void* n) noexcept
+	{
+		static_cast<node*>(n)->~node();
+		::operator delete(n);
+	}
+
+	// Frees the bucket array and all nodes in it.
+	static void free_all(void* b) noexcept
+	{
+		const auto buckets = static_cast<bucket_array*>(b);
+		for (auto i = std::size_t{}; i <= buckets->mask; ++i)
+		{
+			for (auto n = buckets->heads[i].load(std::memory_order_relaxed); n;)
+			{
+				const auto next = n->next.load(std::memory_order_relaxed);
+				free_node(n);
+				n = next;
+			}
+		}
+		delete buckets;
+	}
+
+	// Writer only: the link that points to the node of the key, or nullptr.
+	std::atomic<node*>* find_link(const std::string_view& key, std::uint64_t hash) const noexcept
+	{
+		auto link = &this->buckets_.load(std::memory_order_relaxed)->head(hash);
+		for (auto n = link->load(std::memory_order_relaxed); n; n = n->next.load(std::memory_order_relaxed))
+		{
+			if (n->hash == hash && n->key() == key)
+			{
+				return link;
+			}
+			link = &n->next;
+		}
+		return nullptr;
+	}
+
+	void grow()
+	{
+		const auto old     = this->buckets_.load(std::memory_order_relaxed);
+		auto       buckets = std::make_unique<bucket_array>(2u * (old->mask + 1u));
+		for (auto i = std::size_t{}; i <= old->mask; ++i)
+		{
+			for (auto n = old->heads[i].load(std::memory_order_relaxed); n; n = n->next.load(std::memory_order_relaxed))
+			{
+				auto& head = buckets->head(n->hash);
+				head.store(make_node(n->hash, n->key(), n->value, head.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+			}
+		}
+		this->buckets_.store(buckets.release(), std::memory_order_release);
+		epoch_domain::instance().retire(old, &free_all, epoch_domain::collect_threshold); // the whole old table
+	}
+
+public:
+	concurrent_hash_table()
+	    : buckets_{ new bucket_array{ min_buckets } }
+	    , size_{}
+	    , key_bytes_{}
+	{
+	}
+
+	~concurrent_hash_table() noexcept
+	{
+		free_all(this->buckets_.load(std::memory_order_relaxed));
+	}
+
+	concurrent_hash_table(const concurrent_hash_table&)            = delete;
+	concurrent_hash_table& operator=(const concurrent_hash_table&) = delete;
+
+	/// Writer only, or with writers excluded.
+	std::size_t size() const noexcept
+	{
+		return this->size_;
+	}
+
+	/// Total length of all keys. Writer only, or with writers excluded.
+	std::size_t key_bytes() const noexcept
+	{
+		return this->key_bytes_;
+	}
+
+	/// Writer only, or with writers excluded.
+	std::size_t memory_usage() const noexcept
+	{
+		// nodes with an estimated allocator overhead, keys, and buckets
+		const auto buckets = this->buckets_.load(std::memory_order_relaxed)->mask + 1u;
+		return this->size_ * (sizeof(node) + 16u) + this->key_bytes_ + buckets * sizeof(std::atomic<node*>);
+	}
+
+	/// Safe to call concurrently with a writer.
+	std::optional<Value> find(const std::string_view& key, std::uint64_t hash) const
+	{
+		const auto guard = epoch_domain::instance().pin();
+		(void)(guard);
+
+		const auto buckets = this->buckets_.load(std::memory_order_acquire);
+		for (auto n = buckets->head(hash).load(std::memory_order_acquire); n; n = n->next.load(std::memory_order_acquire))
+		{
+			if (n->hash == hash && n->key() == key)
+			{
+				return n->value;
+			}
+		}
+		return std::nullopt;
+	}
+
+	/// Writer only, or with writers excluded. The pointer is valid until the next modification.
+	const Value* find_locked(const std::string_view& key, std::uint64_t hash) const noexcept
+	{
+		const auto link = this->find_link(key, hash);
+		return link ? &link->load(std::memory_order_relaxed)->value : nullptr;
+	}
+
+	/// Writer only. Returns true if the key was inserted, false if the key existed.
+	bool insert_or_assign(const std::string_view& key, std::uint64_t hash, const Value& value)
+	{
+		const auto link = this->find_link(key, hash);
+		if (link)
+		{
+			const auto old = link->load(std::memory_order_relaxed);
+			link->store(make_node(hash, key, value, old->next.load(std::memory_order_relaxed)), std::memory_order_release);
+			epoch_domain::instance().retire(old, &free_node);
+			return false;
+		}
+
+		auto& head = this->buckets_.load(std::memory_order_relaxed)->head(hash);
+		head.store(make_node(hash, key, value, head.load(std::memory_order_relaxed)), std::memory_order_release);
+		++this->size_;
+		this->key_bytes_ += key.size();
+
+		if (this->size_ > this->buckets_.load(std::memory_order_relaxed)->mask + 1u)
+		{
+			this->grow();
+		}
+		return true;
+	}
+
+	/// Writer only. Returns true if the key was erased, false if the key did not exist.
+	bool erase(const std::string_view& key, std::uint64_t hash)
+	{
+		const auto link = this->find_link(key, hash);
+		if (!link)
+		{
+			return false;
+		}
+
+		const auto old = link->load(std::memory_order_relaxed);
+		link->store(old->next.load(std::memory_order_relaxed), std::memory_order_release);
+		epoch_domain::instance().retire(old, &free_node);
+		--this->size_;
+		this->key_bytes_ -= key.size();
+		return true;
+	}
+
+	/// Writer only, or with writers excluded. Stops and returns false as soon as the callback returns false.
+	template<typename Fn>
+	bool traverse(Fn&& fn) const
+	{
+		const auto buckets = this->buckets_.load(std::memory_order_relaxed);
+		for (auto i = std::size_t{}; i <= buckets->mask; ++i)
+		{
+			for (auto n = buckets->heads[i].load(std::memory_order_relaxed); n; n = n->next.load(std::memory_order_relaxed))
+			{
+				if (!fn(n->key(), n->hash, n->value))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+};
+
+} // namespace bitcask
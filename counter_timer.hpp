@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include "histogram.hpp"
+
 #include <fmt/format.h>
 #include <fmt/chrono.h>
 
@@ -19,6 +21,7 @@ struct counter_timer
 {
 	std::size_t              count{};
 	std::chrono::nanoseconds dur{};
+	histogram                latency{}; // of the individual measurements, in nanoseconds
 
 	using clock_type = std::chrono::high_resolution_clock;
 	clock_type::time_point tp{};
@@ -34,10 +37,7 @@ struct counter_timer
 
 		~stopper() noexcept
 		{
-			const auto tp = clock_type::now();
-			this->ct_.dur += tp - this->ct_.tp;
-
-			++this->ct_.count;
+			this->ct_.stop();
 		}
 	};
 
@@ -54,8 +54,9 @@ struct counter_timer
 
 	void stop() noexcept
 	{
-		const auto tp = clock_type::now();
-		this->dur += tp - this->tp;
+		const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - this->tp);
+		this->dur += elapsed;
+		this->latency.record(static_cast<std::uint64_t>(elapsed.count()));
 
 		++this->count;
 	}
@@ -64,7 +65,17 @@ struct counter_timer
 	{
 		if (this->count)
 		{
-			fmt::print(stdout, "{}: count={} total={} avg={}\n", name, this->count, this->dur, this->dur / this->count);
+			fmt::print(stdout,
+			           "{}: count={} total={} avg={} p50={}ns p90={}ns p99={}ns p99.9={}ns max={}ns\n",
+			           name,
+			           this->count,
+			           this->dur,
+			           this->dur / this->count,
+			           this->latency.percentile(50.0),
+			           this->latency.percentile(90.0),
+			           this->latency.percentile(99.0),
+			           this->latency.percentile(99.9),
+			           this->latency.max());
 		}
 		else
 		{
@@ -12,6 +12,12 @@
 #include "file.h"
 #include "lockfile.h"
 #include "locktypes.hpp"
+#include "epoch.hpp"
+#include "mapped_index.h"
+#include "hash.h"
+#include "hton.h"
+#include "tracing.h"
+#include "config.h"
 
 #include <fmt/format.h>
 
@@ -20,7 +26,10 @@
 #include <set>
 #include <vector>
 #include <map>
+#include <array>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include <limits>
 #include <cassert>
 
@@ -74,48 +83,200 @@ void remove_if_exists(const fs::path& path)
 	}
 }
 
+// The sampled read counts of the data files, kept over a restart so that warm() knows which files are hot.
+// Pairs of file id and count, in network byte order.
+fs::path read_counts_path(const fs::path& directory)
+{
+	return directory / "reads.stats";
+}
+
+std::map<file_id_type, std::uint64_t> load_read_counts(const fs::path& directory)
+{
+	auto counts = std::map<file_id_type, std::uint64_t>{};
+
+	const auto path = read_counts_path(directory);
+	if (fs::exists(path))
+	{
+		const auto f = file::open(path, O_RDONLY, 0664);
+
+		auto pair = std::array<std::uint64_t, 2>{};
+		while (f->read(pair.data(), sizeof(pair), file::read_mode::zero_or_count))
+		{
+			counts[static_cast<file_id_type>(ntoh(pair[0]))] = ntoh(pair[1]);
+		}
+	}
+	return counts;
+}
+
+void save_read_counts(const fs::path& directory, const std::map<file_id_type, std::uint64_t>& counts)
+{
+	auto pairs = std::vector<std::array<std::uint64_t, 2>>{};
+	for (const auto& [id, count] : counts)
+	{
+		pairs.push_back({ hton(static_cast<std::uint64_t>(id)), hton(count) });
+	}
+
+	const auto path = read_counts_path(directory);
+	const auto temp = fs::path{ path.string() + ".tmp" };
+	file::open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0664)->write(pairs.data(), pairs.size() * sizeof(pairs[0]));
+	fs::rename(temp, path);
+}
+
+// Gets are counted one in read_sample_rate per thread, so that threads reading the same file rarely write its counter.
+constexpr auto read_sample_rate = std::uint32_t{ 16u };
+
+bool sample_read()
+{
+	thread_local auto reads = std::uint32_t{};
+	return (++reads % read_sample_rate) == 0u;
+}
+
 } // namespace
 
 class datadir::impl final
 {
 	static constexpr auto file_id_increment = static_cast<file_id_type>(1) << (file_id_bits / 2);
 	static constexpr auto file_id_mask      = std::numeric_limits<file_id_type>::max() << (file_id_bits / 2);
+	static constexpr auto merge_batch_size  = std::size_t{ 1024u * 1024u };
+
+	// The data files by file_index, so that readers can find a file without locking.
+	// The table is never modified once published: a change publishes a copy and retires the original through
+	// the epoch domain. Removed files are retired as well. The slot of a removed file is reused by a later file.
+	struct file_table final
+	{
+		std::vector<datafile*> files{};
+	};
+
+	// Written by the merge, under the merge lock, and read by statistics without a lock.
+	struct merge_progress final
+	{
+		std::atomic<std::uint64_t> merges{};
+		std::atomic<bool>          running{};
+		std::atomic<std::size_t>   files_total{};
+		std::atomic<std::size_t>   files_done{};
+		std::atomic<std::uint64_t> records_copied{};
+		std::atomic<std::uint64_t> bytes_copied{};
+	};
 
 	fs::path                                          directory_{};
 	std::unique_ptr<lockfile>                         lockfile_{};
 	std::map<file_id_type, std::unique_ptr<datafile>> file_map_{};
-	off_t                                             max_file_size_{ 1024u * 1024u * 1024u };
-	mutable shared_locker                             locker_{};
-	mutable locker                                    merge_locker_{};
+	std::atomic<file_table*>                          file_table_{ new file_table{} };
+	datafile*                                         active_file_{}; // guarded by writer_locker_
+	std::atomic<off64_t>                              max_file_size_{ 1024u * 1024u * 1024u };
+	bool                                              preallocate_{};
+	io_mode                                           merge_io_{};
+	mutable shared_locker                             locker_{ "datadir.files" };         // guards file_map_, needed only to add or remove files
+	mutable locker                                    writer_locker_{ "datadir.writer" }; // serializes appends to the active file
+	mutable locker                                    merge_locker_{ "datadir.merge" };
+	std::thread                                       hint_writer_{}; // rewrites the hint files that were found damaged on open
+	merge_progress                                    merge_progress_{};
+	mutable std::atomic<std::uint64_t>                locked_file_lookups_{};
+
+	void publish(const write_lock_type&, std::unique_ptr<file_table>&& table)
+	{
+		epoch_domain::instance().retire(this->file_table_.exchange(table.release(), std::memory_order_acq_rel));
+	}
 
-	datafile* add_file(const write_lock_type&, std::unique_ptr<datafile>&& file)
+	void remove_file(const write_lock_type& lock, file_id_type file_id)
 	{
-		return this->file_map_.insert_or_assign(file->id(), std::move(file)).first->second.get();
+		const auto it = this->file_map_.find(file_id);
+		if (it != this->file_map_.end())
+		{
+			auto table = std::make_unique<file_table>(*this->file_table_.load(std::memory_order_relaxed));
+			table->files.at(it->second->index()) = nullptr;
+			this->publish(lock, std::move(table));
+
+			// the file keeps its descriptor, and so the disk space of a removed file, until it is freed
+			epoch_domain::instance().retire(it->second.release(), epoch_domain::collect_threshold);
+			this->file_map_.erase(it);
+		}
 	}
 
-	datafile& active_file(const write_lock_type& lock)
+	datafile* add_file(const write_lock_type& lock, std::unique_ptr<file>&& f)
 	{
+		const auto& files = this->file_table_.load(std::memory_order_relaxed)->files;
+		const auto  index = static_cast<file_index_type>(std::find(files.begin(), files.end(), nullptr) - files.begin());
+		auto        df    = std::make_unique<datafile>(std::move(f), index);
+
+		// a file that is opened again replaces the old instance; the slot at index stays free
+		this->remove_file(lock, df->id());
+
+		auto table = std::make_unique<file_table>(*this->file_table_.load(std::memory_order_relaxed));
+		if (index == table->files.size())
+		{
+			table->files.push_back(df.get());
+		}
+		else
+		{
+			table->files[index] = df.get();
+		}
+
+		const auto result = this->file_map_.emplace(df->id(), std::move(df)).first->second.get();
+		this->publish(lock, std::move(table));
+		return result;
+	}
+
+	// Holds the merge lock, so that a merge does not remove the files meanwhile.
+	void write_hints(const std::vector<file_id_type>& file_ids)
+	{
+		const auto lock = this->merge_locker_.lock();
+		(void)(lock);
+
+		for (const auto id : file_ids)
 		{
-			assert(!this->file_map_.empty());
-			auto& active = *this->file_map_.rbegin()->second;
-			if (active.size_greater_than(this->max_file_size_))
+			const auto file = [&]() -> const datafile* {
+				const auto rlock = this->locker_.read_lock();
+				(void)(rlock);
+
+				const auto it = this->file_map_.find(id);
+				return it == this->file_map_.end() ? nullptr : it->second.get();
+			}();
+
+			try
 			{
-				active.reopen(O_RDONLY, 0664);
-				this->add_file(lock,
-				               std::make_unique<datafile>(
-				                   file::open(this->directory_ / datafile::make_filename((active.id() + file_id_increment) & file_id_mask),
-				                              O_RDWR | O_CREAT,
-				                              0664)));
+				if (file)
+				{
+					file->write_hint();
+				}
 			}
+			catch (...)
+			{
+				// the data is scanned again on the next open
+			}
+		}
+	}
+
+	void preallocate_active_file()
+	{
+		if (this->preallocate_)
+		{
+			this->active_file_->preallocate(this->max_file_size());
 		}
+	}
 
-		return *this->file_map_.rbegin()->second;
+	// Rotates to a new active file if the current one is full.
+	// Readers are only blocked while the new file is added; appending takes no lock that readers take.
+	datafile& active_file(const lock_type&)
+	{
+		assert(this->active_file_);
+		if (this->active_file_->size_greater_than(this->max_file_size()))
+		{
+			const auto id = (this->active_file_->id() + file_id_increment) & file_id_mask;
+			this->active_file_->seal();
+			this->active_file_ = this->add_file(this->locker_.write_lock(),
+			                                    file::open(this->directory_ / datafile::make_filename(id), O_RDWR | O_CREAT, 0664));
+			this->preallocate_active_file();
+		}
+		return *this->active_file_;
 	}
 
 public:
-	explicit impl(const fs::path& directory)
+	impl(const fs::path& directory, const options& opts)
 	    : directory_{ ensure_directory(directory) }
 	    , lockfile_{ lock_directory(directory) }
+	    , preallocate_{ opts.preallocate_data_files }
+	    , merge_io_{ opts.direct_merge_io ? io_mode::direct : io_mode::cached }
 	{
 		// Scan directory for data files
 		auto names = scan_data_files(directory);
@@ -129,45 +290,180 @@ public:
 			const auto  path    = this->directory_ / name;
 			const auto  is_last = (++it == names.end());
 
-			this->add_file(lock, std::make_unique<datafile>(file::open(path, is_last ? O_RDWR : O_RDONLY, 0664)));
+			this->add_file(lock, file::open(path, is_last ? O_RDWR : O_RDONLY, 0664));
 		}
 
 		if (this->file_map_.empty())
 		{
-			this->add_file(lock,
-			               std::make_unique<datafile>(file::open(this->directory_ / datafile::make_filename(0u), O_RDWR | O_CREAT, 0664)));
+			this->active_file_ = this->add_file(lock, file::open(this->directory_ / datafile::make_filename(0u), O_RDWR | O_CREAT, 0664));
+			this->preallocate_active_file();
+		}
+		else
+		{
+			// An existing active file is not preallocated, that would change the fingerprint
+			this->active_file_ = this->file_map_.rbegin()->second.get();
+		}
+
+		try
+		{
+			// halved, so that files that are no longer read lose their rank over time
+			for (const auto& [id, count] : load_read_counts(this->directory_))
+			{
+				const auto it = this->file_map_.find(id);
+				if (it != this->file_map_.end())
+				{
+					it->second->count_reads(count / 2u);
+				}
+			}
+		}
+		catch (...)
+		{
+			// only a hint
 		}
 	}
 
-	off64_t max_file_size() const
+	~impl() noexcept
 	{
-		const auto lock = this->locker_.read_lock();
-		(void)(lock);
+		if (this->hint_writer_.joinable())
+		{
+			this->hint_writer_.join();
+		}
 
-		return this->max_file_size_;
+		try
+		{
+			auto counts = std::map<file_id_type, std::uint64_t>{};
+			for (const auto& [id, file] : this->file_map_)
+			{
+				if (file->reads())
+				{
+					counts[id] = file->reads();
+				}
+			}
+			save_read_counts(this->directory_, counts);
+		}
+		catch (...)
+		{
+			// only a hint
+		}
+
+		delete this->file_table_.load(std::memory_order_relaxed);
+	}
+
+	impl(const impl&)            = delete;
+	impl& operator=(const impl&) = delete;
+
+	off64_t max_file_size() const
+	{
+		return this->max_file_size_.load(std::memory_order_relaxed);
 	}
 
 	void max_file_size(off64_t size)
 	{
-		const auto lock = this->locker_.write_lock();
+		this->max_file_size_.store(size, std::memory_order_relaxed);
+	}
+
+	recovery_report build_keydir(keydir& kd)
+	{
+		// Not locked while the keydir is built, because the keydir may read keys back through get_key.
+		auto files = std::vector<const datafile*>{};
+		{
+			const auto lock = this->locker_.read_lock();
+			(void)(lock);
+
+			std::transform(this->file_map_.begin(), this->file_map_.end(), std::back_inserter(files), [](const auto& pair) {
+				return pair.second.get();
+			});
+		}
+
+		auto report   = recovery_report{};
+		auto rewrites = std::vector<file_id_type>{};
+		for (const auto file : files)
+		{
+			if (!file->build_keydir(kd, [&](const damaged_region& region) { report.damaged_regions.push_back(region); }))
+			{
+				report.discarded_hint_files.push_back(file->hint_path());
+				rewrites.push_back(file->id());
+			}
+		}
+
+		if (!rewrites.empty())
+		{
+#ifdef BITCASK_THREAD_SAFE
+			this->hint_writer_ = std::thread{ [this, rewrites = std::move(rewrites)] { this->write_hints(rewrites); } };
+#else
+			this->write_hints(rewrites);
+#endif
+		}
+
+		// the active file is last, a damaged region at its end is a torn append
+		if (!report.damaged_regions.empty())
+		{
+			auto& region = report.damaged_regions.back();
+
+			const auto lock = this->writer_locker_.lock();
+			(void)(lock);
+
+			if (region.path == this->active_file_->path() && !this->active_file_->size_greater_than(region.offset + region.length))
+			{
+				this->active_file_->truncate(region.offset);
+				region.truncated = true;
+			}
+		}
+		return report;
+	}
+
+	void reindex_keydir(keydir& kd) const
+	{
+		const auto lock = this->locker_.read_lock();
 		(void)(lock);
 
-		this->max_file_size_ = size;
+		kd.reindex_files([&](file_id_type id) {
+			const auto it = this->file_map_.find(id);
+			return it == this->file_map_.end() ? std::numeric_limits<file_index_type>::max() : it->second->index();
+		});
 	}
 
-	void build_keydir(keydir& kd)
+	std::uint64_t fingerprint() const
 	{
 		const auto lock = this->locker_.read_lock();
 		(void)(lock);
 
-		for (auto& pair : this->file_map_)
+		auto result = std::uint64_t{};
+		for (const auto& pair : this->file_map_)
 		{
-			pair.second->build_keydir(kd);
+			const auto path  = pair.second->path();
+			const auto size  = static_cast<std::uint64_t>(fs::file_size(path));
+			const auto mtime = static_cast<std::uint64_t>(fs::last_write_time(path).time_since_epoch().count());
+			const auto state = std::array<std::uint64_t, 3>{ pair.first, size, mtime };
+
+			result = wyhash(state.data(), sizeof(state), result);
 		}
+		return result;
 	}
 
-	value_type get(const keydir::info& info)
+	template<typename Fn>
+	auto with_file(const keydir::info& info, Fn&& fn)
 	{
+		auto lookup = phase_timer{ trace_phase::file_lookup };
+		{
+			const auto guard = epoch_domain::instance().pin();
+			(void)(guard);
+
+			const auto& files = this->file_table_.load(std::memory_order_acquire)->files;
+			if (info.file_index < files.size())
+			{
+				const auto file = files[info.file_index];
+				if (file && file->id() == info.file_id)
+				{
+					lookup.stop();
+					return fn(*file);
+				}
+			}
+		}
+
+		// The index is stale, e.g. the file was removed by a merge after the entry was read.
+		this->locked_file_lookups_.fetch_add(1u, std::memory_order_relaxed);
+
 		const auto lock = this->locker_.read_lock();
 		(void)(lock);
 
@@ -176,32 +472,118 @@ public:
 		{
 			throw std::runtime_error{ fmt::format("Unknown file_id {}", info.file_id) };
 		}
-		return it->second->get(info);
+		lookup.stop();
+		return fn(*it->second);
+	}
+
+	value_type get(const keydir::info& info, io_mode mode)
+	{
+		return this->with_file(info, [&](const datafile& file) {
+			if (sample_read())
+			{
+				file.count_reads(read_sample_rate);
+			}
+			return file.get(info, mode);
+		});
+	}
+
+	key_type get_key(const keydir::info& info)
+	{
+		return this->with_file(info, [&](const datafile& file) { return file.get_key(info); });
+	}
+
+	value_type get_record(const keydir::info& info, io_mode mode)
+	{
+		return this->with_file(info, [&](const datafile& file) {
+			if (sample_read())
+			{
+				file.count_reads(read_sample_rate);
+			}
+			return file.get_record(info, mode);
+		});
 	}
 
 	keydir::info put(const std::string_view& key, const std::string_view& value, version_type version)
 	{
-		return this->active_file(this->locker_.write_lock()).put(key, value, version);
+		return this->active_file(this->writer_locker_.lock()).put(key, value, version);
 	}
 
 	void del(const std::string_view& key, version_type version)
 	{
-		return this->active_file(this->locker_.write_lock()).del(key, version);
+		return this->active_file(this->writer_locker_.lock()).del(key, version);
 	}
 
-	void merge(keydir& kd)
+	std::vector<keydir::info> append(const std::vector<write_op>& ops)
 	{
-		auto rlock = this->locker_.read_lock();
+		return this->active_file(this->writer_locker_.lock()).append(ops);
+	}
 
-		if (this->file_map_.size() < 2u)
+	datadir_stats statistics() const
+	{
+		const auto& progress = this->merge_progress_;
+
+		auto result  = datadir_stats{ .files               = 0u,
+		                              .bytes               = 0u,
+		                              .locked_file_lookups = this->locked_file_lookups_.load(std::memory_order_relaxed),
+		                              .merge = merge_stats{ .merges         = progress.merges.load(std::memory_order_relaxed),
+		                                                    .running        = progress.running.load(std::memory_order_relaxed),
+		                                                    .files_total    = progress.files_total.load(std::memory_order_relaxed),
+		                                                    .files_done     = progress.files_done.load(std::memory_order_relaxed),
+		                                                    .records_copied = progress.records_copied.load(std::memory_order_relaxed),
+		                                                    .bytes_copied   = progress.bytes_copied.load(std::memory_order_relaxed) } };
+		const auto lock = this->locker_.read_lock();
+		(void)(lock);
+
+		result.files = this->file_map_.size();
+		for (const auto& [id, file] : this->file_map_)
 		{
-			return;
+			result.bytes += static_cast<std::uint64_t>(file->size());
 		}
+		return result;
+	}
 
+	void warm(const warm_policy& policy)
+	{
+		const auto lock = this->locker_.read_lock();
+		(void)(lock);
+
+		// newest first, which also breaks ties between equally read files
+		auto files = std::vector<const datafile*>{};
+		std::transform(this->file_map_.rbegin(), this->file_map_.rend(), std::back_inserter(files), [](const auto& pair) {
+			return pair.second.get();
+		});
+
+		if (policy.files == warm_policy::selection::most_read)
+		{
+			std::stable_sort(files.begin(), files.end(), [](const auto a, const auto b) { return a->reads() > b->reads(); });
+		}
+
+		files.resize(std::min(files.size(), policy.count));
+		std::for_each(files.begin(), files.end(), [](const auto file) { file->warm(); });
+	}
+
+	void trim()
+	{
+		const auto lock = this->locker_.read_lock();
+		(void)(lock);
+
+		std::for_each(this->file_map_.begin(), this->file_map_.end(), [](const auto& pair) { pair.second->trim(); });
+	}
+
+	void merge(keydir& kd)
+	{
 		// one merge at a time!
+		// Taken before the datadir lock, like write_hints does.
 		const auto lock = this->merge_locker_.lock();
 		(void)(lock);
 
+		auto rlock = this->locker_.read_lock();
+
+		if (this->file_map_.size() < 2u)
+		{
+			return;
+		}
+
 		auto immutable_files = std::vector<datafile*>{};
 		std::transform(this->file_map_.begin(),
 		               std::prev(this->file_map_.end()),
@@ -210,59 +592,138 @@ public:
 
 		rlock.unlock();
 
+		auto& progress = this->merge_progress_;
+		progress.files_total.store(immutable_files.size(), std::memory_order_relaxed);
+		progress.files_done.store(0u, std::memory_order_relaxed);
+		progress.running.store(true, std::memory_order_relaxed);
+
+		// also cleared if the merge fails
+		struct running_flag final
+		{
+			std::atomic<bool>& running;
+
+			~running_flag() noexcept
+			{
+				this->running.store(false, std::memory_order_relaxed);
+			}
+		} const running{ progress.running };
+
 		auto last_immutable_file_id = immutable_files.back()->id();
 
 		datafile* merged_file{ nullptr };
+		datafile* last_merged_file{ nullptr }; // inherits the read counts of the files it replaces
 		auto      hint_file = std::unique_ptr<hintfile>{};
 
+		// The live records are copied to the merged file in batches, each with a single write.
+		// The keydir is updated after the write, so that readers never see a location that is not written yet.
+		auto batch    = std::vector<write_op>{};
+		auto contents = std::string{}; // the keys and values of the batch, one after the other
+
+		const auto flush = [&] {
+			auto offset = std::size_t{};
+			for (auto& op : batch)
+			{
+				op.key = std::string_view{ contents }.substr(offset, op.key.size());
+				offset += op.key.size();
+				op.value = std::string_view{ contents }.substr(offset, op.value->size());
+				offset += op.value->size();
+			}
+
+			auto infos = merged_file->append(batch, this->merge_io_);
+			for (auto i = std::size_t{}; i < batch.size(); ++i)
+			{
+				const auto& op = batch[i];
+
+				hint_file->put(hintfile::hint{ .version   = infos[i].version,
+				                               .value_sz  = infos[i].value_sz,
+				                               .value_pos = infos[i].value_pos,
+				                               .key       = op.key });
+
+				// If the key was written or deleted in the meantime, the newer record in the active file wins,
+				// and the copy in the merged file is just garbage.
+				kd.replace(op.key, op.version, std::move(infos[i]));
+			}
+
+			progress.records_copied.fetch_add(batch.size(), std::memory_order_relaxed);
+			progress.bytes_copied.fetch_add(contents.size(), std::memory_order_relaxed);
+
+			batch.clear();
+			contents.clear();
+
+			if (merged_file->size_greater_than(this->max_file_size()))
+			{
+				merged_file->seal();
+				merged_file = nullptr;
+			}
+		};
+
 		std::for_each(immutable_files.begin(), immutable_files.end(), [&](auto file) {
-			file->traverse([&](const auto& rec) {
-				if (rec.value)
-				{
-					const auto& v            = rec.value.value();
-					const auto  opt_key_info = kd.get_mutable(rec.key);
-					if (opt_key_info)
-					{
-						auto key_info = opt_key_info.value().first;
-						if (key_info->version == v.version)
-						{
-							if (!merged_file)
-							{
-								merged_file = this->add_file(
-								    this->locker_.write_lock(),
-								    std::make_unique<datafile>(file::open(
-								        this->directory_ / datafile::make_filename(++last_immutable_file_id), O_RDWR | O_CREAT, 0664)));
-								hint_file = std::make_unique<hintfile>(file::open(merged_file->hint_path(), O_WRONLY | O_CREAT, 0664));
-							}
-
-							*key_info = merged_file->put(rec.key, v.value, v.version);
-
-							hint_file->put(hintfile::hint{ .version   = key_info->version,
-							                               .value_sz  = key_info->value_sz,
-							                               .value_pos = key_info->value_pos,
-							                               .key       = rec.key });
-
-							if (merged_file->size_greater_than(this->max_file_size_))
-							{
-								merged_file->reopen(O_RDONLY, 0664);
-								merged_file = nullptr;
-							}
-						}
-					}
-				}
-			});
+			file->traverse(
+			    [&](const auto& rec) {
+				    if (rec.value)
+				    {
+					    const auto& v        = rec.value.value();
+					    const auto  key_info = kd.get(rec.key);
+					    if (key_info && key_info->version == v.version)
+					    {
+						    if (!merged_file)
+						    {
+							    merged_file = this->add_file(
+							        this->locker_.write_lock(),
+							        file::open(this->directory_ / datafile::make_filename(++last_immutable_file_id), O_RDWR | O_CREAT, 0664));
+							    hint_file = std::make_unique<hintfile>(file::open(merged_file->hint_path(), O_WRONLY | O_CREAT, 0664));
+							    last_merged_file = merged_file;
+						    }
+
+						    // the views are only valid during the callback, the batch refers to its copy of the data
+						    batch.push_back(write_op{ .key = rec.key, .value = v.value, .version = v.version });
+						    contents.append(rec.key).append(v.value);
+
+						    // a full merged file is sealed after the flush
+						    if (contents.size() >= merge_batch_size
+						        || merged_file->size_greater_than(this->max_file_size() - static_cast<off64_t>(contents.size())))
+						    {
+							    flush();
+						    }
+					    }
+				    }
+			    },
+			    this->merge_io_);
+
+			// the records of the file must be in place before it is removed
+			if (!batch.empty())
+			{
+				flush();
+			}
 
 			const auto path      = file->path();
 			const auto hint_path = file->hint_path();
 
-			const auto wlock = this->locker_.write_lock();
-			(void)(wlock);
+			if (last_merged_file)
+			{
+				last_merged_file->count_reads(file->reads());
+			}
 
-			this->file_map_.erase(file->id());
+			file->drop_cache();
+			this->remove_file(this->locker_.write_lock(), file->id());
 
 			fs::remove(path);
 			remove_if_exists(hint_path);
+			remove_if_exists(datafile::preallocated_path(path));
+
+			progress.files_done.fetch_add(1u, std::memory_order_relaxed);
 		});
+
+		if (merged_file)
+		{
+			// releases the zeros after the last direct write
+			merged_file->seal();
+		}
+
+		// close the merged files as soon as no reader uses them anymore
+		epoch_domain::instance().collect();
+
+		progress.merges.fetch_add(1u, std::memory_order_relaxed);
 	}
 
 	static void clear(const std::filesystem::path& directory)
@@ -275,13 +736,17 @@ public:
 				const auto path = directory / name;
 				fs::remove(path);
 				remove_if_exists(datafile::hint_path(path));
+				remove_if_exists(datafile::hint_path(path).string() + ".tmp");
+				remove_if_exists(datafile::preallocated_path(path));
 			}
+			remove_if_exists(mapped_index_path(directory));
+			remove_if_exists(read_counts_path(directory));
 		}
 	}
 };
 
-datadir::datadir(const fs::path& directory)
-    : pimpl_{ std::make_unique<impl>(directory) }
+datadir::datadir(const fs::path& directory, const options& opts)
+    : pimpl_{ std::make_unique<impl>(directory, opts) }
 {
 }
 
@@ -299,14 +764,34 @@ datadir::~datadir() noexcept
 {
 }
 
-void datadir::build_keydir(keydir& kd)
+recovery_report datadir::build_keydir(keydir& kd)
+{
+	return this->pimpl_->build_keydir(kd);
+}
+
+void datadir::reindex_keydir(keydir& kd) const
 {
-	this->pimpl_->build_keydir(kd);
+	return this->pimpl_->reindex_keydir(kd);
 }
 
-value_type datadir::get(const keydir::info& info)
+std::uint64_t datadir::fingerprint() const
 {
-	return this->pimpl_->get(info);
+	return this->pimpl_->fingerprint();
+}
+
+value_type datadir::get(const keydir::info& info, io_mode mode)
+{
+	return this->pimpl_->get(info, mode);
+}
+
+key_type datadir::get_key(const keydir::info& info)
+{
+	return this->pimpl_->get_key(info);
+}
+
+value_type datadir::get_record(const keydir::info& info, io_mode mode)
+{
+	return this->pimpl_->get_record(info, mode);
 }
 
 keydir::info datadir::put(const std::string_view& key, const std::string_view& value, version_type version)
@@ -319,6 +804,26 @@ void datadir::del(const std::string_view& key, version_type version)
 	return this->pimpl_->del(key, version);
 }
 
+std::vector<keydir::info> datadir::append(const std::vector<write_op>& ops)
+{
+	return this->pimpl_->append(ops);
+}
+
+datadir_stats datadir::statistics() const
+{
+	return this->pimpl_->statistics();
+}
+
+void datadir::warm(const warm_policy& policy)
+{
+	return this->pimpl_->warm(policy);
+}
+
+void datadir::trim()
+{
+	return this->pimpl_->trim();
+}
+
 void datadir::merge(keydir& kd)
 {
 	return this->pimpl_->merge(kd);
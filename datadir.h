@@ -8,20 +8,42 @@
 #pragma once
 
 #include "keydir.h"
+#include "datafile.h"
 #include "basictypes.h"
 
 #include <filesystem>
 #include <memory>
+#include <cstdint>
 
 namespace bitcask {
 
+/// Progress of the merges since the store was opened.
+struct merge_stats final
+{
+	std::uint64_t merges;         // completed
+	bool          running;
+	std::size_t   files_total;    // input files of the running merge, or of the last one
+	std::size_t   files_done;     // of files_total, merged and removed
+	std::uint64_t records_copied; // live records copied by all merges
+	std::uint64_t bytes_copied;   // keys and values copied by all merges
+};
+
+struct datadir_stats final
+{
+	std::size_t   files;
+	std::uint64_t bytes;               // of data in all files, excluding preallocated space
+	std::uint64_t locked_file_lookups; // reads whose keydir entry had a stale file index, so that the file was looked up under the lock
+	merge_stats   merge;
+};
+
 class datadir final
 {
 	class impl;
 	std::unique_ptr<impl> pimpl_;
 
 public:
-	explicit datadir(const std::filesystem::path& directory);
+	/// Uses options::preallocate_data_files and options::direct_merge_io.
+	explicit datadir(const std::filesystem::path& directory, const options& opts = options{});
 	~datadir() noexcept;
 
 	datadir(datadir&&)            = default;
@@ -33,12 +55,34 @@ public:
 	off64_t max_file_size() const;
 	void    max_file_size(off64_t size);
 
-	void build_keydir(keydir& kd);
+	/// Skips damaged records in the data files. A damaged region at the end of the active file, typically a record
+	/// that was torn by a crash, is cut off so that appends continue after the last good record.
+	recovery_report build_keydir(keydir& kd);
 
-	value_type   get(const keydir::info& info);
+	/// Corrects the file indexes of a keydir that was restored from disk, see keydir::reindex_files.
+	void reindex_keydir(keydir& kd) const;
+
+	/// Identifies the current state of the data files (names, sizes and modification times).
+	std::uint64_t fingerprint() const;
+
+	value_type   get(const keydir::info& info, io_mode mode = io_mode::cached);
+	key_type     get_key(const keydir::info& info);
+	value_type   get_record(const keydir::info& info, io_mode mode = io_mode::cached); // the key, immediately followed by the value
 	keydir::info put(const std::string_view& key, const std::string_view& value, version_type version);
 	void         del(const std::string_view& key, version_type version);
 
+	/// Appends the records to the active file with a single write (see datafile::append).
+	std::vector<keydir::info> append(const std::vector<write_op>& ops);
+
+	datadir_stats statistics() const;
+
+	/// Asks the kernel to read the files selected by the policy into the page cache.
+	void warm(const warm_policy& policy);
+
+	/// Releases the space beyond the end of the data that this process has preallocated, see datafile::trim.
+	/// Done before the store is closed, so that the fingerprint describes the files as they are found on the next open.
+	void trim();
+
 	// maintenance
 	void merge(keydir& kd);
 
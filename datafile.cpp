@@ -6,21 +6,31 @@
 //
 
 #include "datafile.h"
+#include "recordheader.h"
 #include "file.h"
 #include "keydir.h"
 #include "basictypes.h"
 #include "hton.h"
 #include "crc32.h"
+#include "tracing.h"
 
 #include <fmt/format.h>
 
 #include <string_view>
+#include <filesystem>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
 #include <optional>
 #include <functional>
+#include <vector>
 #include <charconv>
 #include <stdexcept>
 #include <cstring>
 #include <limits>
+#include <memory>
+#include <new>
+#include <cstdlib>
 
 #include <fcntl.h>
 
@@ -28,94 +38,143 @@ namespace bitcask {
 
 namespace {
 
-constexpr auto max_ksz          = std::numeric_limits<ksz_type>::max();
-constexpr auto deleted_value_sz = std::numeric_limits<value_sz_type>::max();
-constexpr auto max_value_sz     = deleted_value_sz - 1u;
+// O_DIRECT requires the buffer address, the file offset and the length to be multiples of the logical block size.
+constexpr auto direct_io_alignment = std::size_t{ 4096u };
 
-struct record_header
+constexpr off64_t align_down(off64_t position)
 {
-	crc_type      crc;
-	version_type  version;
-	ksz_type      ksz;
-	value_sz_type value_sz;
-
-	static constexpr auto size = sizeof(crc_type) + sizeof(version_type) + sizeof(ksz_type) + sizeof(value_sz_type);
+	return position & ~static_cast<off64_t>(direct_io_alignment - 1u);
+}
 
-	char buffer[size];
+constexpr std::size_t align_up(std::size_t size)
+{
+	return (size + direct_io_alignment - 1u) & ~(direct_io_alignment - 1u);
+}
 
-	bool read(const lock_type& lock, file& f, crc_type& crc)
+// Uninitialized memory that is suitable for O_DIRECT.
+class aligned_buffer final
+{
+	struct deleter final
 	{
-		if (f.locked_read(lock, this->buffer, size, file::read_mode::zero_or_count))
+		void operator()(char* p) const noexcept
 		{
-			auto src = this->buffer;
-
-			std::memcpy(&this->crc, src, sizeof(this->crc));
-			src += sizeof(this->crc);
-
-			crc = crc32_fast(src, size - sizeof(this->crc));
-
-			std::memcpy(&this->version, src, sizeof(this->version));
-			src += sizeof(this->version);
-
-			std::memcpy(&this->ksz, src, sizeof(this->ksz));
-			src += sizeof(this->ksz);
+			std::free(p);
+		}
+	};
 
-			std::memcpy(&this->value_sz, src, sizeof(this->value_sz));
+	std::unique_ptr<char[], deleter> data_{};
+	std::size_t                      size_{};
 
-			this->crc      = ntoh(this->crc);
-			this->version  = ntoh(this->version);
-			this->ksz      = ntoh(this->ksz);
-			this->value_sz = ntoh(this->value_sz);
+public:
+	aligned_buffer() = default;
 
-			return true;
-		}
-		else
+	// The size is rounded up to the alignment.
+	explicit aligned_buffer(std::size_t size)
+	    : data_{ static_cast<char*>(std::aligned_alloc(direct_io_alignment, align_up(size))) }
+	    , size_{ align_up(size) }
+	{
+		if (!this->data_ && this->size_)
 		{
-			return false;
+			throw std::bad_alloc{};
 		}
 	}
 
-	void init_crc()
+	char* data() const noexcept
 	{
-		const auto n_version  = hton(this->version);
-		const auto n_ksz      = hton(this->ksz);
-		const auto n_value_sz = hton(this->value_sz);
+		return this->data_.get();
+	}
 
-		auto begin = this->buffer + sizeof(this->crc);
-		auto dst   = begin;
+	std::size_t size() const noexcept
+	{
+		return this->size_;
+	}
+};
 
-		std::memcpy(dst, &n_version, sizeof(n_version));
-		dst += sizeof(n_version);
+// Reads a file front to back in large chunks, rather than with a few small reads per record.
+// The chunks start at aligned offsets and have aligned sizes, so the file may be opened with O_DIRECT.
+class sequential_reader final
+{
+	static constexpr auto chunk_size = std::size_t{ 1024u * 1024u };
 
-		std::memcpy(dst, &n_ksz, sizeof(n_ksz));
-		dst += sizeof(n_ksz);
+	const file&    file_;
+	off64_t        end_;
+	aligned_buffer buffer_;
+	off64_t        buffer_pos_; // file offset of the start of the buffer, aligned
+	std::size_t    begin_;      // first unread byte in the buffer
+	std::size_t    filled_;     // bytes read into the buffer
 
-		std::memcpy(dst, &n_value_sz, sizeof(n_value_sz));
+	// Makes `count` bytes available from begin_, if the file has them.
+	void fill(std::size_t count)
+	{
+		// keep the unread bytes, and the aligned offset before them
+		const auto keep   = static_cast<std::size_t>(align_down(static_cast<off64_t>(this->begin_)));
+		const auto needed = this->begin_ - keep + count;
+		if (needed > this->buffer_.size())
+		{
+			auto buffer = aligned_buffer{ std::max(needed, 2u * this->buffer_.size()) };
+			std::memcpy(buffer.data(), this->buffer_.data() + keep, this->filled_ - keep);
+			this->buffer_ = std::move(buffer);
+		}
+		else
+		{
+			std::memmove(this->buffer_.data(), this->buffer_.data() + keep, this->filled_ - keep);
+		}
+		this->buffer_pos_ += static_cast<off64_t>(keep);
+		this->begin_ -= keep;
+		this->filled_ -= keep;
 
-		this->crc = crc32_fast(begin, size - sizeof(this->crc));
+		// filled_ stays aligned, because only the read that reaches the end of the file comes up short
+		while (this->filled_ < this->begin_ + count && this->buffer_pos_ + static_cast<off64_t>(this->filled_) < this->end_)
+		{
+			const auto n = this->file_.read_at(this->buffer_pos_ + static_cast<off64_t>(this->filled_),
+			                                   this->buffer_.data() + this->filled_,
+			                                   this->buffer_.size() - this->filled_,
+			                                   file::read_mode::any);
+			if (n == 0u)
+			{
+				break;
+			}
+			this->filled_ += n;
+		}
+		this->filled_ = std::min(this->filled_, static_cast<std::size_t>(this->end_ - this->buffer_pos_));
 	}
 
-	void write(const lock_type& lock, file& f)
+public:
+	// Reads up to `end`.
+	sequential_reader(const file& f, off64_t end)
+	    : file_{ f }
+	    , end_{ end }
+	    , buffer_{ chunk_size }
+	    , buffer_pos_{}
+	    , begin_{}
+	    , filled_{}
 	{
-		const auto n_crc      = hton(this->crc);
-		const auto n_version  = hton(this->version);
-		const auto n_ksz      = hton(this->ksz);
-		const auto n_value_sz = hton(this->value_sz);
-
-		auto dst = this->buffer;
-
-		std::memcpy(dst, &n_crc, sizeof(n_crc));
-		dst += sizeof(n_crc);
+	}
 
-		std::memcpy(dst, &n_version, sizeof(n_version));
-		dst += sizeof(n_version);
+	off64_t position() const
+	{
+		return this->buffer_pos_ + static_cast<off64_t>(this->begin_);
+	}
 
-		std::memcpy(dst, &n_ksz, sizeof(n_ksz));
-		dst += sizeof(n_ksz);
+	void seek(off64_t position)
+	{
+		this->buffer_pos_ = align_down(position);
+		this->begin_      = static_cast<std::size_t>(position - this->buffer_pos_);
+		this->filled_     = 0u;
+	}
 
-		std::memcpy(dst, &n_value_sz, sizeof(n_value_sz));
+	// Returns the next `count` bytes, or fewer at the end. The result is valid until the next call.
+	std::string_view read(std::size_t count)
+	{
+		if (this->filled_ < this->begin_ + count)
+		{
+			this->fill(count);
+		}
 
-		f.locked_write(lock, this->buffer, size);
+		const auto n      = std::min(count, this->filled_ > this->begin_ ? this->filled_ - this->begin_ : 0u);
+		const auto result = std::string_view{ this->buffer_.data() + this->begin_, n };
+		this->begin_ += n;
+		return result;
 	}
 };
 
@@ -146,21 +205,222 @@ std::string datafile::make_filename(file_id_type id)
 
 class datafile::impl final
 {
-	std::unique_ptr<file> file_;
-	file_id_type          id_;
+	std::unique_ptr<file>              file_;
+	file_id_type                       id_;
+	file_index_type                    index_;
+	mutable bool                       marked_;   // the preallocation marker exists, see mark(); guarded by the file lock
+	mutable bool                       extended_; // this process wrote zeros after the data; guarded by the file lock
+	mutable std::atomic<off64_t>       tail_; // end of the data, the file is larger if space is preallocated; written under the file lock
+	mutable std::atomic<file*>         direct_reader_;      // opened with O_DIRECT on first use, owned
+	mutable std::atomic<bool>          direct_unsupported_; // the file system refused O_DIRECT
+	mutable std::unique_ptr<file>      direct_writer_;      // opened with O_DIRECT on first use, guarded by the file lock
+	mutable std::atomic<std::uint64_t> reads_;              // sampled gets, to rank the files for warming
+
+	// Returns nullptr if the file system does not support O_DIRECT, the caller then reads through the page cache.
+	const file* direct_reader() const
+	{
+		auto f = this->direct_reader_.load(std::memory_order_acquire);
+		if (f || this->direct_unsupported_.load(std::memory_order_relaxed))
+		{
+			return f;
+		}
+
+		try
+		{
+			auto opened = file::open(this->path(), O_RDONLY | O_DIRECT, 0664);
+			if (this->direct_reader_.compare_exchange_strong(f, opened.get(), std::memory_order_acq_rel))
+			{
+				return opened.release();
+			}
+			return f; // another thread was first
+		}
+		catch (const std::system_error&)
+		{
+			this->direct_unsupported_.store(true, std::memory_order_relaxed);
+			return nullptr;
+		}
+	}
+
+	const file* direct_writer(const lock_type&) const
+	{
+		if (!this->direct_writer_ && !this->direct_unsupported_.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				this->direct_writer_ = file::open(this->path(), O_WRONLY | O_DIRECT, 0664);
+			}
+			catch (const std::system_error&)
+			{
+				this->direct_unsupported_.store(true, std::memory_order_relaxed);
+			}
+		}
+		return this->direct_writer_.get();
+	}
+
+	// Reads through the page cache, or around it.
+	void read_at(off64_t position, char* dst, std::size_t count, io_mode mode) const
+	{
+		const auto direct = mode == io_mode::direct ? this->direct_reader() : nullptr;
+		if (!direct)
+		{
+			const auto timer = phase_timer{ trace_phase::io };
+			this->file_->read_at(position, dst, count, file::read_mode::count);
+			return;
+		}
+
+		const auto begin  = align_down(position);
+		const auto offset = static_cast<std::size_t>(position - begin);
+		const auto buffer = aligned_buffer{ offset + count };
+		if (traced_phase(trace_phase::io, [&] { return direct->read_at(begin, buffer.data(), buffer.size(), file::read_mode::any); })
+		    < offset + count)
+		{
+			throw std::runtime_error{ fmt::format("{}: read: unexpected end of file", this->path().string()) };
+		}
+		traced_phase(trace_phase::copy, [&] { std::memcpy(dst, buffer.data() + offset, count); });
+	}
+
+	// Creates the preallocation marker before zeros are written after the data. Only a marked file is searched for the
+	// end of its data when it is opened, any other file is data up to its last byte, zeros included.
+	void mark(const lock_type&) const
+	{
+		if (!this->marked_)
+		{
+			file::open(preallocated_path(this->path()), O_WRONLY | O_CREAT, 0664);
+			this->marked_ = true;
+		}
+		this->extended_ = true;
+	}
+
+	// Cuts off the zeros after the data and removes the marker.
+	void release(const lock_type& lock) const
+	{
+		const auto tail = this->tail_.load(std::memory_order_relaxed);
+		if (this->file_->locked_size(lock) > tail)
+		{
+			std::filesystem::resize_file(this->path(), static_cast<std::uintmax_t>(tail));
+		}
+		std::filesystem::remove(preallocated_path(this->path()));
+		this->marked_   = false;
+		this->extended_ = false;
+	}
+
+	// Writes `data` at `position` with O_DIRECT. The write covers whole blocks: the start of the first block is read back,
+	// the end of the last block is filled with zeros, which the next append overwrites or trim() removes.
+	bool write_direct(const lock_type& lock, off64_t position, const std::string& data) const
+	{
+		const auto direct = this->direct_writer(lock);
+		if (!direct)
+		{
+			return false;
+		}
+
+		const auto begin  = align_down(position);
+		const auto offset = static_cast<std::size_t>(position - begin);
+		const auto buffer = aligned_buffer{ offset + data.size() };
+		if (offset)
+		{
+			const auto reader = this->direct_reader();
+			if (!reader || reader->read_at(begin, buffer.data(), direct_io_alignment, file::read_mode::any) < offset)
+			{
+				throw std::runtime_error{ fmt::format("{}: read: unexpected end of file", this->path().string()) };
+			}
+		}
+		std::memcpy(buffer.data() + offset, data.data(), data.size());
+		std::memset(buffer.data() + offset + data.size(), 0, buffer.size() - offset - data.size());
+		if (buffer.size() > offset + data.size())
+		{
+			this->mark(lock);
+		}
+
+		direct->write_at(begin, { std::string_view{ buffer.data(), buffer.size() } });
+		return true;
+	}
+
+	// The data of a marked file ends at the first all-zero header after the records whose CRCs match; damage before it
+	// is skipped like traverse does. If no zeros follow the damage, the file is data up to its end, so that traverse
+	// reports the damage. A file that is not marked is data up to its end.
+	off64_t find_tail() const
+	{
+		const auto size = this->file_->size();
+		if (!this->marked_)
+		{
+			return size;
+		}
+
+		auto reader = sequential_reader{ *this->file_, size };
+		auto header = record_header{};
+		while (reader.position() < size)
+		{
+			const auto position = reader.position();
+
+			// less than a header of zeros is left after a direct write
+			const auto header_data = reader.read(record_header::size);
+			if (std::all_of(header_data.begin(), header_data.end(), [](char c) { return c == 0; }))
+			{
+				return position;
+			}
+
+			if (header_data.size() == record_header::size)
+			{
+				auto crc = crc_type{};
+				header.read(header_data.data(), crc);
+				if (position + header.record_size() <= size)
+				{
+					const auto data = reader.read(static_cast<std::size_t>(header.record_size()) - record_header::size);
+					if (crc32_fast(data.data(), data.size(), crc) == header.crc)
+					{
+						continue;
+					}
+				}
+			}
+
+			reader.seek(this->resync(position + 1, size));
+		}
+		return size;
+	}
 
 public:
-	explicit impl(std::unique_ptr<file>&& f)
+	impl(std::unique_ptr<file>&& f, file_index_type index)
 	    : file_{ std::move(f) }
 	    , id_{ get_id_from_file_name(this->file_->path().filename().string()) }
+	    , index_{ index }
+	    , marked_{ std::filesystem::exists(preallocated_path(this->file_->path())) }
+	    , extended_{}
+	    , tail_{ this->find_tail() }
+	    , direct_reader_{}
+	    , direct_unsupported_{}
+	    , direct_writer_{}
+	    , reads_{}
 	{
 	}
 
+	~impl() noexcept
+	{
+		try
+		{
+			this->trim();
+		}
+		catch (...)
+		{
+			// The file may have been removed by a merge. Otherwise the file keeps its marker, and the zeros are
+			// skipped on the next open.
+		}
+		delete this->direct_reader_.load(std::memory_order_relaxed);
+	}
+
+	impl(const impl&)            = delete;
+	impl& operator=(const impl&) = delete;
+
 	file_id_type id() const
 	{
 		return this->id_;
 	}
 
+	file_index_type index() const
+	{
+		return this->index_;
+	}
+
 	std::filesystem::path path() const
 	{
 		return this->file_->path();
@@ -176,23 +436,109 @@ public:
 		return path.string() + ".hint";
 	}
 
+	static std::filesystem::path preallocated_path(const std::filesystem::path& path)
+	{
+		return path.string() + ".prealloc";
+	}
+
+	off64_t size() const
+	{
+		return this->tail_.load(std::memory_order_acquire);
+	}
+
 	bool size_greater_than(off64_t size) const
 	{
-		return this->file_->size() > size;
+		return this->tail_.load(std::memory_order_acquire) > size;
+	}
+
+	void preallocate(off64_t size) const
+	{
+		const auto lock = this->file_->lock();
+		(void)(lock);
+
+		if (size > this->tail_.load(std::memory_order_relaxed))
+		{
+			this->mark(lock);
+			this->file_->allocate(size);
+		}
 	}
 
-	void reopen(int flags, mode_t mode) const
+	void trim() const
 	{
-		return this->file_->reopen(flags, mode);
+		const auto lock = this->file_->lock();
+		(void)(lock);
+
+		if (this->extended_)
+		{
+			this->release(lock);
+		}
 	}
 
-	void build_keydir(keydir& kd) const
+	void seal() const
 	{
+		{
+			const auto lock = this->file_->lock();
+			(void)(lock);
+
+			// the tail of a file that was marked before it was opened has been checked by find_tail
+			if (this->marked_)
+			{
+				this->release(lock);
+			}
+		}
+		this->file_->reopen(O_RDONLY, 0664);
+
+		const auto lock = this->file_->lock();
+		(void)(lock);
+		this->direct_writer_.reset();
+	}
+
+	void truncate(off64_t size) const
+	{
+		const auto lock = this->file_->lock();
+		(void)(lock);
+
+		this->tail_.store(size, std::memory_order_release);
+		std::filesystem::resize_file(this->path(), static_cast<std::uintmax_t>(size));
+	}
+
+	void drop_cache() const
+	{
+		this->file_->advise(0, 0, POSIX_FADV_DONTNEED);
+	}
+
+	void warm() const
+	{
+		this->file_->advise(0, this->tail_.load(std::memory_order_acquire), POSIX_FADV_WILLNEED);
+	}
+
+	std::uint64_t reads() const
+	{
+		return this->reads_.load(std::memory_order_relaxed);
+	}
+
+	void count_reads(std::uint64_t n) const
+	{
+		this->reads_.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	bool build_keydir(keydir& kd, std::function<void(const damaged_region&)> on_damage) const
+	{
+		auto result = true;
 		{
 			const auto hint_path = this->hint_path();
 			if (std::filesystem::exists(hint_path))
 			{
-				return hintfile{ file::open(hint_path, O_RDONLY, 0664) }.build_keydir(kd, this->id_);
+				if (hintfile{ file::open(hint_path, O_RDONLY, 0664) }.build_keydir(
+				        kd, this->id_, this->index_, this->tail_.load(std::memory_order_acquire)))
+				{
+					return result;
+				}
+
+				// The hint file is derived from the data, so the data is scanned instead. The keys that were put from the
+				// hint file are put again, with the same location.
+				std::filesystem::remove(hint_path);
+				result = false;
 			}
 		}
 
@@ -201,31 +547,87 @@ public:
 			{
 				const auto& v = rec.value.value();
 				kd.put(rec.key,
-				       keydir::info{ .file_id   = this->id_,
-				                     .value_sz  = static_cast<value_sz_type>(v.value.size()),
-				                     .value_pos = v.value_pos,
-				                     .version   = v.version });
+				       keydir::info{ .file_id    = this->id_,
+				                     .file_index = this->index_,
+				                     .value_sz   = static_cast<value_sz_type>(v.value.size()),
+				                     .ksz        = static_cast<ksz_type>(rec.key.size()),
+				                     .value_pos  = v.value_pos,
+				                     .version    = v.version });
 			}
 			else
 			{
 				kd.del(rec.key);
 			}
-		});
+		},
+		               io_mode::cached,
+		               on_damage);
+
+		return result;
+	}
+
+	void write_hint() const
+	{
+		const auto hint_path = this->hint_path();
+		const auto temp_path = std::filesystem::path{ hint_path.string() + ".tmp" };
+
+		auto complete = true;
+		{
+			const auto hint_file = hintfile{ file::open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0664) };
+			this->traverse([&](const auto& rec) {
+				if (rec.value)
+				{
+					const auto& v = rec.value.value();
+					hint_file.put(hintfile::hint{ .version   = v.version,
+					                              .value_sz  = static_cast<value_sz_type>(v.value.size()),
+					                              .value_pos = v.value_pos,
+					                              .key       = rec.key });
+				}
+				else
+				{
+					complete = false;
+				}
+			});
+		}
+
+		if (complete)
+		{
+			std::filesystem::rename(temp_path, hint_path);
+		}
+		else
+		{
+			// a hint file cannot hold a delete, merged files have none
+			std::filesystem::remove(temp_path);
+		}
 	}
 
-	value_type get(const keydir::info& info) const
+	value_type get(const keydir::info& info, io_mode mode) const
 	{
 		auto value = value_type{};
 		if (info.value_sz)
 		{
-			value.resize(info.value_sz);
-			const auto lock = this->file_->lock();
-			this->file_->locked_seek(lock, info.value_pos);
-			this->file_->locked_read(lock, value.data(), value.size(), file::read_mode::count);
+			traced_phase(trace_phase::copy, [&] { value.resize(info.value_sz); });
+			this->read_at(info.value_pos, value.data(), value.size(), mode);
 		}
 		return value;
 	}
 
+	key_type get_key(const keydir::info& info) const
+	{
+		auto key = key_type{};
+		key.resize(info.ksz);
+		traced_phase(trace_phase::io,
+		             [&] { this->file_->read_at(info.value_pos - info.ksz, key.data(), key.size(), file::read_mode::count); });
+		return key;
+	}
+
+	value_type get_record(const keydir::info& info, io_mode mode) const
+	{
+		auto record = value_type{};
+		traced_phase(trace_phase::copy, [&] { record.resize(std::size_t{ info.ksz } + info.value_sz); });
+		this->read_at(info.value_pos - info.ksz, record.data(), record.size(), mode);
+		return record;
+	}
+
 	keydir::info put(const std::string_view& key, const std::string_view& value, version_type version) const
 	{
 		if (key.length() > max_ksz)
@@ -239,39 +641,46 @@ public:
 		}
 
 		const auto lock = this->file_->lock();
+		(void)(lock);
 
-		this->file_->locked_seek(lock, 0, SEEK_END);
+		const auto position = this->tail_.load(std::memory_order_relaxed);
 
 		auto header = record_header{};
 
 		header.version  = version;
 		header.ksz      = key.length();
 		header.value_sz = value.length();
-		header.init_crc();
 
-		if (!key.empty())
-		{
-			header.crc = crc32_fast(key.data(), key.length(), header.crc);
-		}
+		traced_phase(trace_phase::checksum, [&] {
+			header.init_crc();
 
-		if (!value.empty())
-		{
-			header.crc = crc32_fast(value.data(), value.length(), header.crc);
-		}
+			if (!key.empty())
+			{
+				header.crc = crc32_fast(key.data(), key.length(), header.crc);
+			}
+
+			if (!value.empty())
+			{
+				header.crc = crc32_fast(value.data(), value.length(), header.crc);
+			}
+		});
 
-		header.write(lock, *this->file_);
+		header.serialize();
 
-		this->file_->locked_write(lock, key.data(), key.length());
+		traced_phase(trace_phase::io,
+		             [&] { this->file_->write_at(position, { std::string_view{ header.buffer, record_header::size }, key, value }); });
 
-		const auto value_pos = this->file_->locked_position(lock);
+		const auto value_pos = position + static_cast<off64_t>(record_header::size + key.length());
 
-		this->file_->locked_write(lock, value.data(), value.length());
+		this->tail_.store(value_pos + static_cast<off64_t>(value.length()), std::memory_order_release);
 
 		return keydir::info{
-			.file_id   = this->id_,
-			.value_sz  = header.value_sz,
-			.value_pos = value_pos,
-			.version   = header.version,
+			.file_id    = this->id_,
+			.file_index = this->index_,
+			.value_sz   = header.value_sz,
+			.ksz        = header.ksz,
+			.value_pos  = value_pos,
+			.version    = header.version,
 		};
 	}
 
@@ -283,90 +692,247 @@ public:
 		}
 
 		const auto lock = this->file_->lock();
+		(void)(lock);
 
-		this->file_->locked_seek(lock, 0, SEEK_END);
+		const auto position = this->tail_.load(std::memory_order_relaxed);
 
 		auto header = record_header{};
 
 		header.version  = version;
 		header.ksz      = key.length();
 		header.value_sz = deleted_value_sz;
-		header.init_crc();
 
-		if (!key.empty())
-		{
-			header.crc = crc32_fast(key.data(), key.length(), header.crc);
-		}
+		traced_phase(trace_phase::checksum, [&] {
+			header.init_crc();
 
-		header.write(lock, *this->file_);
+			if (!key.empty())
+			{
+				header.crc = crc32_fast(key.data(), key.length(), header.crc);
+			}
+		});
+
+		header.serialize();
 
-		this->file_->locked_write(lock, key.data(), key.length());
+		traced_phase(trace_phase::io,
+		             [&] { this->file_->write_at(position, { std::string_view{ header.buffer, record_header::size }, key }); });
+
+		this->tail_.store(position + static_cast<off64_t>(record_header::size + key.length()), std::memory_order_release);
 	}
 
-	void traverse(std::function<void(const record&)> callback) const
+	std::vector<keydir::info> append(const std::vector<write_op>& ops, io_mode mode) const
 	{
+		auto buffer = std::string{};
+		auto infos  = std::vector<keydir::info>{};
+		infos.reserve(ops.size());
+
 		const auto lock = this->file_->lock();
+		(void)(lock);
 
-		this->file_->locked_seek(lock, 0);
+		const auto start = this->tail_.load(std::memory_order_relaxed);
 
-		auto header = record_header{};
+		for (const auto& op : ops)
+		{
+			if (op.key.length() > max_ksz)
+			{
+				throw std::runtime_error{ fmt::format("Key length exceeds limit of {}", max_ksz) };
+			}
 
-		auto key_buffer = std::string{};
-		key_buffer.reserve(4096u);
+			if (op.value && op.value->length() > max_value_sz)
+			{
+				throw std::runtime_error{ fmt::format("Value length exceeds limit of {}", max_value_sz) };
+			}
+
+			auto header = record_header{};
+
+			header.version  = op.version;
+			header.ksz      = op.key.length();
+			header.value_sz = op.value ? op.value->length() : deleted_value_sz;
+			header.init_crc();
+
+			if (!op.key.empty())
+			{
+				header.crc = crc32_fast(op.key.data(), op.key.length(), header.crc);
+			}
+
+			if (op.value && !op.value->empty())
+			{
+				header.crc = crc32_fast(op.value->data(), op.value->length(), header.crc);
+			}
 
-		auto value_buffer = std::string{};
-		value_buffer.reserve(4096u);
+			header.serialize();
+			buffer.append(header.buffer, record_header::size);
+			buffer.append(op.key);
 
-		for (;;)
+			infos.push_back(keydir::info{
+			    .file_id    = this->id_,
+			    .file_index = this->index_,
+			    .value_sz   = op.value ? header.value_sz : value_sz_type{},
+			    .ksz        = header.ksz,
+			    .value_pos  = start + static_cast<value_pos_type>(buffer.size()),
+			    .version    = header.version,
+			});
+
+			if (op.value)
+			{
+				buffer.append(*op.value);
+			}
+		}
+
+		if (mode != io_mode::direct || !this->write_direct(lock, start, buffer))
 		{
-			const auto position = this->file_->locked_position(lock);
+			this->file_->write_at(start, { buffer });
+		}
 
-			auto crc = crc_type{};
+		this->tail_.store(start + static_cast<off64_t>(buffer.size()), std::memory_order_release);
+		return infos;
+	}
 
-			if (!header.read(lock, *this->file_, crc))
+	// Returns the position of the first record at or after `from` whose CRC matches, or `tail` if there is none.
+	// Scanning damage must not cost a CRC over a whole candidate record at every position: most positions are rejected
+	// by record_header::plausible, and a candidate must be followed by a plausible header, zeros (preallocated space)
+	// or the end of the data. A record that is directly followed by more damage is therefore skipped as well.
+	// The file is read in windows that overlap by half, so that each byte is read twice at most and every candidate
+	// of up to half a window is verified from memory. Larger candidates are read separately.
+	off64_t resync(off64_t from, off64_t tail) const
+	{
+		constexpr auto window_size = std::size_t{ 2u * 1024u * 1024u };
+		constexpr auto step        = window_size / 2u;
+
+		auto window = std::string{};
+		auto body   = std::string{};
+		auto header = record_header{};
+		auto next   = record_header{};
+
+		for (auto window_pos = from; window_pos + static_cast<off64_t>(record_header::size) <= tail;
+		     window_pos += static_cast<off64_t>(step))
+		{
+			window.resize(static_cast<std::size_t>(std::min(static_cast<off64_t>(window_size), tail - window_pos)));
+			this->file_->read_at(window_pos, window.data(), window.size(), file::read_mode::count);
+
+			const auto last  = window_pos + static_cast<off64_t>(window.size()) == tail;
+			const auto count = last ? window.size() - record_header::size + 1u : step;
+
+			for (auto i = std::size_t{}; i < count; ++i)
+			{
+				const auto position = window_pos + static_cast<off64_t>(i);
+
+				header.decode(window.data() + i);
+				if (!header.plausible(tail - position))
+				{
+					continue;
+				}
+
+				const auto end       = i + static_cast<std::size_t>(header.record_size());
+				const auto following = position + header.record_size();
+				if (end + record_header::size <= window.size())
+				{
+					next.decode(window.data() + end);
+				}
+				else if (following + static_cast<off64_t>(record_header::size) > tail || !next.read_at(*this->file_, following))
+				{
+					next = record_header{}; // the end of the data, or a torn header after the record
+				}
+
+				if (!next.is_zero() && !next.plausible(tail - following))
+				{
+					continue;
+				}
+
+				auto crc = header.header_crc();
+				if (end <= window.size())
+				{
+					crc = crc32_fast(window.data() + i + record_header::size, end - i - record_header::size, crc);
+				}
+				else
+				{
+					body.resize(static_cast<std::size_t>(header.record_size()) - record_header::size);
+					this->file_->read_at(
+					    position + static_cast<off64_t>(record_header::size), body.data(), body.size(), file::read_mode::count);
+					crc = crc32_fast(body.data(), body.size(), crc);
+				}
+
+				if (crc == header.crc)
+				{
+					return position;
+				}
+			}
+
+			if (last)
 			{
 				break;
 			}
+		}
+		return tail;
+	}
 
-			// read the key
-			const auto key_buffer_size = std::max(key_buffer.capacity(), static_cast<std::string::size_type>(header.ksz));
-			key_buffer.resize(key_buffer_size);
+	void traverse(std::function<void(const record&)>         callback,
+	              io_mode                                    mode      = io_mode::cached,
+	              std::function<void(const damaged_region&)> on_damage = {}) const
+	{
+		const auto tail   = this->tail_.load(std::memory_order_acquire);
+		const auto direct = mode == io_mode::direct ? this->direct_reader() : nullptr;
 
-			this->file_->locked_read(lock, key_buffer.data(), header.ksz, file::read_mode::count);
+		auto reader = sequential_reader{ direct ? *direct : *this->file_, tail };
+		auto header = record_header{};
+
+		// Skips a record that was cut short by a crash, or whose CRC does not match, and the garbage after it.
+		const auto skip_damage = [&](off64_t position) {
+			const auto next = this->resync(position + 1, tail);
+			if (on_damage)
+			{
+				on_damage(damaged_region{ .path = this->path(), .offset = position, .length = next - position, .truncated = false });
+			}
+			reader.seek(next);
+		};
+
+		while (reader.position() < tail)
+		{
+			const auto position = reader.position();
 
-			crc = crc32_fast(key_buffer.data(), header.ksz, crc);
+			const auto header_data = reader.read(record_header::size);
+			if (header_data.size() != record_header::size)
+			{
+				skip_damage(position);
+				continue;
+			}
 
-			auto rec = record{ .key = std::string_view{ key_buffer }.substr(0, header.ksz), .value = std::nullopt };
+			auto crc = crc_type{};
+			header.read(header_data.data(), crc);
 
 			// Not using a tombstone value as delete marker (as mentioned in https://riak.com/assets/bitcask-intro.pdf)
 			// because any value, no matter how unique, could not be used as a real value.
 			// Maybe that's just splitting hairs, but it's just not my idea of good practice.
 			// I'm using maximum length as delete marker.
-			if (header.value_sz != deleted_value_sz)
-			{
-				const auto value_pos = this->file_->locked_position(lock);
-
-				const auto value_buffer_size = std::max(value_buffer.capacity(), static_cast<std::string::size_type>(header.value_sz));
-				value_buffer.resize(value_buffer_size);
+			const auto deleted  = header.value_sz == deleted_value_sz;
+			const auto data_len = std::size_t{ header.ksz } + (deleted ? 0u : header.value_sz);
 
-				this->file_->locked_read(lock, value_buffer.data(), header.value_sz, file::read_mode::count);
-
-				crc = crc32_fast(value_buffer.data(), header.value_sz, crc);
+			if (position + header.record_size() > tail)
+			{
+				skip_damage(position);
+				continue;
+			}
 
-				rec.value = record::value_info{ .value_pos = value_pos,
-					                            .value     = std::string_view{ value_buffer }.substr(0, header.value_sz),
-					                            .version   = header.version };
+			// the key and the value in one piece, a second read could move the first
+			const auto data = reader.read(data_len);
+			if (data.size() != data_len)
+			{
+				skip_damage(position);
+				continue;
 			}
 
+			crc = crc32_fast(data.data(), data.size(), crc);
 			if (crc != header.crc)
 			{
-				// TODO: try to recover from this.
-				// Starting at the current position, seek forward 1 byte per iteration and try
-				// to read the next record. Continue this iteration until a valid record is found
-				// or until EOF is reached.
-				// A corrupted file can happen for multiple reasons, this should not be fatal.
-				throw std::runtime_error{ fmt::format(
-					"{}: CRC mismatch in record at position {}", this->file_->path().string(), position) };
+				skip_damage(position);
+				continue;
+			}
+
+			auto rec = record{ .key = data.substr(0, header.ksz), .value = std::nullopt };
+			if (!deleted)
+			{
+				rec.value = record::value_info{ .value_pos = position + static_cast<off64_t>(record_header::size + header.ksz),
+					                            .value     = data.substr(header.ksz),
+					                            .version   = header.version };
 			}
 
 			callback(rec);
@@ -374,8 +940,8 @@ public:
 	}
 };
 
-datafile::datafile(std::unique_ptr<file>&& f)
-    : pimpl_{ std::make_unique<impl>(std::move(f)) }
+datafile::datafile(std::unique_ptr<file>&& f, file_index_type index)
+    : pimpl_{ std::make_unique<impl>(std::move(f), index) }
 {
 }
 
@@ -388,6 +954,11 @@ file_id_type datafile::id() const
 	return this->pimpl_->id();
 }
 
+file_index_type datafile::index() const
+{
+	return this->pimpl_->index();
+}
+
 std::filesystem::path datafile::path() const
 {
 	return this->pimpl_->path();
@@ -403,24 +974,84 @@ std::filesystem::path datafile::hint_path(const std::filesystem::path& path)
 	return impl::hint_path(path);
 }
 
+std::filesystem::path datafile::preallocated_path(const std::filesystem::path& path)
+{
+	return impl::preallocated_path(path);
+}
+
+off64_t datafile::size() const
+{
+	return this->pimpl_->size();
+}
+
 bool datafile::size_greater_than(off64_t size) const
 {
 	return this->pimpl_->size_greater_than(size);
 }
 
-void datafile::reopen(int flags, mode_t mode) const
+void datafile::preallocate(off64_t size) const
+{
+	return this->pimpl_->preallocate(size);
+}
+
+void datafile::trim() const
+{
+	return this->pimpl_->trim();
+}
+
+void datafile::seal() const
+{
+	return this->pimpl_->seal();
+}
+
+void datafile::truncate(off64_t size) const
+{
+	return this->pimpl_->truncate(size);
+}
+
+void datafile::drop_cache() const
+{
+	return this->pimpl_->drop_cache();
+}
+
+void datafile::warm() const
 {
-	return this->pimpl_->reopen(flags, mode);
+	return this->pimpl_->warm();
 }
 
-void datafile::build_keydir(keydir& kd) const
+std::uint64_t datafile::reads() const
 {
-	return this->pimpl_->build_keydir(kd);
+	return this->pimpl_->reads();
 }
 
-value_type datafile::get(const keydir::info& info) const
+void datafile::count_reads(std::uint64_t n) const
 {
-	return this->pimpl_->get(info);
+	return this->pimpl_->count_reads(n);
+}
+
+bool datafile::build_keydir(keydir& kd, std::function<void(const damaged_region&)> on_damage) const
+{
+	return this->pimpl_->build_keydir(kd, on_damage);
+}
+
+void datafile::write_hint() const
+{
+	return this->pimpl_->write_hint();
+}
+
+value_type datafile::get(const keydir::info& info, io_mode mode) const
+{
+	return this->pimpl_->get(info, mode);
+}
+
+key_type datafile::get_key(const keydir::info& info) const
+{
+	return this->pimpl_->get_key(info);
+}
+
+value_type datafile::get_record(const keydir::info& info, io_mode mode) const
+{
+	return this->pimpl_->get_record(info, mode);
 }
 
 keydir::info datafile::put(const std::string_view& key, const std::string_view& value, version_type version) const
@@ -433,9 +1064,14 @@ void datafile::del(const std::string_view& key, version_type version) const
 	return this->pimpl_->del(key, version);
 }
 
-void datafile::traverse(std::function<void(const record&)> callback) const
+std::vector<keydir::info> datafile::append(const std::vector<write_op>& ops, io_mode mode) const
+{
+	return this->pimpl_->append(ops, mode);
+}
+
+void datafile::traverse(std::function<void(const record&)> callback, io_mode mode, std::function<void(const damaged_region&)> on_damage) const
 {
-	return this->pimpl_->traverse(callback);
+	return this->pimpl_->traverse(callback, mode, on_damage);
 }
 
 } // namespace bitcask
@@ -11,15 +11,34 @@
 #include "basictypes.h"
 #include "keydir.h"
 #include "hintfile.h"
+#include "recovery.h"
 
 #include <memory>
 #include <regex>
 #include <filesystem>
 #include <optional>
 #include <functional>
+#include <vector>
 
 namespace bitcask {
 
+/// How data file I/O treats the page cache.
+/// Direct I/O (O_DIRECT) bypasses it, so that bulk reads and writes do not evict data that other readers need.
+/// If the file system does not support O_DIRECT, direct I/O falls back to cached I/O.
+enum class io_mode
+{
+	cached,
+	direct,
+};
+
+/// A record to append: a put, or a delete if there is no value.
+struct write_op final
+{
+	std::string_view                key;
+	std::optional<std::string_view> value;
+	version_type                    version;
+};
+
 class datafile final
 {
 	class impl;
@@ -30,7 +49,7 @@ public:
 
 	static std::string make_filename(file_id_type id);
 
-	explicit datafile(std::unique_ptr<file>&& f);
+	datafile(std::unique_ptr<file>&& f, file_index_type index);
 	~datafile() noexcept;
 
 	datafile(datafile&&)            = default;
@@ -40,20 +59,64 @@ public:
 	datafile& operator=(const datafile&) = delete;
 
 	file_id_type          id() const;
+	file_index_type       index() const;
 	std::filesystem::path path() const;
 	std::filesystem::path hint_path() const;
 
 	static std::filesystem::path hint_path(const std::filesystem::path& path);
 
+	/// The marker of a file that may hold zeros after its data, because space was preallocated or a direct write
+	/// filled its last block. It exists from before the first zero is written until the file is trimmed.
+	static std::filesystem::path preallocated_path(const std::filesystem::path& path);
+
+	/// Size of the data, which is less than the file size if space is preallocated.
+	off64_t size() const;
+
+	/// Compares the size of the data, which is less than the file size if space is preallocated.
 	bool size_greater_than(off64_t size) const;
-	void reopen(int flags, mode_t mode) const;
 
-	void build_keydir(keydir& kd) const;
+	/// Reserves disk space for `size` bytes of data, if the file system supports it.
+	/// Appends then fill the reserved space instead of growing the file.
+	void preallocate(off64_t size) const;
+
+	/// Releases the space beyond the end of the data, if this process has written zeros after it.
+	/// Other files are left as they are: their size is the size of the data, unless they are marked.
+	void trim() const;
 
-	value_type   get(const keydir::info& info) const;
+	/// Trims a marked file and reopens the file read-only, when it is no longer the active file.
+	void seal() const;
+
+	/// Cuts the data off at `size`, e.g. before a record that was torn by a crash.
+	void truncate(off64_t size) const;
+
+	/// Asks the kernel to drop the cached pages of the file, e.g. after a merge has read it.
+	void drop_cache() const;
+
+	/// Asks the kernel to read the data into the page cache, in the background.
+	void warm() const;
+
+	/// Sampled number of gets served by this file, see datadir::warm.
+	std::uint64_t reads() const;
+	void          count_reads(std::uint64_t n) const;
+
+	/// Uses the hint file if there is one. Damaged records are skipped and reported to `on_damage`, see traverse.
+	/// Returns false if the hint file was damaged: it has then been removed and the data was scanned instead.
+	bool build_keydir(keydir& kd, std::function<void(const damaged_region&)> on_damage = {}) const;
+
+	/// Writes the hint file from the data, through a temporary file, so that a reader never sees half of it.
+	void write_hint() const;
+
+	value_type   get(const keydir::info& info, io_mode mode = io_mode::cached) const;
+	key_type     get_key(const keydir::info& info) const;
+	value_type   get_record(const keydir::info& info, io_mode mode = io_mode::cached) const; // the key, immediately followed by the value
 	keydir::info put(const std::string_view& key, const std::string_view& value, version_type version) const;
 	void         del(const std::string_view& key, version_type version) const;
 
+	/// Appends the records with a single write, and returns their locations in the same order.
+	/// The location of a delete is meaningless.
+	/// A direct append rewrites the last block of the data and zero-fills the rest of its last block, see preallocated_path().
+	std::vector<keydir::info> append(const std::vector<write_op>& ops, io_mode mode = io_mode::cached) const;
+
 	struct record
 	{
 		struct value_info
@@ -67,7 +130,12 @@ public:
 		std::optional<value_info> value;
 	};
 
-	void traverse(std::function<void(const record&)> callback) const;
+	/// Reads the records in large chunks. The views in the record are valid during the callback only.
+	/// A record that is cut short or has a bad CRC does not stop the traversal: the file is scanned for the next
+	/// record with a valid CRC, and the region in between is reported to `on_damage`.
+	void traverse(std::function<void(const record&)>         callback,
+	              io_mode                                    mode      = io_mode::cached,
+	              std::function<void(const damaged_region&)> on_damage = {}) const;
 };
 
 } // namespace bitcask
@@ -51,3 +51,8 @@ endif()
 # 		endif()
 # 	endif()
 # endif()
+
+# Google Benchmark, for the micro-benchmarks only. They are not built if it is not installed.
+if(NOT TARGET benchmark::benchmark)
+	find_package(benchmark QUIET)
+endif()
@@ -0,0 +1,235 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "locktypes.hpp"
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// Epoch based memory reclamation.
+// A reader pins the current thread for as long as it uses objects that a writer may unlink concurrently.
+// The writer unlinks an object, then retires it. The object is freed once every thread that was pinned
+// at the moment of retirement has unpinned. Pinning costs a thread local access, a store and a fence;
+// it takes no lock and writes no shared cache line.
+// There is one domain per process, shared by all data structures.
+class epoch_domain final
+{
+	struct alignas(64) participant final
+	{
+		std::atomic<std::uint64_t> epoch{};   // the epoch announced while pinned, 0 while not pinned
+		std::atomic<bool>          claimed{}; // owned by a thread
+		std::size_t                depth{};   // pin nesting, only accessed by the owning thread
+		participant*               next{};
+	};
+
+	struct retired final
+	{
+		std::uint64_t epoch;
+		void*         object;
+		void (*deleter)(void*);
+		std::size_t cost;
+	};
+
+	// A participant per thread, claimed on first use and released when the thread exits.
+	// Participants are never freed, but reused by later threads.
+	class registration final
+	{
+		participant* participant_;
+
+	public:
+		explicit registration(epoch_domain& domain)
+		    : participant_{ domain.claim() }
+		{
+		}
+
+		~registration() noexcept
+		{
+			this->participant_->claimed.store(false, std::memory_order_release);
+		}
+
+		registration(const registration&)            = delete;
+		registration& operator=(const registration&) = delete;
+
+		participant& get() const noexcept
+		{
+			return *this->participant_;
+		}
+	};
+
+	std::atomic<std::uint64_t> epoch_;
+	std::atomic<participant*>  participants_;
+	locker                     locker_; // guards retired_, cost_ and next_collect_
+	std::vector<retired>       retired_;
+	std::size_t                cost_;         // of the retired objects
+	std::size_t                next_collect_; // the cost at which retire collects
+
+	epoch_domain()
+	    : epoch_{ 1u }
+	    , participants_{}
+	    , locker_{ "epoch.retired" }
+	    , retired_{}
+	    , cost_{}
+	    , next_collect_{ collect_threshold }
+	{
+	}
+
+	participant* claim()
+	{
+		for (auto p = this->participants_.load(std::memory_order_acquire); p; p = p->next)
+		{
+			auto claimed = false;
+			if (!p->claimed.load(std::memory_order_relaxed) && p->claimed.compare_exchange_strong(claimed, true))
+			{
+				return p;
+			}
+		}
+
+		auto p     = new participant{};
+		p->claimed = true;
+		p->next    = this->participants_.load(std::memory_order_relaxed);
+		while (!this->participants_.compare_exchange_weak(p->next, p))
+		{
+		}
+		return p;
+	}
+
+	participant& local()
+	{
+		thread_local auto reg = registration{ *this };
+		return reg.get();
+	}
+
+	// Frees the retired objects that no pinned thread can still see. Must hold the lock.
+	void collect_locked()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		auto oldest = std::numeric_limits<std::uint64_t>::max();
+		for (auto p = this->participants_.load(std::memory_order_acquire); p; p = p->next)
+		{
+			const auto epoch = p->epoch.load(std::memory_order_acquire);
+			if (epoch)
+			{
+				oldest = std::min(oldest, epoch);
+			}
+		}
+
+		const auto it = std::partition(this->retired_.begin(), this->retired_.end(), [&](const auto& r) { return r.epoch >= oldest; });
+		std::for_each(it, this->retired_.end(), [this](const auto& r) {
+			r.deleter(r.object);
+			this->cost_ -= r.cost;
+		});
+		this->retired_.erase(it, this->retired_.end());
+
+		// what a pinned reader still holds does not make every following retire collect
+		this->next_collect_ = this->cost_ + collect_threshold;
+	}
+
+public:
+	/// Retired objects are freed in batches, once their total cost reaches this.
+	static constexpr auto collect_threshold = std::size_t{ 64u };
+
+	class guard final
+	{
+		participant* participant_;
+
+	public:
+		explicit guard(participant& p) noexcept
+		    : participant_{ &p }
+		{
+		}
+
+		~guard() noexcept
+		{
+			if (--this->participant_->depth == 0u)
+			{
+				this->participant_->epoch.store(0u, std::memory_order_release);
+			}
+		}
+
+		guard(const guard&)            = delete;
+		guard& operator=(const guard&) = delete;
+	};
+
+	~epoch_domain() noexcept
+	{
+		std::for_each(this->retired_.begin(), this->retired_.end(), [](const auto& r) { r.deleter(r.object); });
+	}
+
+	epoch_domain(const epoch_domain&)            = delete;
+	epoch_domain& operator=(const epoch_domain&) = delete;
+
+	static epoch_domain& instance()
+	{
+		static auto domain = epoch_domain{};
+		return domain;
+	}
+
+	/// Pins the current thread until the guard is destroyed. Guards may be nested.
+	[[nodiscard]] guard pin()
+	{
+		auto& p = this->local();
+		if (p.depth++ == 0u)
+		{
+			p.epoch.store(this->epoch_.load(std::memory_order_acquire), std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+		return guard{ p };
+	}
+
+	/// Frees `object` with `deleter` once no reader can see it anymore. The object must already be unreachable.
+	/// An object that holds much memory or a resource such as a file descriptor should cost collect_threshold,
+	/// so that it is freed as soon as the readers let go of it, instead of with the next batch.
+	void retire(void* object, void (*deleter)(void*), std::size_t cost = 1u)
+	{
+		const auto epoch = this->epoch_.fetch_add(1u, std::memory_order_seq_cst);
+
+		const auto lock = this->locker_.lock();
+		(void)(lock);
+
+		this->retired_.push_back(retired{ .epoch = epoch, .object = object, .deleter = deleter, .cost = cost });
+		this->cost_ += cost;
+		if (this->cost_ >= this->next_collect_)
+		{
+			this->collect_locked();
+		}
+	}
+
+	template<typename T>
+	void retire(T* object, std::size_t cost = 1u)
+	{
+		this->retire(object, [](void* p) { delete static_cast<T*>(p); }, cost);
+	}
+
+	/// Frees what can be freed now.
+	void collect()
+	{
+		const auto lock = this->locker_.lock();
+		(void)(lock);
+
+		this->collect_locked();
+	}
+
+	/// Number of retired objects that are not freed yet.
+	std::size_t pending()
+	{
+		const auto lock = this->locker_.lock();
+		(void)(lock);
+
+		return this->retired_.size();
+	}
+};
+
+} // namespace bitcask
@@ -10,6 +10,7 @@
 #include <fmt/format.h>
 
 #include <system_error>
+#include <array>
 #include <cassert>
 
 #ifdef _MSC_VER
@@ -20,6 +21,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef _MSC_VER
@@ -60,6 +62,34 @@ void close_file(int& fd) noexcept
 	fd = -1;
 }
 
+std::size_t check_read(ssize_t rc, std::size_t count, file::read_mode mode, const std::filesystem::path& path)
+{
+	if (rc < 0)
+	{
+		throw std::system_error{ std::error_code{ errno, std::system_category() }, path.string() + ": read" };
+	}
+
+	switch (mode)
+	{
+	case file::read_mode::any:
+		return static_cast<std::size_t>(rc);
+	case file::read_mode::zero_or_count:
+		if (rc == 0 || static_cast<std::size_t>(rc) == count)
+		{
+			return static_cast<std::size_t>(rc);
+		}
+		break;
+	case file::read_mode::count:
+		if (static_cast<std::size_t>(rc) == count)
+		{
+			return count;
+		}
+		break;
+	}
+
+	throw std::runtime_error{ fmt::format("{}: read: unexpected end of file", path.string()) };
+}
+
 } // namespace
 
 class file::impl
@@ -72,7 +102,7 @@ public:
 	explicit impl(int fd, const std::filesystem::path& path)
 	    : fd_{ fd }
 	    , path_{ path }
-	    , locker_{}
+	    , locker_{ "file" }
 	{
 	}
 
@@ -86,8 +116,15 @@ public:
 		const auto lock = this->locker_.lock();
 		(void)(lock);
 
-		close_file(this->fd_);
-		this->fd_ = open_file(this->path_, flags, mode);
+		// Replace the descriptor atomically, so that a concurrent read_at never sees a closed descriptor.
+		auto fd = open_file(this->path_, flags, mode);
+		if (::dup2(fd, this->fd_) == -1)
+		{
+			const auto error = errno;
+			close_file(fd);
+			throw std::system_error{ std::error_code{ error, std::system_category() }, this->path_.string() + ": dup2" };
+		}
+		close_file(fd);
 	}
 
 	const std::filesystem::path& path() const noexcept
@@ -138,32 +175,78 @@ public:
 		}
 
 		//	fslog(trace, "read fd={} count={}", this->fd_, count);
-		const auto rc = c_read(this->fd_, buf, count);
+		return check_read(c_read(this->fd_, buf, count), count, mode, this->path_);
+	}
 
-		if (rc < 0)
+	std::size_t read_at(off64_t offset, void* buf, std::size_t count, read_mode mode) const
+	{
+		if (count == 0u)
 		{
-			throw std::system_error{ std::error_code{ errno, std::system_category() }, this->path_.string() + ": read" };
+			return count;
 		}
 
-		switch (mode)
+		return check_read(::pread64(this->fd_, buf, count, offset), count, mode, this->path_);
+	}
+
+	void write_at(off64_t offset, std::initializer_list<std::string_view> buffers) const
+	{
+		auto iov   = std::array<iovec, 4>{};
+		auto count = std::size_t{};
+		for (const auto& buffer : buffers)
 		{
-		case read_mode::any:
-			return static_cast<std::size_t>(rc);
-		case read_mode::zero_or_count:
-			if (rc == 0 || static_cast<std::size_t>(rc) == count)
+			assert(count < iov.size());
+			if (!buffer.empty())
 			{
-				return static_cast<std::size_t>(rc);
+				iov[count++] = iovec{ .iov_base = const_cast<char*>(buffer.data()), .iov_len = buffer.size() };
 			}
-			break;
-		case read_mode::count:
-			if (static_cast<std::size_t>(rc) == count)
+		}
+
+		// pwritev may write less than requested, continue with what is left
+		auto first = iov.data();
+		auto last  = iov.data() + count;
+		while (first != last)
+		{
+			const auto rc = ::pwritev64(this->fd_, first, static_cast<int>(last - first), offset);
+			if (rc <= 0)
 			{
-				return count;
+				throw std::system_error{ std::error_code{ rc ? errno : EIO, std::system_category() }, this->path_.string() + ": write" };
+			}
+
+			offset += rc;
+			auto written = static_cast<std::size_t>(rc);
+			while (first != last && written >= first->iov_len)
+			{
+				written -= first->iov_len;
+				++first;
+			}
+			if (first != last)
+			{
+				first->iov_base = static_cast<char*>(first->iov_base) + written;
+				first->iov_len -= written;
 			}
-			break;
 		}
+	}
+
+	void advise(off64_t offset, off64_t length, int advice) const
+	{
+		// only a hint, failure is not an error
+		(void)(::posix_fadvise64(this->fd_, offset, length, advice));
+	}
 
-		throw std::runtime_error{ fmt::format("{}: read: unexpected end of file", this->path_.string()) };
+	bool allocate(off64_t size) const
+	{
+		if (::fallocate64(this->fd_, 0, 0, size) == 0)
+		{
+			return true;
+		}
+		else if (errno == EOPNOTSUPP || errno == ENOSYS)
+		{
+			return false;
+		}
+		else
+		{
+			throw std::system_error{ std::error_code{ errno, std::system_category() }, this->path_.string() + ": fallocate" };
+		}
 	}
 
 	void locked_write(const lock_type&, const void* buf, std::size_t count) const
@@ -261,6 +344,26 @@ off64_t file::size() const
 	return this->pimpl_->size();
 }
 
+std::size_t file::read_at(off64_t offset, void* buf, std::size_t count, read_mode mode) const
+{
+	return this->pimpl_->read_at(offset, buf, count, mode);
+}
+
+void file::write_at(off64_t offset, std::initializer_list<std::string_view> buffers) const
+{
+	return this->pimpl_->write_at(offset, buffers);
+}
+
+void file::advise(off64_t offset, off64_t length, int advice) const
+{
+	return this->pimpl_->advise(offset, length, advice);
+}
+
+bool file::allocate(off64_t size) const
+{
+	return this->pimpl_->allocate(size);
+}
+
 lock_type file::lock() const
 {
 	return this->pimpl_->lock();
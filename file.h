@@ -11,6 +11,8 @@
 
 #include <filesystem>
 #include <memory>
+#include <string_view>
+#include <initializer_list>
 
 #include <sys/stat.h>
 
@@ -52,6 +54,20 @@ public:
 	off64_t     position() const;
 	off64_t     size() const;
 
+	// Reads at the given offset without using or moving the file position, so it does not lock.
+	std::size_t read_at(off64_t offset, void* buf, std::size_t count, read_mode mode) const;
+
+	// Writes the buffers one after the other at the given offset, without using or moving the file position,
+	// so it does not lock. The caller must make sure that concurrent writes do not overlap.
+	void write_at(off64_t offset, std::initializer_list<std::string_view> buffers) const;
+
+	// Tells the kernel how the range will be used, see posix_fadvise. A length of 0 means up to the end of the file.
+	void advise(off64_t offset, off64_t length, int advice) const;
+
+	// Reserves disk space for the first `size` bytes. A smaller file grows to `size`, the added bytes read as zeros.
+	// Returns false if the file system does not support it.
+	bool allocate(off64_t size) const;
+
 	// Lock this instance.
 	// Use this lock if you need to perform several dependent operations. For example,
 	// to perform a seek and a write, first get a lock, then pass that lock to locked_seek and locked_write.
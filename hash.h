@@ -0,0 +1,129 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+namespace bitcask {
+
+// wyhash (final version 4) by Wang Yi, released into the public domain.
+// See https://github.com/wangyi-fudan/wyhash
+namespace wyhash_detail {
+
+inline void mum(std::uint64_t& a, std::uint64_t& b)
+{
+#if defined(__SIZEOF_INT128__)
+	__extension__ using uint128 = unsigned __int128;
+
+	const auto r = static_cast<uint128>(a) * b;
+	a            = static_cast<std::uint64_t>(r);
+	b            = static_cast<std::uint64_t>(r >> 64);
+#else
+	const auto ha = a >> 32, hb = b >> 32, la = static_cast<std::uint32_t>(a), lb = static_cast<std::uint32_t>(b);
+	const auto rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+	auto       c  = static_cast<std::uint64_t>(t < rl);
+	const auto lo = t + (rm1 << 32);
+	c += lo < t;
+	const auto hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	a             = lo;
+	b             = hi;
+#endif
+}
+
+inline std::uint64_t mix(std::uint64_t a, std::uint64_t b)
+{
+	mum(a, b);
+	return a ^ b;
+}
+
+inline std::uint64_t r8(const std::uint8_t* p)
+{
+	auto v = std::uint64_t{};
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline std::uint64_t r4(const std::uint8_t* p)
+{
+	auto v = std::uint32_t{};
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline std::uint64_t r3(const std::uint8_t* p, std::size_t k)
+{
+	return (static_cast<std::uint64_t>(p[0]) << 16) | (static_cast<std::uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+constexpr std::uint64_t secret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+} // namespace wyhash_detail
+
+inline std::uint64_t wyhash(const void* key, std::size_t len, std::uint64_t seed = 0u)
+{
+	using namespace wyhash_detail;
+
+	auto p = static_cast<const std::uint8_t*>(key);
+	seed ^= mix(seed ^ secret[0], secret[1]);
+
+	auto a = std::uint64_t{};
+	auto b = std::uint64_t{};
+	if (len <= 16u)
+	{
+		if (len >= 4u)
+		{
+			a = (r4(p) << 32) | r4(p + ((len >> 3) << 2));
+			b = (r4(p + len - 4) << 32) | r4(p + len - 4 - ((len >> 3) << 2));
+		}
+		else if (len > 0u)
+		{
+			a = r3(p, len);
+			b = 0u;
+		}
+	}
+	else
+	{
+		auto i = len;
+		if (i > 48u)
+		{
+			auto see1 = seed;
+			auto see2 = seed;
+			do
+			{
+				seed = mix(r8(p) ^ secret[1], r8(p + 8) ^ seed);
+				see1 = mix(r8(p + 16) ^ secret[2], r8(p + 24) ^ see1);
+				see2 = mix(r8(p + 32) ^ secret[3], r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48u);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16u)
+		{
+			seed = mix(r8(p) ^ secret[1], r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = r8(p + i - 16);
+		b = r8(p + i - 8);
+	}
+	a ^= secret[1];
+	b ^= seed;
+	mum(a, b);
+	return mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+inline std::uint64_t hash_key(const std::string_view& key)
+{
+	return wyhash(key.data(), key.size());
+}
+
+} // namespace bitcask
@@ -9,8 +9,6 @@
 #include "crc32.h"
 #include "hton.h"
 
-#include <fmt/format.h>
-
 #include <functional>
 #include <cstring>
 
@@ -31,9 +29,11 @@ struct record_header
 
 	char buffer[size];
 
-	bool read(const lock_type& lock, file& f, crc_type& crc)
+	// Returns the number of bytes read, the header is only decoded if all of it was read.
+	std::size_t read(const lock_type& lock, file& f, crc_type& crc)
 	{
-		if (f.locked_read(lock, this->buffer, size, file::read_mode::zero_or_count))
+		const auto n = f.locked_read(lock, this->buffer, size, file::read_mode::any);
+		if (n == size)
 		{
 			auto src = this->buffer;
 
@@ -58,13 +58,8 @@ struct record_header
 			this->ksz       = ntoh(this->ksz);
 			this->value_sz  = ntoh(this->value_sz);
 			this->value_pos = ntoh(this->value_pos);
-
-			return true;
-		}
-		else
-		{
-			return false;
 		}
+		return n;
 	}
 
 	void init_crc()
@@ -131,10 +126,14 @@ class hintfile::impl
 		std::string_view key;
 	};
 
-	void traverse(std::function<void(const record&)> callback) const
+	// Returns false if the file is damaged: a record is cut short, its CRC does not match,
+	// or it points beyond `data_size`, the size of the data file.
+	bool traverse(off64_t data_size, std::function<void(const record&)> callback) const
 	{
 		const auto lock = this->file_->lock();
 
+		const auto size = this->file_->locked_size(lock);
+
 		this->file_->locked_seek(lock, 0);
 
 		auto rec = record{};
@@ -148,9 +147,14 @@ class hintfile::impl
 
 			auto crc = crc_type{};
 
-			if (!rec.header.read(lock, *this->file_, crc))
+			const auto n = rec.header.read(lock, *this->file_, crc);
+			if (n == 0u)
+			{
+				return true;
+			}
+			if (n != record_header::size || position + static_cast<off64_t>(record_header::size + rec.header.ksz) > size)
 			{
-				break;
+				return false;
 			}
 
 			// read the key
@@ -163,13 +167,9 @@ class hintfile::impl
 
 			rec.key = std::string_view{ key_buffer }.substr(0, rec.header.ksz);
 
-			if (crc != rec.header.crc)
+			if (crc != rec.header.crc || rec.header.value_pos + static_cast<off64_t>(rec.header.value_sz) > data_size)
 			{
-				// TODO: do not throw but return a value that tells the caller that the hint file
-				// is corrupted. The caller must then delete this hint file and read the keys from the
-				// datafile instead.
-				throw std::runtime_error{ fmt::format(
-					"{}: CRC mismatch in record at position {}", this->file_->path().string(), position) };
+				return false;
 			}
 
 			callback(rec);
@@ -187,14 +187,16 @@ public:
 		return this->file_->path();
 	}
 
-	void build_keydir(keydir& kd, file_id_type file_id)
+	bool build_keydir(keydir& kd, file_id_type file_id, file_index_type file_index, off64_t data_size)
 	{
-		this->traverse([&](const record& rec) {
+		return this->traverse(data_size, [&](const record& rec) {
 			kd.put(rec.key,
-			       keydir::info{ .file_id   = file_id,
-			                     .value_sz  = rec.header.value_sz,
-			                     .value_pos = rec.header.value_pos,
-			                     .version   = rec.header.version });
+			       keydir::info{ .file_id    = file_id,
+			                     .file_index = file_index,
+			                     .value_sz   = rec.header.value_sz,
+			                     .ksz        = static_cast<ksz_type>(rec.key.size()),
+			                     .value_pos  = rec.header.value_pos,
+			                     .version    = rec.header.version });
 		});
 	}
 
@@ -237,9 +239,9 @@ std::filesystem::path hintfile::path() const
 	return this->pimpl_->path();
 }
 
-void hintfile::build_keydir(keydir& kd, file_id_type file_id) const
+bool hintfile::build_keydir(keydir& kd, file_id_type file_id, file_index_type file_index, off64_t data_size) const
 {
-	return this->pimpl_->build_keydir(kd, file_id);
+	return this->pimpl_->build_keydir(kd, file_id, file_index, data_size);
 }
 
 void hintfile::put(hint&& rec) const
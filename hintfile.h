@@ -32,7 +32,9 @@ public:
 
 	std::filesystem::path path() const;
 
-	void build_keydir(keydir& kd, file_id_type file_id) const;
+	/// Returns false if the hint file is damaged, the keys before the damage have been put in the keydir.
+	/// The hints of a data file of `data_size` bytes do not point beyond it.
+	bool build_keydir(keydir& kd, file_id_type file_id, file_index_type file_index, off64_t data_size) const;
 
 	struct hint final
 	{
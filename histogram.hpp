@@ -0,0 +1,145 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// Distribution of recorded values, for latencies in particular, as in HdrHistogram.
+// Each power of two range is split into 32 linear sub-buckets, so a percentile is reported within 1/32 (about 3%)
+// of the true value, over the whole range of std::uint64_t. Values below 64 are counted exactly.
+// Recording is an index computation and an increment. A histogram is not thread safe: threads record into their own
+// and the histograms are merged for reporting.
+class histogram final
+{
+	static constexpr auto sub_bucket_bits  = 5u;
+	static constexpr auto sub_bucket_count = std::size_t{ 1u } << sub_bucket_bits;
+	static constexpr auto bucket_count     = (64u - sub_bucket_bits + 1u) * sub_bucket_count;
+
+	std::array<std::uint64_t, bucket_count> buckets_;
+	std::uint64_t                           count_;
+	std::uint64_t                           sum_;
+	std::uint64_t                           min_;
+	std::uint64_t                           max_;
+
+	static unsigned shift_of(std::uint64_t value) noexcept
+	{
+		const auto width = static_cast<unsigned>(std::bit_width(value));
+		return width > sub_bucket_bits + 1u ? width - sub_bucket_bits - 1u : 0u;
+	}
+
+	static std::size_t index_of(std::uint64_t value) noexcept
+	{
+		const auto shift = shift_of(value);
+		return shift * sub_bucket_count + static_cast<std::size_t>(value >> shift);
+	}
+
+	// The largest value that is counted in the bucket.
+	static std::uint64_t highest_of(std::size_t index) noexcept
+	{
+		const auto shift = index < 2u * sub_bucket_count ? 0u : static_cast<unsigned>(index / sub_bucket_count - 1u);
+		const auto low   = static_cast<std::uint64_t>(index - shift * sub_bucket_count) << shift;
+		return low + ((std::uint64_t{ 1u } << shift) - 1u);
+	}
+
+public:
+	histogram() noexcept
+	    : buckets_{}
+	    , count_{}
+	    , sum_{}
+	    , min_{ std::numeric_limits<std::uint64_t>::max() }
+	    , max_{}
+	{
+	}
+
+	void record(std::uint64_t value) noexcept
+	{
+		++this->buckets_[index_of(value)];
+		++this->count_;
+		this->sum_ += value;
+		this->min_ = std::min(this->min_, value);
+		this->max_ = std::max(this->max_, value);
+	}
+
+	void merge(const histogram& other) noexcept
+	{
+		for (auto i = std::size_t{}; i < bucket_count; ++i)
+		{
+			this->buckets_[i] += other.buckets_[i];
+		}
+		this->count_ += other.count_;
+		this->sum_ += other.sum_;
+		this->min_ = std::min(this->min_, other.min_);
+		this->max_ = std::max(this->max_, other.max_);
+	}
+
+	void reset() noexcept
+	{
+		*this = histogram{};
+	}
+
+	std::uint64_t count() const noexcept
+	{
+		return this->count_;
+	}
+
+	std::uint64_t sum() const noexcept
+	{
+		return this->sum_;
+	}
+
+	/// Zero if nothing was recorded, as are min, max and the percentiles.
+	double mean() const noexcept
+	{
+		return this->count_ ? static_cast<double>(this->sum_) / static_cast<double>(this->count_) : 0.0;
+	}
+
+	std::uint64_t min() const noexcept
+	{
+		return this->count_ ? this->min_ : 0u;
+	}
+
+	std::uint64_t max() const noexcept
+	{
+		return this->max_;
+	}
+
+	/// The value below which `p` percent of the recorded values are, for `p` in [0, 100].
+	/// Reported as the largest value of its bucket, so that tail latencies are not underestimated.
+	std::uint64_t percentile(double p) const noexcept
+	{
+		if (!this->count_)
+		{
+			return 0u;
+		}
+
+		const auto rank = std::clamp(static_cast<std::uint64_t>(std::ceil(p / 100.0 * static_cast<double>(this->count_))),
+		                             std::uint64_t{ 1u },
+		                             this->count_);
+
+		auto seen = std::uint64_t{};
+		for (auto i = std::size_t{}; i < bucket_count; ++i)
+		{
+			seen += this->buckets_[i];
+			if (seen >= rank)
+			{
+				return std::clamp(highest_of(i), this->min_, this->max_);
+			}
+		}
+		return this->max_;
+	}
+};
+
+} // namespace bitcask
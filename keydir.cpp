@@ -7,45 +7,169 @@
 
 #include "keydir.h"
 #include "locktypes.hpp"
+#include "bloomfilter.hpp"
+#include "epoch.hpp"
+#include "keydir_index.h"
+#include "hash.h"
 
 #include <string>
-#include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <algorithm>
 #include <stdexcept>
 
 namespace bitcask {
 
-class keydir::impl
+namespace {
+
+// Bloom filter over the keys in the keydir, consulted without taking the keydir lock.
+// Writers must hold the keydir write lock.
+// Bits of deleted keys cannot be cleared, so the filter is rebuilt once enough keys have been deleted,
+// and it is rebuilt with twice the capacity when the number of keys outgrows it. A rebuilt filter is
+// published atomically; the old one is retired, and freed when no reader uses it anymore (see epoch.hpp).
+class negative_filter final
 {
-	struct string_hash
+	std::atomic<bloom_filter*> current_;
+	std::size_t                stale_;
+
+	template<typename Traverse>
+	void rebuild(std::size_t capacity, Traverse&& traverse)
+	{
+		auto filter = std::make_unique<bloom_filter>(capacity);
+		traverse([&](std::uint64_t h) { filter->insert(h); });
+		const auto old = this->current_.exchange(filter.release(), std::memory_order_acq_rel);
+		epoch_domain::instance().retire(old, epoch_domain::collect_threshold); // a whole filter
+		this->stale_ = 0u;
+	}
+
+public:
+	negative_filter()
+	    : current_{ new bloom_filter{ 0u } }
+	    , stale_{}
+	{
+	}
+
+	~negative_filter() noexcept
+	{
+		delete this->current_.load(std::memory_order_relaxed);
+	}
+
+	negative_filter(const negative_filter&)            = delete;
+	negative_filter& operator=(const negative_filter&) = delete;
+
+	bool may_contain(std::uint64_t hash) const
 	{
-		using is_transparent = void;
+		const auto guard = epoch_domain::instance().pin();
+		(void)(guard);
 
-		std::size_t operator()(const std::string& v) const
+		return this->current_.load(std::memory_order_acquire)->may_contain(hash);
+	}
+
+	template<typename Traverse>
+	void inserted(std::uint64_t hash, std::size_t key_count, Traverse&& traverse)
+	{
+		const auto current = this->current_.load(std::memory_order_relaxed);
+		if (key_count > current->capacity())
 		{
-			return std::hash<std::string>{}(v);
+			this->rebuild(2u * key_count, traverse);
 		}
-
-		std::size_t operator()(const std::string_view& v) const
+		else
 		{
-			return std::hash<std::string_view>{}(v);
+			current->insert(hash);
 		}
+	}
 
-		std::size_t operator()(const char* v) const
+	template<typename Traverse>
+	void deleted(Traverse&& traverse)
+	{
+		const auto capacity = this->current_.load(std::memory_order_relaxed)->capacity();
+		if (++this->stale_ > capacity / 2u)
 		{
-			return std::hash<std::string_view>{}(v);
+			this->rebuild(capacity, traverse);
 		}
-	};
+	}
+
+	template<typename Traverse>
+	void reset(std::size_t key_count, Traverse&& traverse)
+	{
+		this->rebuild(2u * key_count, traverse);
+	}
+
+	std::size_t memory_usage() const
+	{
+		return this->current_.load(std::memory_order_relaxed)->memory_usage();
+	}
+};
+
+} // namespace
+
+class keydir::impl
+{
+	std::unique_ptr<keydir_index>    index_;
+	bool                             concurrent_reads_;
+	version_type                     version_;
+	std::unique_ptr<negative_filter> filter_;
+	mutable shared_locker            locker_;
+
+	static std::uint64_t filter_hash(std::uint64_t hash)
+	{
+		// Re-mix, so that the filter bits do not correlate with the table slots.
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		return hash;
+	}
 
-	std::unordered_map<key_type, keydir_info, string_hash, std::equal_to<>> map_;
-	version_type                                                            version_;
-	mutable shared_locker                                                   locker_;
+	auto filter_traverser() const
+	{
+		return [this](auto&& insert) {
+			this->index_->traverse_hashes([&](std::uint64_t hash) { insert(filter_hash(hash)); });
+		};
+	}
+
+	bool may_contain(std::uint64_t hash) const
+	{
+		return !this->filter_ || this->filter_->may_contain(filter_hash(hash));
+	}
 
 public:
-	impl() noexcept
-	    : map_{}
-	    , version_{}
-	    , locker_{}
+	explicit impl(const options& opts, const keydir_context& context)
+	    : index_{ make_keydir_index(opts, context) }
+	    , concurrent_reads_{ this->index_->concurrent_reads() }
+	    , version_{ this->index_->restored_version().value_or(version_type{}) }
+	    , filter_{ opts.negative_lookup_filter ? std::make_unique<negative_filter>() : nullptr }
+	    , locker_{ "keydir" }
+	{
+		if (this->filter_ && this->restored())
+		{
+			this->filter_->reset(this->index_->size(), this->filter_traverser());
+		}
+	}
+
+	bool restored() const
 	{
+		return this->index_->restored_version().has_value();
+	}
+
+	void persist(std::uint64_t fingerprint)
+	{
+		const auto lock = this->locker_.write_lock();
+		(void)(lock);
+
+		this->index_->persist(fingerprint, this->version_);
+	}
+
+	void reindex_files(const std::function<file_index_type(file_id_type)>& index_of)
+	{
+		const auto lock = this->locker_.write_lock();
+		(void)(lock);
+
+		this->index_->reindex_files(index_of);
+	}
+
+	bool may_contain(const std::string_view& key) const
+	{
+		return !this->filter_ || this->may_contain(hash_key(key));
 	}
 
 	version_type next_version()
@@ -58,34 +182,60 @@ public:
 
 	std::optional<keydir::info> get(const std::string_view& key) const
 	{
+		const auto hash = hash_key(key);
+		if (!this->may_contain(hash))
+		{
+			return std::nullopt;
+		}
+
+		if (this->concurrent_reads_)
+		{
+			return this->index_->lookup(key, hash);
+		}
+
 		const auto lock = this->locker_.read_lock();
 		(void)(lock);
 
-		const auto it = this->map_.find(key);
-		if (it == this->map_.end())
+		return this->index_->lookup(key, hash);
+	}
+
+	std::optional<keydir::info> get_unchecked(const std::string_view& key) const
+	{
+		const auto hash = hash_key(key);
+		if (!this->may_contain(hash))
 		{
 			return std::nullopt;
 		}
+
+		const auto lock = this->locker_.read_lock();
+		(void)(lock);
+
+		const auto info = this->index_->find_unchecked(key, hash);
+		if (info)
+		{
+			return *info;
+		}
 		else
 		{
-			return it->second;
+			return std::nullopt;
 		}
 	}
 
-	std::optional<std::pair<keydir::info*, write_lock_type>> get_mutable(const std::string_view& key)
+	bool replace(const std::string_view& key, version_type version, keydir::info&& info)
 	{
-		auto lock = this->locker_.write_lock();
+		const auto hash = hash_key(key);
+
+		const auto lock = this->locker_.write_lock();
 		(void)(lock);
 
-		const auto it = this->map_.find(key);
-		if (it == this->map_.end())
-		{
-			return std::nullopt;
-		}
-		else
+		const auto current = this->index_->find(key, hash);
+		if (!current || current->version != version)
 		{
-			return std::make_pair(&it->second, std::move(lock));
+			return false;
 		}
+
+		this->index_->insert_or_assign(key, hash, std::move(info));
+		return true;
 	}
 
 	bool empty() const
@@ -93,11 +243,26 @@ public:
 		const auto lock = this->locker_.read_lock();
 		(void)(lock);
 
-		return this->map_.empty();
+		return this->index_->size() == 0u;
+	}
+
+	keydir_stats statistics() const
+	{
+		const auto lock = this->locker_.read_lock();
+		(void)(lock);
+
+		auto st = this->index_->statistics();
+		if (this->filter_)
+		{
+			st.memory_usage += this->filter_->memory_usage();
+		}
+		return st;
 	}
 
 	bool put(const std::string_view& key, keydir::info&& info)
 	{
+		const auto hash = hash_key(key);
+
 		const auto lock = this->locker_.write_lock();
 		(void)(lock);
 
@@ -106,23 +271,36 @@ public:
 			this->version_ = info.version;
 		}
 
-		return this->map_.insert_or_assign(std::string{ key }, std::move(info)).second;
+		const auto inserted = this->index_->insert_or_assign(key, hash, std::move(info));
+		if (inserted && this->filter_)
+		{
+			this->filter_->inserted(filter_hash(hash), this->index_->size(), this->filter_traverser());
+		}
+		return inserted;
 	}
 
 	bool del(const std::string_view& key)
 	{
+		const auto hash = hash_key(key);
+		if (!this->may_contain(hash))
+		{
+			return false;
+		}
+
 		const auto lock = this->locker_.write_lock();
 		(void)(lock);
 
-		const auto it = this->map_.find(key);
-		if (it == this->map_.end())
+		if (this->index_->erase(key, hash))
 		{
-			return false;
+			if (this->filter_)
+			{
+				this->filter_->deleted(this->filter_traverser());
+			}
+			return true;
 		}
 		else
 		{
-			this->map_.erase(it);
-			return true;
+			return false;
 		}
 	}
 
@@ -131,19 +309,22 @@ public:
 		const auto lock = this->locker_.read_lock();
 		(void)(lock);
 
-		for (const auto& pair : this->map_)
-		{
-			if (!callback(pair.first, pair.second))
-			{
-				return false;
-			}
-		}
-		return true;
+		return this->index_->traverse([&](const auto& key, std::uint64_t, const auto& info) { return callback(key, info); });
+	}
+
+	bool scan(const std::string_view&                                            begin,
+	          const std::string_view&                                            end,
+	          std::function<bool(const std::string_view& key, const info& info)> callback)
+	{
+		const auto lock = this->locker_.read_lock();
+		(void)(lock);
+
+		return this->index_->scan(begin, end, [&](const auto& key, std::uint64_t, const auto& info) { return callback(key, info); });
 	}
 };
 
-keydir::keydir() noexcept
-    : pimpl_{ std::make_unique<impl>() }
+keydir::keydir(const options& opts, const keydir_context& context)
+    : pimpl_{ std::make_unique<impl>(opts, context) }
 {
 }
 
@@ -151,19 +332,44 @@ keydir::~keydir() noexcept
 {
 }
 
+bool keydir::restored() const
+{
+	return this->pimpl_->restored();
+}
+
+void keydir::persist(std::uint64_t fingerprint)
+{
+	return this->pimpl_->persist(fingerprint);
+}
+
+void keydir::reindex_files(const std::function<file_index_type(file_id_type)>& index_of)
+{
+	return this->pimpl_->reindex_files(index_of);
+}
+
 version_type keydir::next_version()
 {
 	return this->pimpl_->next_version();
 }
 
+bool keydir::may_contain(const std::string_view& key) const
+{
+	return this->pimpl_->may_contain(key);
+}
+
 std::optional<keydir::info> keydir::get(const std::string_view& key) const
 {
 	return this->pimpl_->get(key);
 }
 
-std::optional<std::pair<keydir::info*, write_lock_type>> keydir::get_mutable(const std::string_view& key)
+std::optional<keydir::info> keydir::get_unchecked(const std::string_view& key) const
 {
-	return this->pimpl_->get_mutable(key);
+	return this->pimpl_->get_unchecked(key);
+}
+
+bool keydir::replace(const std::string_view& key, version_type version, info&& info)
+{
+	return this->pimpl_->replace(key, version, std::move(info));
 }
 
 bool keydir::empty() const
@@ -171,6 +377,11 @@ bool keydir::empty() const
 	return this->pimpl_->empty();
 }
 
+keydir_stats keydir::statistics() const
+{
+	return this->pimpl_->statistics();
+}
+
 bool keydir::put(const std::string_view& key, info&& info)
 {
 	return this->pimpl_->put(key, std::move(info));
@@ -186,4 +397,11 @@ bool keydir::traverse(std::function<bool(const std::string_view&, const info&)>
 	return this->pimpl_->traverse(callback);
 }
 
+bool keydir::scan(const std::string_view&                                   begin,
+                  const std::string_view&                                   end,
+                  std::function<bool(const std::string_view&, const info&)> callback)
+{
+	return this->pimpl_->scan(begin, end, callback);
+}
+
 } // namespace bitcask
@@ -8,6 +8,7 @@
 #pragma once
 
 #include "basictypes.h"
+#include "options.h"
 #include "locktypes.hpp"
 
 #include <memory>
@@ -17,15 +18,38 @@
 #include <shared_mutex>
 #include <utility>
 #include <functional>
+#include <filesystem>
+#include <cstdint>
 
 namespace bitcask {
 
 struct keydir_info final
 {
-	file_id_type   file_id;
-	value_sz_type  value_sz;
-	value_pos_type value_pos;
-	version_type   version;
+	file_id_type    file_id;
+	file_index_type file_index; // a hint only, the file is looked up by file_id if the index does not match
+	value_sz_type   value_sz;
+	ksz_type        ksz; // the key is stored right before the value, at value_pos - ksz
+	value_pos_type  value_pos;
+	version_type    version;
+};
+
+/// Reads the key of an entry from the data file. Required by keydir_mode::hash_only.
+using key_reader = std::function<key_type(const keydir_info& info)>;
+
+/// What the keydir needs to know about the store it belongs to.
+struct keydir_context final
+{
+	std::filesystem::path directory{};   // keydir_mode::mapped keeps its file here
+	std::uint64_t         fingerprint{}; // of the data files, see datadir::fingerprint; used by keydir_mode::mapped
+	key_reader            read_key{};    // required by keydir_mode::hash_only
+};
+
+struct keydir_stats final
+{
+	std::size_t keys;
+	std::size_t key_bytes;        // total length of all keys
+	std::size_t stored_key_bytes; // bytes used to store the keys, less than key_bytes if keys are prefix compressed
+	std::size_t memory_usage;     // estimated total, including the negative lookup filter
 };
 
 class keydir final
@@ -36,23 +60,53 @@ class keydir final
 public:
 	using info = keydir_info;
 
-	keydir() noexcept;
+	explicit keydir(const options& opts, const keydir_context& context = keydir_context{});
 	~keydir() noexcept;
 
+	/// True if the keydir was restored from disk (keydir_mode::mapped) and need not be built from the data files.
+	bool restored() const;
+
+	/// Saves a persistent keydir (keydir_mode::mapped). `fingerprint` identifies the data files it describes.
+	void persist(std::uint64_t fingerprint);
+
+	/// Sets the file_index of every entry from its file_id. A restored keydir holds the file indexes of the previous
+	/// open, and the files are numbered again on every open.
+	void reindex_files(const std::function<file_index_type(file_id_type)>& index_of);
+
 	version_type next_version();
 
-	std::optional<info>                              get(const std::string_view& key) const;
-	std::optional<std::pair<info*, write_lock_type>> get_mutable(const std::string_view& key);
+	/// Returns false if the key is certainly not in the keydir. Does not lock.
+	/// Always returns true if the negative lookup filter is disabled.
+	bool may_contain(const std::string_view& key) const;
+
+	/// Takes no lock with keydir_mode::concurrent.
+	std::optional<info> get(const std::string_view& key) const;
+
+	/// Like get, but with keydir_mode::hash_only, when only one entry has the hash of the key, that entry is returned
+	/// without reading its key from disk. The caller must then check the key of the record.
+	std::optional<info> get_unchecked(const std::string_view& key) const;
 
 	bool empty() const;
 
+	keydir_stats statistics() const;
+
 	/// Returns true if the key was inserted, false if the key existed.
 	bool put(const std::string_view& key, info&& info);
 
 	/// Returns true if the key was deleted, false if the key did not exist.
 	bool del(const std::string_view& key);
 
+	/// Replaces the entry of the key, but only if its version is still `version`.
+	/// Returns false if the key was written or deleted since.
+	bool replace(const std::string_view& key, version_type version, info&& info);
+
 	bool traverse(std::function<bool(const std::string_view& key, const info& info)> callback);
+
+	/// Visits the keys in [begin, end) in key order. An empty `end` means no upper bound.
+	/// Requires keydir_mode::ordered or keydir_mode::compact.
+	bool scan(const std::string_view&                                            begin,
+	          const std::string_view&                                            end,
+	          std::function<bool(const std::string_view& key, const info& info)> callback);
 };
 
 } // namespace bitcask
@@ -0,0 +1,482 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "keydir_index.h"
+#include "mapped_index.h"
+#include "swisstable.hpp"
+#include "concurrenttable.hpp"
+#include "radixtree.hpp"
+#include "hash.h"
+
+#include <map>
+#include <utility>
+#include <stdexcept>
+
+namespace bitcask {
+
+namespace {
+
+// Heap memory used by a std::string holding a key of this size: none if it fits in the small string buffer.
+std::size_t key_heap_usage(std::size_t size)
+{
+	constexpr auto sso_capacity = std::string{}.capacity();
+	return size > sso_capacity ? size + 1u + 16u : 0u;
+}
+
+class hashed_index final : public keydir_index
+{
+	swiss_table<keydir_info> table_;
+	std::size_t              key_bytes_;
+	std::size_t              key_heap_bytes_;
+
+public:
+	hashed_index()
+	    : table_{}
+	    , key_bytes_{}
+	    , key_heap_bytes_{}
+	{
+	}
+
+	std::size_t size() const override
+	{
+		return this->table_.size();
+	}
+
+	keydir_stats statistics() const override
+	{
+		return keydir_stats{ .keys             = this->table_.size(),
+			                 .key_bytes        = this->key_bytes_,
+			                 .stored_key_bytes = this->key_bytes_,
+			                 .memory_usage     = this->table_.memory_usage() + this->key_heap_bytes_ };
+	}
+
+	const keydir_info* find(const std::string_view& key, std::uint64_t hash) const override
+	{
+		const auto slot = this->table_.find(key, hash);
+		return slot ? &slot->value : nullptr;
+	}
+
+	bool insert_or_assign(const std::string_view& key, std::uint64_t hash, keydir_info&& info) override
+	{
+		const auto inserted = this->table_.insert_or_assign(key, hash, std::move(info));
+		if (inserted)
+		{
+			this->key_bytes_ += key.size();
+			this->key_heap_bytes_ += key_heap_usage(key.size());
+		}
+		return inserted;
+	}
+
+	bool erase(const std::string_view& key, std::uint64_t hash) override
+	{
+		const auto erased = this->table_.erase(key, hash);
+		if (erased)
+		{
+			this->key_bytes_ -= key.size();
+			this->key_heap_bytes_ -= key_heap_usage(key.size());
+		}
+		return erased;
+	}
+
+	bool traverse(const callback& cb) const override
+	{
+		return this->table_.traverse([&](const auto& slot) { return cb(slot.key, slot.hash, slot.value); });
+	}
+
+	bool ordered() const override
+	{
+		return false;
+	}
+
+	bool scan(const std::string_view&, const std::string_view&, const callback&) const override
+	{
+		throw std::runtime_error{ "Range scans require an ordered keydir (keydir_mode::ordered or keydir_mode::compact)" };
+	}
+};
+
+// Chained hash table whose lookups take no lock (see concurrenttable.hpp).
+class concurrent_index final : public keydir_index
+{
+	concurrent_hash_table<keydir_info> table_;
+
+public:
+	concurrent_index()
+	    : table_{}
+	{
+	}
+
+	std::size_t size() const override
+	{
+		return this->table_.size();
+	}
+
+	keydir_stats statistics() const override
+	{
+		return keydir_stats{ .keys             = this->table_.size(),
+			                 .key_bytes        = this->table_.key_bytes(),
+			                 .stored_key_bytes = this->table_.key_bytes(),
+			                 .memory_usage     = this->table_.memory_usage() };
+	}
+
+	const keydir_info* find(const std::string_view& key, std::uint64_t hash) const override
+	{
+		return this->table_.find_locked(key, hash);
+	}
+
+	std::optional<keydir_info> lookup(const std::string_view& key, std::uint64_t hash) const override
+	{
+		return this->table_.find(key, hash);
+	}
+
+	bool concurrent_reads() const override
+	{
+		return true;
+	}
+
+	bool insert_or_assign(const std::string_view& key, std::uint64_t hash, keydir_info&& info) override
+	{
+		return this->table_.insert_or_assign(key, hash, info);
+	}
+
+	bool erase(const std::string_view& key, std::uint64_t hash) override
+	{
+		return this->table_.erase(key, hash);
+	}
+
+	bool traverse(const callback& cb) const override
+	{
+		return this->table_.traverse(cb);
+	}
+
+	bool ordered() const override
+	{
+		return false;
+	}
+
+	bool scan(const std::string_view&, const std::string_view&, const callback&) const override
+	{
+		throw std::runtime_error{ "Range scans require an ordered keydir (keydir_mode::ordered or keydir_mode::compact)" };
+	}
+};
+
+// Balanced search tree. Lookups are O(log n), but keys can be visited in order and ranges located directly.
+class ordered_index final : public keydir_index
+{
+	using map_type = std::map<key_type, keydir_info, std::less<>>;
+
+	map_type    map_;
+	std::size_t key_bytes_;
+	std::size_t key_heap_bytes_;
+
+public:
+	ordered_index()
+	    : map_{}
+	    , key_bytes_{}
+	    , key_heap_bytes_{}
+	{
+	}
+
+	std::size_t size() const override
+	{
+		return this->map_.size();
+	}
+
+	keydir_stats statistics() const override
+	{
+		// tree node: 3 pointers and a color, plus an estimated allocator overhead
+		constexpr auto node_size = 4u * sizeof(void*) + sizeof(map_type::value_type) + 16u;
+		return keydir_stats{ .keys             = this->map_.size(),
+			                 .key_bytes        = this->key_bytes_,
+			                 .stored_key_bytes = this->key_bytes_,
+			                 .memory_usage     = this->map_.size() * node_size + this->key_heap_bytes_ };
+	}
+
+	const keydir_info* find(const std::string_view& key, std::uint64_t) const override
+	{
+		const auto it = this->map_.find(key);
+		return it == this->map_.end() ? nullptr : &it->second;
+	}
+
+	bool insert_or_assign(const std::string_view& key, std::uint64_t, keydir_info&& info) override
+	{
+		const auto it = this->map_.lower_bound(key);
+		if (it != this->map_.end() && it->first == key)
+		{
+			it->second = std::move(info);
+			return false;
+		}
+		else
+		{
+			this->map_.emplace_hint(it, key_type{ key }, std::move(info));
+			this->key_bytes_ += key.size();
+			this->key_heap_bytes_ += key_heap_usage(key.size());
+			return true;
+		}
+	}
+
+	bool erase(const std::string_view& key, std::uint64_t) override
+	{
+		const auto it = this->map_.find(key);
+		if (it == this->map_.end())
+		{
+			return false;
+		}
+		else
+		{
+			this->map_.erase(it);
+			this->key_bytes_ -= key.size();
+			this->key_heap_bytes_ -= key_heap_usage(key.size());
+			return true;
+		}
+	}
+
+	bool traverse(const callback& cb) const override
+	{
+		return this->scan(std::string_view{}, std::string_view{}, cb);
+	}
+
+	bool ordered() const override
+	{
+		return true;
+	}
+
+	bool scan(const std::string_view& begin, const std::string_view& end, const callback& cb) const override
+	{
+		for (auto it = this->map_.lower_bound(begin); it != this->map_.end(); ++it)
+		{
+			if (!end.empty() && it->first >= end)
+			{
+				break;
+			}
+			if (!cb(it->first, hash_key(it->first), it->second))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// Radix tree: keys that share a prefix store it only once. Ordered, like ordered_index.
+class compact_index final : public keydir_index
+{
+	radix_tree<keydir_info> tree_;
+
+public:
+	compact_index()
+	    : tree_{}
+	{
+	}
+
+	std::size_t size() const override
+	{
+		return this->tree_.size();
+	}
+
+	keydir_stats statistics() const override
+	{
+		return keydir_stats{ .keys             = this->tree_.size(),
+			                 .key_bytes        = this->tree_.key_bytes(),
+			                 .stored_key_bytes = this->tree_.label_bytes(),
+			                 .memory_usage     = this->tree_.memory_usage() };
+	}
+
+	const keydir_info* find(const std::string_view& key, std::uint64_t) const override
+	{
+		return this->tree_.find(key);
+	}
+
+	bool insert_or_assign(const std::string_view& key, std::uint64_t, keydir_info&& info) override
+	{
+		return this->tree_.insert_or_assign(key, std::move(info));
+	}
+
+	bool erase(const std::string_view& key, std::uint64_t) override
+	{
+		return this->tree_.erase(key);
+	}
+
+	bool traverse(const callback& cb) const override
+	{
+		return this->scan(std::string_view{}, std::string_view{}, cb);
+	}
+
+	bool ordered() const override
+	{
+		return true;
+	}
+
+	bool scan(const std::string_view& begin, const std::string_view& end, const callback& cb) const override
+	{
+		return this->tree_.scan(begin, end, [&](const auto& key, const auto& info) { return cb(key, hash_key(key), info); });
+	}
+};
+
+// Stores the hash of every key, but not the key itself: the key is in the data file, right before the value.
+// Keys with the same hash get separate slots in the same probe sequence, and are told apart by reading their
+// keys back from disk. Lookups that need an exact match therefore read one key per entry with the same hash.
+// A slot holds the 8 byte hash and the 40 byte keydir_info, 48 bytes, next to its control byte.
+class hash_only_index final : public keydir_index
+{
+	struct no_key final
+	{
+	};
+
+	using table_type = swiss_table<keydir_info, no_key>;
+
+	table_type  table_;
+	key_reader  read_key_;
+	std::size_t key_bytes_;
+
+	const table_type::slot* find_slot(const std::string_view& key, std::uint64_t hash) const
+	{
+		return this->table_.find_if(hash,
+		                            [&](const auto& slot) { return slot.value.ksz == key.size() && this->read_key_(slot.value) == key; });
+	}
+
+	table_type::slot* find_slot(const std::string_view& key, std::uint64_t hash)
+	{
+		return const_cast<table_type::slot*>(std::as_const(*this).find_slot(key, hash));
+	}
+
+public:
+	explicit hash_only_index(key_reader reader)
+	    : table_{}
+	    , read_key_{ std::move(reader) }
+	    , key_bytes_{}
+	{
+	}
+
+	std::size_t size() const override
+	{
+		return this->table_.size();
+	}
+
+	keydir_stats statistics() const override
+	{
+		return keydir_stats{ .keys             = this->table_.size(),
+			                 .key_bytes        = this->key_bytes_,
+			                 .stored_key_bytes = 0u,
+			                 .memory_usage     = this->table_.memory_usage() };
+	}
+
+	const keydir_info* find(const std::string_view& key, std::uint64_t hash) const override
+	{
+		const auto slot = this->find_slot(key, hash);
+		return slot ? &slot->value : nullptr;
+	}
+
+	const keydir_info* find_unchecked(const std::string_view& key, std::uint64_t hash) const override
+	{
+		auto first     = static_cast<const table_type::slot*>(nullptr);
+		auto collision = false;
+		this->table_.find_if(hash, [&](const auto& slot) {
+			if (first)
+			{
+				collision = true;
+				return true;
+			}
+			first = &slot;
+			return false;
+		});
+
+		if (collision)
+		{
+			return this->find(key, hash);
+		}
+		else
+		{
+			return first && first->value.ksz == key.size() ? &first->value : nullptr;
+		}
+	}
+
+	bool insert_or_assign(const std::string_view& key, std::uint64_t hash, keydir_info&& info) override
+	{
+		const auto slot = this->find_slot(key, hash);
+		if (slot)
+		{
+			slot->value = std::move(info);
+			return false;
+		}
+		else
+		{
+			this->table_.insert(hash, no_key{}, std::move(info));
+			this->key_bytes_ += key.size();
+			return true;
+		}
+	}
+
+	bool erase(const std::string_view& key, std::uint64_t hash) override
+	{
+		const auto slot = this->find_slot(key, hash);
+		if (slot)
+		{
+			this->table_.erase(slot);
+			this->key_bytes_ -= key.size();
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	bool traverse(const callback& cb) const override
+	{
+		return this->table_.traverse([&](const auto& slot) { return cb(this->read_key_(slot.value), slot.hash, slot.value); });
+	}
+
+	void traverse_hashes(const std::function<void(std::uint64_t hash)>& fn) const override
+	{
+		this->table_.traverse([&](const auto& slot) {
+			fn(slot.hash);
+			return true;
+		});
+	}
+
+	bool ordered() const override
+	{
+		return false;
+	}
+
+	bool scan(const std::string_view&, const std::string_view&, const callback&) const override
+	{
+		throw std::runtime_error{ "Range scans require an ordered keydir (keydir_mode::ordered or keydir_mode::compact)" };
+	}
+};
+
+} // namespace
+
+std::unique_ptr<keydir_index> make_keydir_index(const options& opts, const keydir_context& context)
+{
+	switch (opts.keydir)
+	{
+	case keydir_mode::hashed:
+		return std::make_unique<hashed_index>();
+	case keydir_mode::concurrent:
+		return std::make_unique<concurrent_index>();
+	case keydir_mode::ordered:
+		return std::make_unique<ordered_index>();
+	case keydir_mode::compact:
+		return std::make_unique<compact_index>();
+	case keydir_mode::hash_only:
+		if (!context.read_key)
+		{
+			throw std::invalid_argument{ "keydir_mode::hash_only requires a key reader" };
+		}
+		return std::make_unique<hash_only_index>(context.read_key);
+	case keydir_mode::mapped:
+		if (context.directory.empty())
+		{
+			throw std::invalid_argument{ "keydir_mode::mapped requires a directory" };
+		}
+		return make_mapped_index(mapped_index_path(context.directory), context.fingerprint);
+	}
+	throw std::invalid_argument{ "Unknown keydir mode" };
+}
+
+} // namespace bitcask
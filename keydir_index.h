@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "keydir.h"
+#include "options.h"
+
+#include <memory>
+#include <string_view>
+#include <functional>
+#include <optional>
+#include <cstdint>
+
+namespace bitcask {
+
+// The container behind the keydir, selected with options::keydir_mode.
+// Implementations are not thread safe, the keydir does the locking, except for lookup if concurrent_reads() is true.
+// All methods that take a key also take its hash (see hash.h), so that it is computed only once.
+class keydir_index
+{
+public:
+	using callback = std::function<bool(const std::string_view& key, std::uint64_t hash, const keydir_info& info)>;
+
+	virtual ~keydir_index() = default;
+
+	virtual std::size_t size() const = 0;
+
+	/// Key bytes and memory usage of the index. Only `keys`, `key_bytes`, `stored_key_bytes` and `memory_usage` are set.
+	virtual keydir_stats statistics() const = 0;
+
+	/// The pointer is valid until the index is modified.
+	virtual const keydir_info* find(const std::string_view& key, std::uint64_t hash) const = 0;
+
+	/// Copies the entry of the key. Without concurrent_reads(), the caller must exclude writers.
+	virtual std::optional<keydir_info> lookup(const std::string_view& key, std::uint64_t hash) const
+	{
+		const auto info = this->find(key, hash);
+		return info ? std::make_optional(*info) : std::nullopt;
+	}
+
+	/// True if lookup may run without the keydir lock, concurrently with a writer.
+	virtual bool concurrent_reads() const
+	{
+		return false;
+	}
+
+	/// Like find, but an index that does not store keys may return an entry of another key with the same hash,
+	/// if that is the only entry with this hash. The caller must then check the key.
+	virtual const keydir_info* find_unchecked(const std::string_view& key, std::uint64_t hash) const
+	{
+		return this->find(key, hash);
+	}
+
+	/// Returns true if the key was inserted, false if the key existed.
+	virtual bool insert_or_assign(const std::string_view& key, std::uint64_t hash, keydir_info&& info) = 0;
+
+	/// Returns true if the key was erased, false if the key did not exist.
+	virtual bool erase(const std::string_view& key, std::uint64_t hash) = 0;
+
+	/// Visits all keys, in key order if the index is ordered.
+	/// Stops and returns false as soon as the callback returns false.
+	virtual bool traverse(const callback& cb) const = 0;
+
+	/// Visits the hashes of all keys. Cheaper than traverse if the index does not store keys.
+	virtual void traverse_hashes(const std::function<void(std::uint64_t hash)>& fn) const
+	{
+		this->traverse([&](const auto&, std::uint64_t hash, const auto&) {
+			fn(hash);
+			return true;
+		});
+	}
+
+	virtual bool ordered() const = 0;
+
+	/// Visits the keys in [begin, end) in key order. An empty `end` means no upper bound.
+	/// Throws if the index is not ordered.
+	virtual bool scan(const std::string_view& begin, const std::string_view& end, const callback& cb) const = 0;
+
+	/// The highest version in the data files, if the index was restored from disk instead of starting empty.
+	virtual std::optional<version_type> restored_version() const
+	{
+		return std::nullopt;
+	}
+
+	/// Saves the index, so that it can be restored when the store is opened again with the same data files.
+	/// Does nothing if the index is not persistent.
+	virtual void persist(std::uint64_t, version_type)
+	{
+	}
+
+	/// Sets the file_index of every entry from its file_id, after the index was restored from disk.
+	/// Does nothing if the index is not persistent: its entries are never older than the open.
+	virtual void reindex_files(const std::function<file_index_type(file_id_type)>&)
+	{
+	}
+};
+
+std::unique_ptr<keydir_index> make_keydir_index(const options& opts, const keydir_context& context);
+
+} // namespace bitcask
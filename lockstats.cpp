@@ -0,0 +1,164 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "lockstats.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+
+namespace bitcask {
+
+#if defined(BITCASK_LOCK_STATS) && defined(BITCASK_THREAD_SAFE)
+
+namespace {
+
+class lock_registry final
+{
+	std::mutex                                                     mutex_{};
+	std::map<std::string, std::unique_ptr<lock_profile>, std::less<>> profiles_{};
+
+	lock_registry() = default;
+
+public:
+	static lock_registry& instance()
+	{
+		static auto registry = lock_registry{};
+		return registry;
+	}
+
+	lock_profile& find(std::string_view name)
+	{
+		const auto lock = std::lock_guard<std::mutex>{ this->mutex_ };
+
+		auto it = this->profiles_.find(name);
+		if (it == this->profiles_.end())
+		{
+			it = this->profiles_.emplace(std::string{ name }, std::make_unique<lock_profile>(name)).first;
+		}
+		return *it->second;
+	}
+
+	template<typename Fn>
+	void for_each(Fn&& fn)
+	{
+		const auto lock = std::lock_guard<std::mutex>{ this->mutex_ };
+		for (auto& [name, profile] : this->profiles_)
+		{
+			fn(*profile);
+		}
+	}
+};
+
+} // namespace
+
+lock_profile::lock_profile(std::string_view name)
+    : name_{ name }
+    , stripes_{}
+{
+}
+
+lock_profile& lock_profile::find(std::string_view name)
+{
+	return lock_registry::instance().find(name);
+}
+
+lock_stats lock_profile::statistics() const
+{
+	auto result = lock_stats{ .name = this->name_, .acquisitions = 0u, .contended = 0u, .wait = {}, .hold = {} };
+	for (auto& s : this->stripes_)
+	{
+		const auto lock = std::lock_guard<std::mutex>{ s.mutex };
+		result.acquisitions += s.acquisitions;
+		result.contended += s.contended;
+		result.wait.merge(s.wait);
+		result.hold.merge(s.hold);
+	}
+	return result;
+}
+
+void lock_profile::reset()
+{
+	for (auto& s : this->stripes_)
+	{
+		const auto lock = std::lock_guard<std::mutex>{ s.mutex };
+		s.acquisitions  = 0u;
+		s.contended     = 0u;
+		s.wait.reset();
+		s.hold.reset();
+	}
+}
+
+std::vector<lock_stats> lock_statistics()
+{
+	auto result = std::vector<lock_stats>{};
+	lock_registry::instance().for_each([&](const lock_profile& profile) {
+		auto stats = profile.statistics();
+		if (stats.acquisitions)
+		{
+			result.push_back(std::move(stats));
+		}
+	});
+
+	std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) { return a.wait.sum() > b.wait.sum(); });
+	return result;
+}
+
+void reset_lock_statistics()
+{
+	lock_registry::instance().for_each([](lock_profile& profile) { profile.reset(); });
+}
+
+#else
+
+std::vector<lock_stats> lock_statistics()
+{
+	return {};
+}
+
+void reset_lock_statistics()
+{
+}
+
+#endif
+
+std::string format_lock_statistics(const std::vector<lock_stats>& stats)
+{
+	auto text = fmt::format("{:<32} {:>12} {:>9} {:>12} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+	                        "lock",
+	                        "acquisitions",
+	                        "contended",
+	                        "wait total",
+	                        "wait p50",
+	                        "wait p99",
+	                        "wait max",
+	                        "hold p50",
+	                        "hold p99",
+	                        "hold max");
+
+	for (const auto& s : stats)
+	{
+		fmt::format_to(std::back_inserter(text),
+		               "{:<32} {:>12} {:>8.2f}% {:>10.3f}ms {:>8}ns {:>8}ns {:>8}ns {:>8}ns {:>8}ns {:>8}ns\n",
+		               s.name,
+		               s.acquisitions,
+		               s.acquisitions ? 100.0 * static_cast<double>(s.contended) / static_cast<double>(s.acquisitions) : 0.0,
+		               static_cast<double>(s.wait.sum()) / 1e6,
+		               s.wait.percentile(50.0),
+		               s.wait.percentile(99.0),
+		               s.wait.max(),
+		               s.hold.percentile(50.0),
+		               s.hold.percentile(99.0),
+		               s.hold.max());
+	}
+	return text;
+}
+
+} // namespace bitcask
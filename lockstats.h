@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "histogram.hpp"
+#include "config.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#if defined(BITCASK_LOCK_STATS) && defined(BITCASK_THREAD_SAFE)
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#endif
+
+namespace bitcask {
+
+/// Contention of the locks with one name, summed over all instances (e.g. the locks of all data files)
+/// and all stores in the process. Shared and exclusive acquisitions of a shared lock are reported separately.
+struct lock_stats final
+{
+	std::string   name;
+	std::uint64_t acquisitions;
+	std::uint64_t contended; // acquisitions that found the lock taken and had to wait
+	histogram     wait;      // nanoseconds from the request to the acquisition, zero if not contended
+	histogram     hold;      // nanoseconds from the acquisition to the release
+};
+
+/// The locks that have been used, the longest total wait first.
+/// Empty unless built with BITCASK_LOCK_STATS and BITCASK_THREAD_SAFE.
+std::vector<lock_stats> lock_statistics();
+
+/// Starts counting from zero again, e.g. after the warm-up of a benchmark.
+void reset_lock_statistics();
+
+/// A table with a line per lock: acquisitions, contention, and wait and hold time percentiles.
+std::string format_lock_statistics(const std::vector<lock_stats>& stats);
+
+#if defined(BITCASK_LOCK_STATS) && defined(BITCASK_THREAD_SAFE)
+
+// The statistics of the locks with one name, recorded by the lock types of locktypes.hpp.
+// A lock guards its own data, but the locks with one name share a profile, which is therefore split into stripes
+// with a mutex each, so that threads rarely wait for each other to record. The mutexes are plain std::mutex,
+// not instrumented themselves.
+class lock_profile final
+{
+	static constexpr auto stripe_count = std::size_t{ 8u };
+
+	struct alignas(64) stripe final
+	{
+		std::mutex    mutex{};
+		std::uint64_t acquisitions{};
+		std::uint64_t contended{};
+		histogram     wait{};
+		histogram     hold{};
+	};
+
+	std::string                              name_;
+	mutable std::array<stripe, stripe_count> stripes_;
+
+	static stripe& local_stripe(std::array<stripe, stripe_count>& stripes) noexcept
+	{
+		static auto             next  = std::atomic<std::size_t>{};
+		thread_local const auto index = next.fetch_add(1u, std::memory_order_relaxed) % stripe_count;
+		return stripes[index];
+	}
+
+public:
+	explicit lock_profile(std::string_view name);
+
+	lock_profile(const lock_profile&)            = delete;
+	lock_profile& operator=(const lock_profile&) = delete;
+
+	/// The profile of the locks with this name, created on first use and kept until the process exits.
+	static lock_profile& find(std::string_view name);
+
+	void acquired(std::chrono::nanoseconds wait, bool contended)
+	{
+		auto&      s    = local_stripe(this->stripes_);
+		const auto lock = std::lock_guard<std::mutex>{ s.mutex };
+		++s.acquisitions;
+		s.contended += contended ? 1u : 0u;
+		s.wait.record(static_cast<std::uint64_t>(wait.count()));
+	}
+
+	void released(std::chrono::nanoseconds hold)
+	{
+		auto&      s    = local_stripe(this->stripes_);
+		const auto lock = std::lock_guard<std::mutex>{ s.mutex };
+		s.hold.record(static_cast<std::uint64_t>(hold.count()));
+	}
+
+	lock_stats statistics() const;
+	void       reset();
+};
+
+#endif
+
+} // namespace bitcask
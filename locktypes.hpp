@@ -9,10 +9,189 @@
 
 #include "config.h"
 
+#include <string_view>
+
 #ifdef BITCASK_THREAD_SAFE
+#include "tracing.h"
+
 #include <mutex>
 #include <shared_mutex>
 
+#ifdef BITCASK_LOCK_STATS
+
+#include "lockstats.h"
+
+#include <chrono>
+#include <string>
+#include <utility>
+
+namespace bitcask {
+
+// A lock that records in a lock_profile how long it was waited for and how long it was held.
+// An uncontended acquisition costs a try_lock and a clock read, a contended one two more clock reads.
+template<typename Mutex, bool Shared>
+class profiled_lock final
+{
+	using clock_type = std::chrono::steady_clock;
+
+	Mutex*                 mutex_;
+	lock_profile*          profile_;
+	clock_type::time_point acquired_;
+
+public:
+	profiled_lock(Mutex& mutex, lock_profile& profile)
+	    : mutex_{ &mutex }
+	    , profile_{ &profile }
+	    , acquired_{}
+	{
+		auto contended = false;
+		if constexpr (Shared)
+		{
+			contended = !mutex.try_lock_shared();
+		}
+		else
+		{
+			contended = !mutex.try_lock();
+		}
+
+		if (contended)
+		{
+			const auto start = clock_type::now();
+			if constexpr (Shared)
+			{
+				mutex.lock_shared();
+			}
+			else
+			{
+				mutex.lock();
+			}
+			this->acquired_ = clock_type::now();
+			profile.acquired(this->acquired_ - start, true);
+		}
+		else
+		{
+			this->acquired_ = clock_type::now();
+			profile.acquired(std::chrono::nanoseconds{}, false);
+		}
+	}
+
+	~profiled_lock() noexcept
+	{
+		if (this->mutex_)
+		{
+			this->unlock();
+		}
+	}
+
+	profiled_lock(profiled_lock&& other) noexcept
+	    : mutex_{ std::exchange(other.mutex_, nullptr) }
+	    , profile_{ other.profile_ }
+	    , acquired_{ other.acquired_ }
+	{
+	}
+
+	profiled_lock& operator=(profiled_lock&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (this->mutex_)
+			{
+				this->unlock();
+			}
+			this->mutex_    = std::exchange(other.mutex_, nullptr);
+			this->profile_  = other.profile_;
+			this->acquired_ = other.acquired_;
+		}
+		return *this;
+	}
+
+	profiled_lock(const profiled_lock&)            = delete;
+	profiled_lock& operator=(const profiled_lock&) = delete;
+
+	bool owns_lock() const noexcept
+	{
+		return this->mutex_ != nullptr;
+	}
+
+	void unlock()
+	{
+		const auto held = clock_type::now() - this->acquired_;
+		if constexpr (Shared)
+		{
+			std::exchange(this->mutex_, nullptr)->unlock_shared();
+		}
+		else
+		{
+			std::exchange(this->mutex_, nullptr)->unlock();
+		}
+		this->profile_->released(held);
+	}
+};
+
+using lock_type       = profiled_lock<std::mutex, false>;
+using write_lock_type = profiled_lock<std::shared_mutex, false>;
+using read_lock_type  = profiled_lock<std::shared_mutex, true>;
+
+class locker
+{
+	std::mutex    mutex_{};
+	lock_profile* profile_;
+
+public:
+	locker()
+	    : locker{ "unnamed" }
+	{
+	}
+
+	/// The name identifies the lock in lock_statistics. Locks with the same name are counted together.
+	explicit locker(std::string_view name)
+	    : profile_{ &lock_profile::find(name) }
+	{
+	}
+
+	lock_type lock()
+	{
+		const auto timer = phase_timer{ trace_phase::lock };
+		return lock_type{ this->mutex_, *this->profile_ };
+	}
+};
+
+class shared_locker
+{
+	std::shared_mutex mutex_{};
+	lock_profile*     read_profile_;
+	lock_profile*     write_profile_;
+
+public:
+	shared_locker()
+	    : shared_locker{ "unnamed" }
+	{
+	}
+
+	/// The name identifies the lock in lock_statistics, with " (shared)" or " (exclusive)" appended.
+	explicit shared_locker(std::string_view name)
+	    : read_profile_{ &lock_profile::find(std::string{ name } + " (shared)") }
+	    , write_profile_{ &lock_profile::find(std::string{ name } + " (exclusive)") }
+	{
+	}
+
+	read_lock_type read_lock()
+	{
+		const auto timer = phase_timer{ trace_phase::lock };
+		return read_lock_type{ this->mutex_, *this->read_profile_ };
+	}
+
+	write_lock_type write_lock()
+	{
+		const auto timer = phase_timer{ trace_phase::lock };
+		return write_lock_type{ this->mutex_, *this->write_profile_ };
+	}
+};
+
+} // namespace bitcask
+
+#else
+
 namespace bitcask {
 
 using lock_type       = std::unique_lock<std::mutex>;
@@ -24,8 +203,16 @@ class locker
 	std::mutex mutex_{};
 
 public:
+	locker() = default;
+
+	/// The name identifies the lock in the statistics of a build with BITCASK_LOCK_STATS.
+	explicit locker(std::string_view)
+	{
+	}
+
 	lock_type lock()
 	{
+		const auto timer = phase_timer{ trace_phase::lock };
 		return lock_type{ this->mutex_ };
 	}
 };
@@ -35,19 +222,30 @@ class shared_locker
 	std::shared_mutex mutex_{};
 
 public:
+	shared_locker() = default;
+
+	/// The name identifies the lock in the statistics of a build with BITCASK_LOCK_STATS.
+	explicit shared_locker(std::string_view)
+	{
+	}
+
 	read_lock_type read_lock()
 	{
+		const auto timer = phase_timer{ trace_phase::lock };
 		return read_lock_type{ this->mutex_ };
 	}
 
 	write_lock_type write_lock()
 	{
+		const auto timer = phase_timer{ trace_phase::lock };
 		return write_lock_type{ this->mutex_ };
 	}
 };
 
 } // namespace bitcask
 
+#endif
+
 #else
 
 namespace bitcask {
@@ -64,6 +262,12 @@ using read_lock_type  = lock_type;
 class locker
 {
 public:
+	locker() = default;
+
+	explicit locker(std::string_view)
+	{
+	}
+
 	lock_type lock()
 	{
 		return lock_type{};
@@ -73,6 +277,12 @@ public:
 class shared_locker
 {
 public:
+	shared_locker() = default;
+
+	explicit shared_locker(std::string_view)
+	{
+	}
+
 	read_lock_type read_lock()
 	{
 		return read_lock_type{};
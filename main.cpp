@@ -9,10 +9,11 @@
 #include "test_operation.h"
 #include "make_random_operations.h"
 #include "counter_timer.hpp"
-#include "syncqueue.hpp"
+#include "mpmcqueue.hpp"
 #include "config.h"
 #include <fmt/format.h>
 #include <fmt/ostream.h>
+#include <fmt/std.h>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
@@ -22,6 +23,7 @@
 #include <unordered_map>
 #include <filesystem>
 #include <algorithm>
+#include <array>
 #include <random>
 #include <future>
 
@@ -293,13 +295,16 @@ struct test_operation_executor
 #ifdef BITCASK_THREAD_SAFE
 class worker
 {
-	bitcask&                              bc_;
-	synchronized_queue<std::string_view>& queue_;
-	std::thread                           thread_;
-	std::size_t                           get_count_;
+	// keys are taken from the queue in batches, so that the benchmark measures the store rather than the queue
+	static constexpr auto batch_size = std::size_t{ 32u };
+
+	bitcask&                      bc_;
+	mpmc_queue<std::string_view>& queue_;
+	std::thread                   thread_;
+	std::size_t                   get_count_;
 
 public:
-	explicit worker(bitcask& bc, synchronized_queue<std::string_view>& queue)
+	explicit worker(bitcask& bc, mpmc_queue<std::string_view>& queue)
 	    : bc_{ bc }
 	    , queue_{ queue }
 	    , thread_{ std::bind(&worker::run, this) }
@@ -328,21 +333,22 @@ public:
 private:
 	void run()
 	{
+		auto keys = std::array<std::string_view, batch_size>{};
 		for (;;)
 		{
-			auto key = std::string_view{};
-			if (this->queue_.pop(key))
+			const auto count = this->queue_.pop_batch(keys.begin(), keys.size());
+			if (!count)
 			{
+				return;
+			}
+
+			std::for_each(keys.begin(), keys.begin() + count, [&](const auto& key) {
 				auto res = this->bc_.get(key);
 				assert(res.has_value());
 				(void)res;
+			});
 
-				++this->get_count_;
-			}
-			else
-			{
-				return;
-			}
+			this->get_count_ += count;
 		}
 	}
 };
@@ -413,8 +419,10 @@ void run_test_03()
 	verify_maps_are_equal(map1, map2);
 	{
 		fmt::print(stderr, "Load started\n");
-		auto bc = bitcask{ bitcask_dir };
-		map2    = load_map(bc);
+		const auto start = std::chrono::steady_clock::now();
+		auto       bc    = bitcask{ bitcask_dir };
+		fmt::print(stderr, "Opened in {:.3f} s\n", std::chrono::duration<double>{ std::chrono::steady_clock::now() - start }.count());
+		map2 = load_map(bc);
 		fmt::print(stderr, "Load finished\n");
 	}
 	verify_maps_are_equal(map1, map2);
@@ -493,10 +501,12 @@ void run_concurrency_test_02()
 	auto map = load_map(bc);
 	fmt::print(stderr, "Load finished\n");
 
-	auto queue = synchronized_queue<std::string_view>{};
-	std::for_each(map.begin(), map.end(), [&](const auto& pair) { queue.push(std::string_view{ pair.first }); });
+	auto key_views = std::vector<std::string_view>{};
+	key_views.reserve(map.size());
+	std::for_each(map.begin(), map.end(), [&](const auto& pair) { key_views.push_back(std::string_view{ pair.first }); });
 
-	assert(queue.size() == map.size());
+	// the workers take the keys while they are being pushed, and stop once the queue is closed and empty
+	auto queue = mpmc_queue<std::string_view>{ 4096u };
 
 	using clock_type = std::chrono::high_resolution_clock;
 
@@ -512,6 +522,11 @@ void run_concurrency_test_02()
 		workers.push_back(std::make_unique<worker>(bc, queue));
 	}
 
+	const auto pushed = queue.push_batch(key_views.begin(), key_views.end());
+	assert(pushed == map.size());
+	(void)pushed;
+	queue.close();
+
 	std::for_each(workers.begin(), workers.end(), [](auto& worker) { worker->join(); });
 
 	assert(queue.empty());
@@ -26,9 +26,8 @@ void make_random_operations(std::map<key_type, value_type>&
 	auto&& pick_random_map_pair = [&]() {
 		auto dist = std::uniform_int_distribution<std::size_t>(0, map.size() - 1);
 
-		auto it = map.begin();
-		//std::advance(it, dist(re)); // << very slow
-		std::next(it, dist(re)); // << much faster
+		// a walk over dist(re) nodes, which is slow for large maps but good enough for the demo
+		const auto it = std::next(map.begin(), dist(re));
 
 		return *it;
 	};
@@ -0,0 +1,498 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "mapped_index.h"
+
+#include <string_view>
+#include <optional>
+#include <system_error>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+#include <utility>
+#include <bit>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bitcask {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// File layout: header, slots, key arena. All positions are offsets, so the file can be mapped at any address.
+// The layout is that of the host (byte order, alignment); a file written by another platform is rejected and rebuilt.
+
+constexpr char          magic[8]       = { 'B', 'C', 'K', 'E', 'Y', 'D', 'I', 'R' };
+constexpr std::uint32_t format_version = 1u;
+
+constexpr std::size_t   header_size    = 4096u;
+constexpr std::size_t   min_capacity   = 1024u;
+constexpr std::size_t   min_arena_size = 64u * 1024u;
+constexpr std::uint64_t empty_ref      = 0u;
+constexpr std::uint64_t deleted_ref    = 1u;
+constexpr std::uint64_t arena_begin    = 8u; // key offsets below this mark empty and deleted slots
+
+struct header final
+{
+	char          magic[8];
+	std::uint32_t format_version;
+	std::uint32_t slot_size;
+	std::uint32_t dirty;         // set while the index is open for writing
+	std::uint32_t reserved;
+	std::uint64_t fingerprint;   // of the data files the index was persisted with
+	std::uint64_t max_version;   // highest version in the data files
+	std::uint64_t capacity;      // number of slots, power of 2
+	std::uint64_t size;          // slots in use
+	std::uint64_t deleted;       // slots that must be probed past
+	std::uint64_t arena_size;    // bytes reserved for keys
+	std::uint64_t arena_used;    // including arena_begin
+	std::uint64_t arena_garbage; // bytes of erased keys
+};
+
+struct slot final
+{
+	std::uint64_t hash;
+	std::uint64_t key_ref; // offset of the key in the arena, or empty_ref or deleted_ref
+	keydir_info   info;    // info.ksz is the length of the key
+};
+
+static_assert(sizeof(header) <= header_size);
+static_assert(std::is_trivially_copyable_v<header> && std::is_trivially_copyable_v<slot>);
+
+std::system_error make_error(const fs::path& path, const char* what)
+{
+	return std::system_error{ std::error_code{ errno, std::system_category() }, path.string() + ": " + what };
+}
+
+// A file, mapped in its entirety. Every resize maps it again, possibly at another address.
+class mapped_file final
+{
+	fs::path    path_;
+	int         fd_;
+	char*       data_;
+	std::size_t size_;
+
+	void unmap() noexcept
+	{
+		if (this->data_)
+		{
+			::munmap(this->data_, this->size_);
+			this->data_ = nullptr;
+		}
+	}
+
+	void map(std::size_t size)
+	{
+		this->size_ = size;
+		if (size)
+		{
+			const auto addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd_, 0);
+			if (addr == MAP_FAILED)
+			{
+				throw make_error(this->path_, "mmap");
+			}
+			this->data_ = static_cast<char*>(addr);
+		}
+	}
+
+public:
+	explicit mapped_file(const fs::path& path)
+	    : path_{ path }
+	    , fd_{ ::open(path.string().c_str(), O_RDWR | O_CREAT, 0664) }
+	    , data_{}
+	    , size_{}
+	{
+		if (this->fd_ == -1)
+		{
+			throw make_error(this->path_, "open");
+		}
+
+		struct stat st;
+		if (::fstat(this->fd_, &st) == -1)
+		{
+			const auto error = make_error(this->path_, "fstat");
+			::close(this->fd_);
+			throw error;
+		}
+
+		try
+		{
+			this->map(static_cast<std::size_t>(st.st_size));
+		}
+		catch (...)
+		{
+			::close(this->fd_);
+			throw;
+		}
+	}
+
+	~mapped_file() noexcept
+	{
+		this->unmap();
+		::close(this->fd_);
+	}
+
+	mapped_file(const mapped_file&)            = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	const fs::path& path() const noexcept
+	{
+		return this->path_;
+	}
+
+	char* data() const noexcept
+	{
+		return this->data_;
+	}
+
+	std::size_t size() const noexcept
+	{
+		return this->size_;
+	}
+
+	void resize(std::size_t size)
+	{
+		this->unmap();
+		if (::ftruncate(this->fd_, static_cast<off_t>(size)) == -1)
+		{
+			throw make_error(this->path_, "ftruncate");
+		}
+		this->map(size);
+	}
+
+	void rename(const fs::path& path)
+	{
+		fs::rename(this->path_, path);
+		this->path_ = path;
+	}
+
+	void sync(std::size_t length) const
+	{
+		if (::msync(this->data_, std::min(length, this->size_), MS_SYNC) == -1)
+		{
+			throw make_error(this->path_, "msync");
+		}
+	}
+};
+
+// Open addressing with linear probing. The file only grows; growing the table writes a new file and renames it.
+class mapped_index final : public keydir_index
+{
+	std::unique_ptr<mapped_file> file_;
+	std::optional<version_type>  restored_version_;
+
+	header& head() const noexcept
+	{
+		return *reinterpret_cast<header*>(this->file_->data());
+	}
+
+	slot* slots() const noexcept
+	{
+		return reinterpret_cast<slot*>(this->file_->data() + header_size);
+	}
+
+	char* arena() const noexcept
+	{
+		return this->file_->data() + header_size + this->head().capacity * sizeof(slot);
+	}
+
+	std::string_view key_of(const slot& s) const noexcept
+	{
+		return std::string_view{ this->arena() + s.key_ref, s.info.ksz };
+	}
+
+	static bool in_use(const slot& s) noexcept
+	{
+		return s.key_ref >= arena_begin;
+	}
+
+	bool valid() const noexcept
+	{
+		if (this->file_->size() < header_size)
+		{
+			return false;
+		}
+		const auto& h = this->head();
+		return std::memcmp(h.magic, magic, sizeof(magic)) == 0 && h.format_version == format_version && h.slot_size == sizeof(slot)
+		       && std::has_single_bit(h.capacity) && h.arena_used <= h.arena_size
+		       && this->file_->size() == header_size + h.capacity * sizeof(slot) + h.arena_size;
+	}
+
+	static void initialize(mapped_file& file, std::size_t capacity, std::size_t arena_size)
+	{
+		file.resize(0u); // discard the old contents
+		file.resize(header_size + capacity * sizeof(slot) + arena_size);
+
+		auto& h = *reinterpret_cast<header*>(file.data());
+		std::memcpy(h.magic, magic, sizeof(magic));
+		h.format_version = format_version;
+		h.slot_size      = sizeof(slot);
+		h.dirty          = 1u;
+		h.capacity       = capacity;
+		h.arena_size     = arena_size;
+		h.arena_used     = arena_begin;
+	}
+
+	slot* find_slot(const std::string_view& key, std::uint64_t hash) const
+	{
+		const auto slots = this->slots();
+		const auto mask  = this->head().capacity - 1u;
+		for (auto i = hash & mask;; i = (i + 1u) & mask)
+		{
+			auto& s = slots[i];
+			if (s.key_ref == empty_ref)
+			{
+				return nullptr;
+			}
+			if (in_use(s) && s.hash == hash && this->key_of(s) == key)
+			{
+				return &s;
+			}
+		}
+	}
+
+	// Places a key in an unused slot. There must be room in the table and in the arena.
+	void place(std::uint64_t hash, const std::string_view& key, const keydir_info& info)
+	{
+		auto&      h     = this->head();
+		const auto slots = this->slots();
+		const auto mask  = h.capacity - 1u;
+		auto       i     = hash & mask;
+		while (in_use(slots[i]))
+		{
+			i = (i + 1u) & mask;
+		}
+
+		if (slots[i].key_ref == deleted_ref)
+		{
+			--h.deleted;
+		}
+
+		std::copy(key.begin(), key.end(), this->arena() + h.arena_used);
+		slots[i] = slot{ .hash = hash, .key_ref = h.arena_used, .info = info };
+		slots[i].info.ksz = static_cast<ksz_type>(key.size());
+
+		h.arena_used += key.size();
+		++h.size;
+	}
+
+	// Writes the live entries to a new file with the given capacity, and replaces the current file with it.
+	void rebuild(std::size_t capacity, std::size_t extra_key_bytes)
+	{
+		const auto& h         = this->head();
+		const auto  key_bytes = h.arena_used - arena_begin - h.arena_garbage;
+
+		auto target = mapped_index{ std::make_unique<mapped_file>(this->file_->path().string() + ".tmp") };
+		initialize(*target.file_, capacity, std::max(min_arena_size, 2u * (arena_begin + key_bytes + extra_key_bytes)));
+		target.head().max_version = h.max_version;
+
+		this->traverse([&](const auto& key, std::uint64_t hash, const auto& info) {
+			target.place(hash, key, info);
+			return true;
+		});
+
+		target.file_->rename(this->file_->path());
+		this->file_ = std::move(target.file_);
+	}
+
+	// Makes room for one more key.
+	void reserve(std::size_t key_size)
+	{
+		const auto& h = this->head();
+		if ((h.size + h.deleted + 1u) * 4u > h.capacity * 3u)
+		{
+			// Grow if the table is filled with live entries, otherwise just drop the deleted slots.
+			auto capacity = min_capacity;
+			while ((h.size + 1u) * 2u > capacity)
+			{
+				capacity *= 2u;
+			}
+			this->rebuild(capacity, key_size);
+		}
+		else if (h.arena_used + key_size > h.arena_size)
+		{
+			if (h.arena_garbage > h.arena_used / 2u)
+			{
+				this->rebuild(h.capacity, key_size);
+			}
+			else
+			{
+				// The arena is at the end of the file, so it grows in place.
+				const auto arena_size = std::max(2u * h.arena_size, h.arena_used + key_size);
+				const auto capacity   = h.capacity;
+				this->file_->resize(header_size + capacity * sizeof(slot) + arena_size);
+				this->head().arena_size = arena_size;
+			}
+		}
+	}
+
+	explicit mapped_index(std::unique_ptr<mapped_file>&& file)
+	    : file_{ std::move(file) }
+	    , restored_version_{}
+	{
+	}
+
+public:
+	mapped_index(const fs::path& path, std::uint64_t fingerprint)
+	    : file_{ std::make_unique<mapped_file>(path) }
+	    , restored_version_{}
+	{
+		if (this->valid() && !this->head().dirty && this->head().fingerprint == fingerprint)
+		{
+			this->restored_version_ = this->head().max_version;
+		}
+		else
+		{
+			initialize(*this->file_, min_capacity, min_arena_size);
+		}
+
+		// From here on the contents change without being synced. Make sure a crash leaves them marked as stale.
+		this->head().dirty = 1u;
+		this->file_->sync(header_size);
+	}
+
+	std::size_t size() const override
+	{
+		return this->head().size;
+	}
+
+	keydir_stats statistics() const override
+	{
+		const auto& h = this->head();
+		return keydir_stats{ .keys             = h.size,
+			                 .key_bytes        = h.arena_used - arena_begin - h.arena_garbage,
+			                 .stored_key_bytes = h.arena_used - arena_begin,
+			                 .memory_usage     = this->file_->size() };
+	}
+
+	const keydir_info* find(const std::string_view& key, std::uint64_t hash) const override
+	{
+		const auto s = this->find_slot(key, hash);
+		return s ? &s->info : nullptr;
+	}
+
+	bool insert_or_assign(const std::string_view& key, std::uint64_t hash, keydir_info&& info) override
+	{
+		const auto s = this->find_slot(key, hash);
+		if (s)
+		{
+			s->info     = info;
+			s->info.ksz = static_cast<ksz_type>(key.size());
+			return false;
+		}
+		else
+		{
+			this->reserve(key.size());
+			this->place(hash, key, info);
+			return true;
+		}
+	}
+
+	bool erase(const std::string_view& key, std::uint64_t hash) override
+	{
+		const auto s = this->find_slot(key, hash);
+		if (!s)
+		{
+			return false;
+		}
+
+		auto&      h     = this->head();
+		const auto slots = this->slots();
+		const auto next  = (static_cast<std::size_t>(s - slots) + 1u) & (h.capacity - 1u);
+
+		h.arena_garbage += s->info.ksz;
+		--h.size;
+
+		// No probe sequence continues past an empty slot, so if the next slot is empty, this one can be too.
+		*s = slot{};
+		if (slots[next].key_ref != empty_ref)
+		{
+			s->key_ref = deleted_ref;
+			++h.deleted;
+		}
+		return true;
+	}
+
+	bool traverse(const callback& cb) const override
+	{
+		const auto slots    = this->slots();
+		const auto capacity = this->head().capacity;
+		for (auto i = std::size_t{}; i < capacity; ++i)
+		{
+			if (in_use(slots[i]) && !cb(this->key_of(slots[i]), slots[i].hash, slots[i].info))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool ordered() const override
+	{
+		return false;
+	}
+
+	void reindex_files(const std::function<file_index_type(file_id_type)>& index_of) override
+	{
+		const auto slots    = this->slots();
+		const auto capacity = this->head().capacity;
+		for (auto i = std::size_t{}; i < capacity; ++i)
+		{
+			if (in_use(slots[i]))
+			{
+				// written only if it changes, so that the pages of the file stay clean
+				const auto index = index_of(slots[i].info.file_id);
+				if (slots[i].info.file_index != index)
+				{
+					slots[i].info.file_index = index;
+				}
+			}
+		}
+	}
+
+	bool scan(const std::string_view&, const std::string_view&, const callback&) const override
+	{
+		throw std::runtime_error{ "Range scans require an ordered keydir (keydir_mode::ordered or keydir_mode::compact)" };
+	}
+
+	std::optional<version_type> restored_version() const override
+	{
+		return this->restored_version_;
+	}
+
+	void persist(std::uint64_t fingerprint, version_type max_version) override
+	{
+		auto& h       = this->head();
+		h.fingerprint = fingerprint;
+		h.max_version = max_version;
+		this->file_->sync(this->file_->size());
+
+		// Clear the flag only once everything else is on disk.
+		h.dirty = 0u;
+		this->file_->sync(header_size);
+	}
+};
+
+} // namespace
+
+fs::path mapped_index_path(const fs::path& directory)
+{
+	return directory / "keydir.map";
+}
+
+std::unique_ptr<keydir_index> make_mapped_index(const fs::path& path, std::uint64_t fingerprint)
+{
+	return std::make_unique<mapped_index>(path, fingerprint);
+}
+
+} // namespace bitcask
@@ -0,0 +1,26 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "keydir_index.h"
+
+#include <filesystem>
+#include <memory>
+#include <cstdint>
+
+namespace bitcask {
+
+/// Path of the file that holds the keydir of keydir_mode::mapped.
+std::filesystem::path mapped_index_path(const std::filesystem::path& directory);
+
+/// Hash table in a memory-mapped file (see keydir_mode::mapped).
+/// The contents of the file are reused if it was persisted with the same data file fingerprint,
+/// otherwise the index starts empty.
+std::unique_ptr<keydir_index> make_mapped_index(const std::filesystem::path& path, std::uint64_t fingerprint);
+
+} // namespace bitcask
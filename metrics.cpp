@@ -0,0 +1,148 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "metrics.h"
+
+#include <fmt/format.h>
+
+#include <iterator>
+#include <initializer_list>
+#include <utility>
+
+namespace bitcask {
+
+namespace {
+
+class prometheus_writer final
+{
+	std::string      text_;
+	std::string_view prefix_;
+
+	void header(std::string_view name, std::string_view type, std::string_view help)
+	{
+		fmt::format_to(std::back_inserter(this->text_), "# HELP {}_{} {}\n# TYPE {}_{} {}\n", this->prefix_, name, help, this->prefix_, name, type);
+	}
+
+public:
+	explicit prometheus_writer(std::string_view prefix)
+	    : text_{}
+	    , prefix_{ prefix }
+	{
+	}
+
+	void counter(std::string_view name, std::string_view help, std::uint64_t value)
+	{
+		this->header(name, "counter", help);
+		fmt::format_to(std::back_inserter(this->text_), "{}_{} {}\n", this->prefix_, name, value);
+	}
+
+	void gauge(std::string_view name, std::string_view help, std::uint64_t value)
+	{
+		this->header(name, "gauge", help);
+		fmt::format_to(std::back_inserter(this->text_), "{}_{} {}\n", this->prefix_, name, value);
+	}
+
+	// A summary with the operation as label, values in nanoseconds are exported in seconds.
+	void latency(std::string_view name, std::string_view help, std::initializer_list<std::pair<std::string_view, const histogram*>> ops)
+	{
+		this->header(name, "summary", help);
+		for (const auto& [op, h] : ops)
+		{
+			for (const auto q : { 0.5, 0.9, 0.99, 0.999 })
+			{
+				fmt::format_to(std::back_inserter(this->text_),
+				               "{}_{}{{op=\"{}\",quantile=\"{}\"}} {:.9f}\n",
+				               this->prefix_,
+				               name,
+				               op,
+				               q,
+				               static_cast<double>(h->percentile(q * 100.0)) / 1e9);
+			}
+			fmt::format_to(std::back_inserter(this->text_),
+			               "{}_{}_sum{{op=\"{}\"}} {:.9f}\n{}_{}_count{{op=\"{}\"}} {}\n",
+			               this->prefix_,
+			               name,
+			               op,
+			               static_cast<double>(h->sum()) / 1e9,
+			               this->prefix_,
+			               name,
+			               op,
+			               h->count());
+		}
+	}
+
+	// Counters with the lock name as label.
+	void locks(std::string_view name, std::string_view help, const std::vector<lock_stats>& locks, auto&& value)
+	{
+		this->header(name, "counter", help);
+		for (const auto& l : locks)
+		{
+			fmt::format_to(std::back_inserter(this->text_), "{}_{}{{lock=\"{}\"}} {}\n", this->prefix_, name, l.name, value(l));
+		}
+	}
+
+	std::string release()
+	{
+		return std::move(this->text_);
+	}
+};
+
+} // namespace
+
+std::string to_prometheus(const store_metrics& m, std::string_view prefix)
+{
+	auto w = prometheus_writer{ prefix };
+
+	w.counter("gets_total", "Gets.", m.gets);
+	w.counter("get_misses_total", "Gets of keys that do not exist.", m.get_misses);
+	w.counter("puts_total", "Puts.", m.puts);
+	w.counter("dels_total", "Deletes.", m.dels);
+	w.counter("read_bytes_total", "Bytes of keys and values read from the data files by gets.", m.bytes_read);
+	w.counter("written_bytes_total", "Bytes of keys and values appended by puts and deletes.", m.bytes_written);
+
+	w.gauge("keydir_keys", "Keys in the keydir.", m.keydir.keys);
+	w.gauge("keydir_memory_bytes", "Estimated memory used by the keydir.", m.keydir.memory_usage);
+
+	w.gauge("data_files", "Data files.", m.data.files);
+	w.gauge("data_bytes", "Bytes of data in all data files.", m.data.bytes);
+	w.counter("locked_file_lookups_total", "Reads that looked up their data file under the datadir lock.", m.data.locked_file_lookups);
+
+	w.counter("merges_total", "Completed merges.", m.data.merge.merges);
+	w.gauge("merge_running", "1 while a merge runs.", m.data.merge.running ? 1u : 0u);
+	w.gauge("merge_files", "Input files of the running or last merge.", m.data.merge.files_total);
+	w.gauge("merge_files_done", "Input files of the running or last merge that have been merged.", m.data.merge.files_done);
+	w.counter("merge_copied_records_total", "Live records copied by merges.", m.data.merge.records_copied);
+	w.counter("merge_copied_bytes_total", "Bytes of keys and values copied by merges.", m.data.merge.bytes_copied);
+
+	w.counter("value_cache_hits_total", "Value cache hits.", m.value_cache.hits);
+	w.counter("value_cache_misses_total", "Value cache misses.", m.value_cache.misses);
+	w.counter("value_cache_evictions_total", "Value cache evictions.", m.value_cache.evictions);
+	w.gauge("value_cache_entries", "Entries in the value cache.", m.value_cache.entries);
+	w.gauge("value_cache_bytes", "Bytes used by the value cache.", m.value_cache.size);
+
+	if (m.latencies)
+	{
+		const auto& l = m.latencies.value();
+		w.latency("operation_latency_seconds", "Latency of gets, puts and deletes.", { { "get", &l.get }, { "put", &l.put }, { "del", &l.del } });
+	}
+
+	if (!m.locks.empty())
+	{
+		w.locks("lock_acquisitions_total", "Lock acquisitions.", m.locks, [](const lock_stats& l) { return l.acquisitions; });
+		w.locks("lock_contended_total", "Lock acquisitions that had to wait.", m.locks, [](const lock_stats& l) { return l.contended; });
+		w.locks("lock_wait_seconds_total", "Time spent waiting for locks.", m.locks, [](const lock_stats& l) {
+			return fmt::format("{:.9f}", static_cast<double>(l.wait.sum()) / 1e9);
+		});
+		w.locks("lock_hold_seconds_total", "Time locks were held.", m.locks, [](const lock_stats& l) {
+			return fmt::format("{:.9f}", static_cast<double>(l.hold.sum()) / 1e9);
+		});
+	}
+
+	return w.release();
+}
+
+} // namespace bitcask
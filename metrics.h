@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "keydir.h"
+#include "datadir.h"
+#include "valuecache.h"
+#include "histogram.hpp"
+#include "lockstats.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace bitcask {
+
+/// Latencies in nanoseconds since the store was opened, see options::record_latencies.
+/// Includes the time spent waiting for locks and, with options::writer_thread, for the writer.
+struct latency_stats final
+{
+	histogram get{};
+	histogram put{};
+	histogram del{};
+
+	void merge(const latency_stats& other) noexcept
+	{
+		this->get.merge(other.get);
+		this->put.merge(other.put);
+		this->del.merge(other.del);
+	}
+};
+
+/// Counters since the store was opened, and the current state of the keydir, the data files and the value cache.
+/// See bitcask::metrics.
+struct store_metrics final
+{
+	std::uint64_t gets;
+	std::uint64_t get_misses; // gets of keys that do not exist
+	std::uint64_t puts;
+	std::uint64_t dels;
+	std::uint64_t bytes_read;    // keys and values read from the data files by gets, i.e. not served by the value cache
+	std::uint64_t bytes_written; // keys and values appended by puts and dels
+
+	keydir_stats      keydir;
+	datadir_stats     data;
+	valuecache::stats value_cache;
+
+	std::optional<latency_stats> latencies; // with options::record_latencies
+	std::vector<lock_stats>      locks;     // of all stores in the process, in a build with BITCASK_LOCK_STATS
+};
+
+/// Formats the metrics in the Prometheus text exposition format, with `prefix` and an underscore before every name.
+/// Latencies are exported as summaries in seconds, lock wait and hold times as totals in seconds per lock.
+std::string to_prometheus(const store_metrics& m, std::string_view prefix = "bitcask");
+
+} // namespace bitcask
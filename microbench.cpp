@@ -0,0 +1,364 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Micro-benchmarks of the components on the get and put paths, each measured in isolation.
+// Run with --benchmark_filter=<regex> to select some of them, see --help for the other Google Benchmark options.
+
+#include "datafile.h"
+#include "keydir.h"
+#include "recordheader.h"
+#include "file.h"
+#include "hton.h"
+#include "crc32.h"
+#include "options.h"
+
+#include <benchmark/benchmark.h>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bitcask {
+namespace microbench {
+
+namespace {
+
+// "key" and a zero padded number, `size` bytes long, at least long enough for the number.
+std::string make_key(std::size_t number, std::size_t size)
+{
+	return fmt::format("key{:0>{}}", number, size > 3u ? size - 3u : 1u);
+}
+
+std::string make_value(std::size_t size)
+{
+	auto rng   = std::mt19937_64{ size };
+	auto value = std::string(size, '\0');
+	std::generate(value.begin(), value.end(), [&] { return static_cast<char>(rng()); });
+	return value;
+}
+
+// The keys in a random order, so that consecutive lookups do not hit neighbouring memory.
+std::vector<std::size_t> shuffled(std::size_t count)
+{
+	auto order = std::vector<std::size_t>(count);
+	for (auto i = std::size_t{}; i < count; ++i)
+	{
+		order[i] = i;
+	}
+	std::shuffle(order.begin(), order.end(), std::mt19937_64{ 1u });
+	return order;
+}
+
+std::size_t arg(const benchmark::State& state, int index)
+{
+	return static_cast<std::size_t>(state.range(index));
+}
+
+// ---- record_header
+
+// Encodes a header the way datafile::put does: CRC over the header fields, the key and the value, then serialize.
+// Arguments: key size, value size.
+void record_header_write(benchmark::State& state)
+{
+	const auto key   = make_key(1u, arg(state, 0));
+	const auto value = make_value(arg(state, 1));
+
+	auto version = version_type{};
+	for (auto _ : state)
+	{
+		auto header     = record_header{};
+		header.version  = ++version;
+		header.ksz      = static_cast<ksz_type>(key.size());
+		header.value_sz = static_cast<value_sz_type>(value.size());
+		header.init_crc();
+		header.crc = crc32_fast(key.data(), key.size(), header.crc);
+		header.crc = crc32_fast(value.data(), value.size(), header.crc);
+		header.serialize();
+		benchmark::DoNotOptimize(header.buffer);
+	}
+	state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * (record_header::size + key.size() + value.size())));
+}
+
+// Decodes a header and verifies the CRC of the record, the way datafile::traverse does.
+// Arguments: key size, value size.
+void record_header_read(benchmark::State& state)
+{
+	const auto key   = make_key(1u, arg(state, 0));
+	const auto value = make_value(arg(state, 1));
+
+	auto header     = record_header{};
+	header.version  = 1u;
+	header.ksz      = static_cast<ksz_type>(key.size());
+	header.value_sz = static_cast<value_sz_type>(value.size());
+	header.init_crc();
+	header.crc = crc32_fast(key.data(), key.size(), header.crc);
+	header.crc = crc32_fast(value.data(), value.size(), header.crc);
+	header.serialize();
+	const auto record = std::string{ header.buffer, record_header::size } + key + value;
+
+	for (auto _ : state)
+	{
+		auto decoded = record_header{};
+		auto crc     = crc_type{};
+		decoded.read(record.data(), crc);
+		crc = crc32_fast(record.data() + record_header::size, decoded.ksz, crc);
+		crc = crc32_fast(record.data() + record_header::size + decoded.ksz, decoded.value_sz, crc);
+		const auto valid = crc == decoded.crc;
+		benchmark::DoNotOptimize(valid);
+	}
+	state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * record.size()));
+}
+
+void record_sizes(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({ "key", "value" })->ArgsProduct({ { 16, 64, 256 }, { 0, 64, 1024, 16384 } });
+}
+
+BENCHMARK(record_header_write)->Apply(record_sizes);
+BENCHMARK(record_header_read)->Apply(record_sizes);
+
+// ---- crc32
+
+using crc32_function = uint32_t (*)(const void* data, size_t length, uint32_t previousCrc32);
+
+uint32_t crc32_16bytes_prefetch_default(const void* data, size_t length, uint32_t previousCrc32)
+{
+	return crc32_16bytes_prefetch(data, length, previousCrc32);
+}
+
+// Argument: length of the data.
+void crc32(benchmark::State& state, crc32_function fn)
+{
+	const auto data = make_value(arg(state, 0));
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(fn(data.data(), data.size(), 0u));
+	}
+	state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * data.size()));
+}
+
+void crc32_sizes(benchmark::internal::Benchmark* b)
+{
+	b->ArgName("length")->RangeMultiplier(4)->Range(16, 64 << 10);
+}
+
+BENCHMARK_CAPTURE(crc32, fast, &crc32_fast)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, bitwise, &crc32_bitwise)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, halfbyte, &crc32_halfbyte)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, 1byte, &crc32_1byte)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, 1byte_tableless, &crc32_1byte_tableless)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, 4bytes, &crc32_4bytes)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, 8bytes, &crc32_8bytes)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, 4x8bytes, &crc32_4x8bytes)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, 16bytes, &crc32_16bytes)->Apply(crc32_sizes);
+BENCHMARK_CAPTURE(crc32, 16bytes_prefetch, &crc32_16bytes_prefetch_default)->Apply(crc32_sizes);
+
+// ---- hton, ntoh
+
+// Converts a block of integers. ntoh is hton, see hton.h.
+template<typename T>
+void hton_block(benchmark::State& state)
+{
+	auto values = std::array<T, 1024>{};
+	auto rng    = std::mt19937_64{ 1u };
+	std::generate(values.begin(), values.end(), [&] { return static_cast<T>(rng()); });
+
+	for (auto _ : state)
+	{
+		for (auto& v : values)
+		{
+			v = hton(v);
+		}
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * values.size()));
+}
+
+BENCHMARK_TEMPLATE(hton_block, std::uint16_t);
+BENCHMARK_TEMPLATE(hton_block, std::uint32_t);
+BENCHMARK_TEMPLATE(hton_block, std::uint64_t);
+
+// ---- keydir
+
+constexpr auto keydir_modes =
+    std::array<keydir_mode, 4>{ keydir_mode::hashed, keydir_mode::concurrent, keydir_mode::ordered, keydir_mode::compact };
+constexpr auto keydir_mode_names = std::array<std::string_view, 4>{ "hashed", "concurrent", "ordered", "compact" };
+
+// A keydir filled with keys. Building a large one takes long, so the last one is kept for the next benchmark with the
+// same arguments. keydir_mode::hash_only and keydir_mode::mapped need a store on disk and are not measured here.
+struct keydir_fixture final
+{
+	std::tuple<std::size_t, std::size_t, std::size_t> args;
+	std::vector<std::string>                          keys;
+	std::vector<std::size_t>                          order;
+	keydir                                            kd;
+
+	keydir_fixture(std::size_t mode, std::size_t count, std::size_t key_size)
+	    : args{ mode, count, key_size }
+	    , keys{}
+	    , order{ shuffled(count) }
+	    , kd{ options{ .keydir = keydir_modes[mode] } }
+	{
+		this->keys.reserve(count);
+		for (auto i = std::size_t{}; i < count; ++i)
+		{
+			this->keys.push_back(make_key(i, key_size));
+			this->kd.put(this->keys.back(), make_info(i));
+		}
+	}
+
+	static keydir::info make_info(std::size_t i)
+	{
+		return keydir::info{ .file_id    = static_cast<file_id_type>(i % 16u),
+			                 .file_index = static_cast<file_index_type>(i % 16u),
+			                 .value_sz   = 100u,
+			                 .ksz        = 0u,
+			                 .value_pos  = static_cast<value_pos_type>(i * 128u),
+			                 .version    = static_cast<version_type>(i + 1u) };
+	}
+
+	// Arguments: mode, number of keys, key size.
+	static keydir_fixture& get(benchmark::State& state)
+	{
+		static auto cached = std::unique_ptr<keydir_fixture>{};
+
+		const auto args = std::tuple{ arg(state, 0), arg(state, 1), arg(state, 2) };
+		if (!cached || cached->args != args)
+		{
+			cached.reset();
+			cached = std::make_unique<keydir_fixture>(arg(state, 0), arg(state, 1), arg(state, 2));
+		}
+		state.SetLabel(std::string{ keydir_mode_names[arg(state, 0)] });
+		return *cached;
+	}
+};
+
+void keydir_get(benchmark::State& state)
+{
+	auto& f = keydir_fixture::get(state);
+	auto  i = std::size_t{};
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(f.kd.get(f.keys[f.order[i]]));
+		i = i + 1u == f.order.size() ? 0u : i + 1u;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// Overwrites existing keys, so that the size of the keydir stays the same.
+void keydir_put(benchmark::State& state)
+{
+	auto& f = keydir_fixture::get(state);
+	auto  i = std::size_t{};
+	for (auto _ : state)
+	{
+		const auto index = f.order[i];
+		benchmark::DoNotOptimize(f.kd.put(f.keys[index], keydir_fixture::make_info(index)));
+		i = i + 1u == f.order.size() ? 0u : i + 1u;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+void keydir_sizes(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({ "mode", "keys", "key" })->ArgsProduct({ { 0, 1, 2, 3 }, { 1 << 10, 1 << 16, 1 << 20 }, { 16, 64 } });
+}
+
+BENCHMARK(keydir_get)->Apply(keydir_sizes);
+BENCHMARK(keydir_put)->Apply(keydir_sizes);
+
+// ---- datafile
+
+// A data file in a temporary directory, with records of one size. The file is small enough to stay in the page cache,
+// so that the benchmark measures the read path rather than the disk.
+struct datafile_fixture final
+{
+	static constexpr auto records = std::size_t{ 4096u };
+
+	std::tuple<std::size_t, std::size_t> args;
+	std::filesystem::path                directory;
+	std::vector<keydir::info>            infos;
+	std::vector<std::size_t>             order;
+	std::unique_ptr<datafile>            df;
+
+	datafile_fixture(std::size_t key_size, std::size_t value_size)
+	    : args{ key_size, value_size }
+	    , directory{ std::filesystem::temp_directory_path() / fmt::format("bitcask_microbench.{}", ::getpid()) }
+	    , infos{}
+	    , order{ shuffled(records) }
+	    , df{}
+	{
+		std::filesystem::remove_all(this->directory);
+		std::filesystem::create_directories(this->directory);
+		this->df = std::make_unique<datafile>(
+		    file::open(this->directory / datafile::make_filename(0u), O_RDWR | O_CREAT | O_TRUNC, 0664), file_index_type{});
+
+		const auto value = make_value(value_size);
+		this->infos.reserve(records);
+		for (auto i = std::size_t{}; i < records; ++i)
+		{
+			this->infos.push_back(this->df->put(make_key(i, key_size), value, static_cast<version_type>(i + 1u)));
+		}
+	}
+
+	~datafile_fixture() noexcept
+	{
+		this->df.reset();
+		auto ec = std::error_code{};
+		std::filesystem::remove_all(this->directory, ec);
+	}
+
+	datafile_fixture(const datafile_fixture&)            = delete;
+	datafile_fixture& operator=(const datafile_fixture&) = delete;
+
+	// Arguments: key size, value size.
+	static datafile_fixture& get(benchmark::State& state)
+	{
+		static auto cached = std::unique_ptr<datafile_fixture>{};
+
+		const auto args = std::tuple{ arg(state, 0), arg(state, 1) };
+		if (!cached || cached->args != args)
+		{
+			cached.reset();
+			cached = std::make_unique<datafile_fixture>(arg(state, 0), arg(state, 1));
+		}
+		return *cached;
+	}
+};
+
+void datafile_get(benchmark::State& state)
+{
+	auto& f = datafile_fixture::get(state);
+	auto  i = std::size_t{};
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(f.df->get(f.infos[f.order[i]]));
+		i = i + 1u == f.order.size() ? 0u : i + 1u;
+	}
+	state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * arg(state, 1)));
+}
+
+BENCHMARK(datafile_get)->ArgNames({ "key", "value" })->ArgsProduct({ { 16, 64 }, { 64, 1024, 16384 } });
+
+} // namespace
+
+} // namespace microbench
+} // namespace bitcask
+
+BENCHMARK_MAIN();
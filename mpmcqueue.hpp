@@ -0,0 +1,401 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// Bounded lock-free queue for many producers and many consumers (D. Vyukov's bounded queue).
+// Each cell carries a sequence number that tells whether it is free for the producer of its position,
+// or holds an element for the consumer of its position. Producers and consumers claim positions with a CAS
+// on the tail and the head, so an uncontended push or pop is one CAS and two stores.
+// A batch claims several positions with a single CAS.
+// The blocking operations sleep on an atomic wait; a push or pop only notifies when somebody sleeps.
+// An empty cell holds no element, so T need not be default constructible.
+template<typename T>
+class mpmc_queue final
+{
+	struct alignas(64) cell final
+	{
+		std::atomic<std::size_t> sequence;
+		std::optional<T>         data;
+	};
+
+	std::unique_ptr<cell[]>                cells_;
+	std::size_t                            mask_;
+	alignas(64) std::atomic<std::size_t>   tail_;   // next position to push
+	alignas(64) std::atomic<std::size_t>   head_;   // next position to pop
+	alignas(64) std::atomic<std::uint32_t> pushed_; // bumped after a push if consumers wait
+	std::atomic<std::uint32_t>             popped_; // bumped after a pop if producers wait
+	std::atomic<std::uint32_t>             waiting_consumers_;
+	std::atomic<std::uint32_t>             waiting_producers_;
+	std::atomic<bool>                      closed_;
+
+	static std::size_t round_capacity(std::size_t capacity)
+	{
+		return std::bit_ceil(std::max(capacity, std::size_t{ 2u }));
+	}
+
+	static void signal(std::atomic<std::uint32_t>& counter, const std::atomic<std::uint32_t>& waiting, bool all)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed))
+		{
+			counter.fetch_add(1u, std::memory_order_release);
+			if (all)
+			{
+				counter.notify_all();
+			}
+			else
+			{
+				counter.notify_one();
+			}
+		}
+	}
+
+	// Sleeps until `counter` changes, unless `done` returns true first.
+	template<typename Fn>
+	static void wait(std::atomic<std::uint32_t>& counter, std::atomic<std::uint32_t>& waiting, Fn&& done)
+	{
+		waiting.fetch_add(1u, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in signal
+		const auto seen = counter.load(std::memory_order_acquire);
+		if (!done())
+		{
+			counter.wait(seen, std::memory_order_acquire);
+		}
+		waiting.fetch_sub(1u, std::memory_order_relaxed);
+	}
+
+	void store(std::size_t pos, T&& data)
+	{
+		auto& c = this->cells_[pos & this->mask_];
+		while (c.sequence.load(std::memory_order_acquire) != pos)
+		{
+			// the consumer of the previous round has claimed the cell, but is still moving the element out
+			std::this_thread::yield();
+		}
+		c.data.emplace(std::move(data));
+		c.sequence.store(pos + 1u, std::memory_order_release);
+	}
+
+	T load(std::size_t pos)
+	{
+		auto& c = this->cells_[pos & this->mask_];
+		while (c.sequence.load(std::memory_order_acquire) != pos + 1u)
+		{
+			// the producer has claimed the cell, but is still moving the element in
+			std::this_thread::yield();
+		}
+		auto result = std::move(*c.data);
+		c.data.reset();
+		c.sequence.store(pos + this->mask_ + 1u, std::memory_order_release);
+		return result;
+	}
+
+	// Claims up to `count` positions between `from` and the `until` counter, at most `limit` ahead of it.
+	static std::size_t
+	claim(std::atomic<std::size_t>& from, const std::atomic<std::size_t>& until, std::size_t limit, std::size_t count, std::size_t& pos)
+	{
+		pos = from.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const auto bound     = until.load(std::memory_order_acquire) + limit;
+			const auto available = bound > pos ? bound - pos : std::size_t{};
+			const auto n         = std::min(count, available);
+			if (n == 0u)
+			{
+				return 0u;
+			}
+			if (from.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+			{
+				return n;
+			}
+		}
+	}
+
+public:
+	/// The capacity is rounded up to a power of two.
+	explicit mpmc_queue(std::size_t capacity)
+	    : cells_{ std::make_unique<cell[]>(round_capacity(capacity)) }
+	    , mask_{ round_capacity(capacity) - 1u }
+	    , tail_{}
+	    , head_{}
+	    , pushed_{}
+	    , popped_{}
+	    , waiting_consumers_{}
+	    , waiting_producers_{}
+	    , closed_{}
+	{
+		for (auto i = std::size_t{}; i <= this->mask_; ++i)
+		{
+			this->cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	mpmc_queue(const mpmc_queue&)            = delete;
+	mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+	std::size_t capacity() const noexcept
+	{
+		return this->mask_ + 1u;
+	}
+
+	/// Approximate while other threads push or pop.
+	std::size_t size() const noexcept
+	{
+		const auto head = this->head_.load(std::memory_order_acquire);
+		const auto tail = this->tail_.load(std::memory_order_acquire);
+		return tail > head ? tail - head : 0u;
+	}
+
+	bool empty() const noexcept
+	{
+		return this->size() == 0u;
+	}
+
+	/// Wakes all blocked threads. Pushes fail from now on; pops return the elements that were pushed before,
+	/// and then fail instead of blocking.
+	void close()
+	{
+		this->closed_.store(true, std::memory_order_seq_cst);
+		this->pushed_.fetch_add(1u, std::memory_order_release);
+		this->pushed_.notify_all();
+		this->popped_.fetch_add(1u, std::memory_order_release);
+		this->popped_.notify_all();
+	}
+
+	bool closed() const noexcept
+	{
+		return this->closed_.load(std::memory_order_acquire);
+	}
+
+	/// Returns false if the queue is full or closed, `data` is then left untouched.
+	bool try_push(T&& data)
+	{
+		if (this->closed())
+		{
+			return false;
+		}
+
+		auto pos = this->tail_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const auto seq = this->cells_[pos & this->mask_].sequence.load(std::memory_order_acquire);
+			const auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+			if (dif == 0)
+			{
+				if (this->tail_.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (dif < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = this->tail_.load(std::memory_order_relaxed);
+			}
+		}
+
+		this->store(pos, std::move(data));
+		signal(this->pushed_, this->waiting_consumers_, false);
+		return true;
+	}
+
+	/// Returns nothing if the queue is empty. May also return nothing while the element at the head is still being pushed.
+	std::optional<T> try_pop()
+	{
+		auto pos = this->head_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const auto seq = this->cells_[pos & this->mask_].sequence.load(std::memory_order_acquire);
+			const auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1u);
+			if (dif == 0)
+			{
+				if (this->head_.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (dif < 0)
+			{
+				return std::nullopt;
+			}
+			else
+			{
+				pos = this->head_.load(std::memory_order_relaxed);
+			}
+		}
+
+		auto result = this->load(pos);
+		signal(this->popped_, this->waiting_producers_, false);
+		return result;
+	}
+
+	/// Blocks while the queue is full. Returns false if the queue is closed, `data` is then left untouched.
+	bool push(T&& data)
+	{
+		for (;;)
+		{
+			if (this->try_push(std::move(data)))
+			{
+				return true;
+			}
+			if (this->closed())
+			{
+				return false;
+			}
+
+			auto pushed = false;
+			this->wait(this->popped_, this->waiting_producers_, [&] {
+				return (pushed = this->try_push(std::move(data))) || this->closed();
+			});
+			if (pushed)
+			{
+				return true;
+			}
+		}
+	}
+
+	/// Blocks while the queue is empty. Returns nothing once the queue is closed and empty.
+	std::optional<T> pop()
+	{
+		for (;;)
+		{
+			auto result = this->try_pop();
+			if (result)
+			{
+				return result;
+			}
+			if (this->closed())
+			{
+				// unlike try_pop, this waits for the elements of pushes that were under way when the queue was closed
+				auto pos = std::size_t{};
+				if (claim(this->head_, this->tail_, 0u, 1u, pos) == 0u)
+				{
+					return std::nullopt;
+				}
+				result = this->load(pos);
+				signal(this->popped_, this->waiting_producers_, false);
+				return result;
+			}
+
+			this->wait(this->pushed_, this->waiting_consumers_, [&] { return (result = this->try_pop()).has_value() || this->closed(); });
+			if (result)
+			{
+				return result;
+			}
+		}
+	}
+
+	/// Moves as many elements from [first, last) as fit. Returns how many were pushed, none if the queue is closed.
+	template<typename It>
+	std::size_t try_push_batch(It first, It last)
+	{
+		if (this->closed())
+		{
+			return 0u;
+		}
+
+		auto       pos = std::size_t{};
+		const auto n   = claim(this->tail_, this->head_, this->capacity(), static_cast<std::size_t>(std::distance(first, last)), pos);
+		for (auto i = std::size_t{}; i < n; ++i, ++first)
+		{
+			this->store(pos + i, std::move(*first));
+		}
+		if (n)
+		{
+			signal(this->pushed_, this->waiting_consumers_, true);
+		}
+		return n;
+	}
+
+	/// Moves the elements of [first, last), blocking while the queue is full.
+	/// Returns how many were pushed, fewer than all of them only if the queue was closed.
+	template<typename It>
+	std::size_t push_batch(It first, It last)
+	{
+		auto pushed = std::size_t{};
+		while (first != last)
+		{
+			auto n = this->try_push_batch(first, last);
+			if (n == 0u)
+			{
+				if (this->closed())
+				{
+					return pushed;
+				}
+				this->wait(this->popped_, this->waiting_producers_, [&] {
+					return (n = this->try_push_batch(first, last)) != 0u || this->closed();
+				});
+			}
+			std::advance(first, n);
+			pushed += n;
+		}
+		return pushed;
+	}
+
+	/// Pops up to `max` elements into `out`. Returns how many were popped.
+	template<typename OutIt>
+	std::size_t try_pop_batch(OutIt out, std::size_t max)
+	{
+		auto       pos = std::size_t{};
+		const auto n   = claim(this->head_, this->tail_, 0u, max, pos);
+		for (auto i = std::size_t{}; i < n; ++i)
+		{
+			*out++ = this->load(pos + i);
+		}
+		if (n)
+		{
+			signal(this->popped_, this->waiting_producers_, true);
+		}
+		return n;
+	}
+
+	/// Blocks until at least one element is available, then pops up to `max` elements into `out`.
+	/// Returns 0 once the queue is closed and empty.
+	template<typename OutIt>
+	std::size_t pop_batch(OutIt out, std::size_t max)
+	{
+		for (;;)
+		{
+			auto n = this->try_pop_batch(out, max);
+			if (n || max == 0u)
+			{
+				return n;
+			}
+			if (this->closed())
+			{
+				// claims up to the tail, so this also takes the elements of pushes that were under way when the queue was closed
+				return this->try_pop_batch(out, max);
+			}
+
+			this->wait(this->pushed_, this->waiting_consumers_, [&] {
+				return (n = this->try_pop_batch(out, max)) != 0u || this->closed();
+			});
+			if (n)
+			{
+				return n;
+			}
+		}
+	}
+};
+
+} // namespace bitcask
@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// Bounded lock-free queue for many producers and a single consumer.
+// Each cell carries a sequence number that tells whether it is free for the producer that claimed its position,
+// or holds an element for the consumer (D. Vyukov's bounded queue). Producers claim positions with a CAS on the
+// tail; the consumer owns the head and needs no atomic read-modify-write at all.
+// An empty cell holds no element, so T need not be default constructible, and an empty queue owns no resources.
+template<typename T>
+class mpsc_queue final
+{
+	struct alignas(64) cell final
+	{
+		std::atomic<std::size_t> sequence;
+		std::optional<T>         data;
+	};
+
+	std::unique_ptr<cell[]>              cells_;
+	std::size_t                          mask_;
+	alignas(64) std::atomic<std::size_t> tail_; // next position to produce
+	alignas(64) std::size_t              head_; // next position to consume, consumer only
+
+public:
+	/// The capacity is rounded up to a power of two.
+	explicit mpsc_queue(std::size_t capacity)
+	    : cells_{ std::make_unique<cell[]>(std::bit_ceil(capacity < 2u ? std::size_t{ 2u } : capacity)) }
+	    , mask_{ std::bit_ceil(capacity < 2u ? std::size_t{ 2u } : capacity) - 1u }
+	    , tail_{}
+	    , head_{}
+	{
+		for (auto i = std::size_t{}; i <= this->mask_; ++i)
+		{
+			this->cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	mpsc_queue(const mpsc_queue&)            = delete;
+	mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+	/// Any thread. Returns false if the queue is full, `data` is then left untouched.
+	bool try_push(T&& data)
+	{
+		auto  pos = this->tail_.load(std::memory_order_relaxed);
+		cell* c   = nullptr;
+		for (;;)
+		{
+			c              = &this->cells_[pos & this->mask_];
+			const auto seq = c->sequence.load(std::memory_order_acquire);
+			const auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+			if (dif == 0)
+			{
+				if (this->tail_.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (dif < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = this->tail_.load(std::memory_order_relaxed);
+			}
+		}
+
+		c->data.emplace(std::move(data));
+		c->sequence.store(pos + 1u, std::memory_order_release);
+		return true;
+	}
+
+	/// Consumer only. Returns nothing if the queue is empty.
+	std::optional<T> try_pop()
+	{
+		auto& c = this->cells_[this->head_ & this->mask_];
+		if (c.sequence.load(std::memory_order_acquire) != this->head_ + 1u)
+		{
+			return std::nullopt;
+		}
+
+		auto result = std::move(c.data);
+		c.data.reset();
+		c.sequence.store(this->head_ + this->mask_ + 1u, std::memory_order_release);
+		++this->head_;
+		return result;
+	}
+};
+
+} // namespace bitcask
@@ -0,0 +1,84 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace bitcask {
+
+class trace_hook; // see tracing.h
+
+enum class keydir_mode
+{
+	hashed,     // hash table, fastest point lookups
+	concurrent, // hash table whose lookups take no lock, for many reader threads
+	ordered,    // search tree, supports range and prefix scans
+	compact,    // radix tree, stores common key prefixes once, supports range and prefix scans
+	hash_only,  // stores key hashes instead of keys, and reads keys from the data files to tell colliding keys apart;
+	            // an entry takes a 48 byte slot and a control byte, whatever the key length
+	mapped,     // hash table in a memory-mapped file, reused on the next open if the store was closed cleanly
+};
+
+/// Which data files bitcask::warm asks the kernel to read into the page cache.
+struct warm_policy final
+{
+	enum class selection
+	{
+		newest,    // the most recent files, where the recently written data is
+		most_read, // the files that served the most gets, counted by sampling, also before the store was reopened
+	};
+
+	selection   files{ selection::most_read };
+	std::size_t count{ 1u }; // number of files to warm
+};
+
+/// Settings that must be known when the store is opened.
+struct options final
+{
+	/// Capacity in bytes of the cache of recently read values.
+	/// Zero disables the cache.
+	std::size_t value_cache_size{ 0u };
+
+	/// Keep a Bloom filter over the keys, so that lookups of absent keys can be answered without
+	/// probing the keydir or taking its lock.
+	bool negative_lookup_filter{ false };
+
+	/// How the keydir is organized in memory.
+	keydir_mode keydir{ keydir_mode::hashed };
+
+	/// Reserve disk space for max_file_size bytes (see bitcask::max_file_size) whenever a new active file is started,
+	/// so that appends do not grow the file. The unused space is released when the file is sealed or the store is closed.
+	bool preallocate_data_files{ false };
+
+	/// Apply puts and deletes on a dedicated writer thread, which appends the requests of all threads in batches.
+	/// Raises the put throughput when many threads write. Requires a build with BITCASK_THREAD_SAFE.
+	bool writer_thread{ false };
+
+	/// Let merge read and write the data files with O_DIRECT, so that compaction does not evict the working set
+	/// from the page cache. The merged input files are dropped from the page cache either way.
+	bool direct_merge_io{ false };
+
+	/// Read values that are not found in the value cache with O_DIRECT. Use with a value cache, which then
+	/// is the only cache of values, or when the page cache is better left to other data.
+	bool direct_cold_reads{ false };
+
+	/// Record the latency of every get, put and del in histograms, see bitcask::latencies.
+	/// Costs two clock reads per operation.
+	bool record_latencies{ false };
+
+	/// Receives the phase timings of sampled gets, puts and dels, e.g. a chrome_trace_writer (see tracing.h).
+	/// Operations that are not sampled pay a thread local read per phase.
+	std::shared_ptr<trace_hook> tracer{};
+
+	/// With a tracer, one in this many operations of each thread is traced.
+	std::uint32_t trace_sample_rate{ 1000u };
+};
+
+} // namespace bitcask
@@ -0,0 +1,177 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "locktypes.hpp"
+
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// A counter that is only incremented by the thread that owns it, so the increment is a plain load and store instead of
+// an atomic read-modify-write. Other threads may read it at any time.
+class local_counter final
+{
+	std::atomic<std::uint64_t> value_{};
+
+public:
+	void add(std::uint64_t n = 1u) noexcept
+	{
+		this->value_.store(this->value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	std::uint64_t get() const noexcept
+	{
+		return this->value_.load(std::memory_order_relaxed);
+	}
+};
+
+// An instance of T for every thread that uses it, for statistics that are updated on hot paths.
+// A thread finds its own instance through a thread local cache, without a lock and without writing shared memory;
+// the instances are on separate cache lines. Readers visit all instances with for_each, so T must tolerate being
+// read while its thread updates it (e.g. relaxed atomics, or a lock of its own).
+// When a thread exits, its instance goes to the next thread that needs one, with the values it holds, so there are
+// no more instances than threads that used the object at the same time, and for_each still sees everything recorded.
+template<typename T>
+class per_thread final
+{
+	struct alignas(64) slot final
+	{
+		T value{};
+	};
+
+	// Shared with the caches of the threads that use the object, which may outlive it.
+	struct state final
+	{
+		locker            locker_{ "per_thread" };
+		std::deque<slot>  slots_{};
+		std::vector<T*>   free_{}; // instances of threads that have exited
+		std::atomic<bool> alive_{ true };
+
+		// Called when a thread that uses the instance exits.
+		void release(T* value)
+		{
+			const auto lock = this->locker_.lock();
+			(void)(lock);
+
+			if (this->alive_.load(std::memory_order_relaxed))
+			{
+				this->free_.push_back(value);
+			}
+		}
+	};
+
+	struct cache_entry final
+	{
+		std::shared_ptr<state> owner; // keeps the address from being reused while the entry exists
+		T*                     value;
+	};
+
+	struct thread_cache final
+	{
+		std::vector<cache_entry> entries{};
+
+		thread_cache() = default;
+
+		thread_cache(const thread_cache&)            = delete;
+		thread_cache& operator=(const thread_cache&) = delete;
+
+		~thread_cache() noexcept
+		{
+			for (const auto& e : this->entries)
+			{
+				e.owner->release(e.value);
+			}
+		}
+	};
+
+	std::shared_ptr<state> state_;
+
+	static std::vector<cache_entry>& cache()
+	{
+		thread_local auto c = thread_cache{};
+		return c.entries;
+	}
+
+public:
+	per_thread()
+	    : state_{ std::make_shared<state>() }
+	{
+	}
+
+	~per_thread() noexcept
+	{
+		// The caches of the threads that used the object drop their entries the next time they miss.
+		const auto lock = this->state_->locker_.lock();
+		(void)(lock);
+
+		this->state_->alive_.store(false, std::memory_order_relaxed);
+		this->state_->free_.clear();
+		this->state_->slots_.clear();
+	}
+
+	per_thread(const per_thread&)            = delete;
+	per_thread& operator=(const per_thread&) = delete;
+
+	/// The instance of the calling thread, created on first use.
+	T& local()
+	{
+		auto& entries = cache();
+		for (const auto& e : entries)
+		{
+			if (e.owner.get() == this->state_.get())
+			{
+				return *e.value;
+			}
+		}
+
+		std::erase_if(entries, [](const auto& e) { return !e.owner->alive_.load(std::memory_order_relaxed); });
+
+		const auto lock = this->state_->locker_.lock();
+		(void)(lock);
+
+		auto& free  = this->state_->free_;
+		auto  value = static_cast<T*>(nullptr);
+		if (free.empty())
+		{
+			value = &this->state_->slots_.emplace_back().value;
+		}
+		else
+		{
+			value = free.back();
+			free.pop_back();
+		}
+		entries.push_back(cache_entry{ .owner = this->state_, .value = value });
+		return *value;
+	}
+
+	template<typename Fn>
+	void for_each(Fn&& fn) const
+	{
+		const auto lock = this->state_->locker_.lock();
+		(void)(lock);
+
+		for (const auto& s : this->state_->slots_)
+		{
+			fn(s.value);
+		}
+	}
+
+	/// The number of objects in the cache of the calling thread, including those that were destroyed since it last missed.
+	static std::size_t cached()
+	{
+		return cache().size();
+	}
+};
+
+} // namespace bitcask
@@ -0,0 +1,354 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+// Compressed trie (radix tree). Every edge is labelled with a string, and a common prefix of many keys
+// is stored only once. The label is allocated inline with its node.
+// Lookups cost O(key length), independent of the number of keys. Keys are visited in lexicographical order.
+// Not thread safe. Pointers to values remain valid until the next insertion or erasure.
+template<typename Value>
+class radix_tree final
+{
+	struct node final
+	{
+		Value              value;
+		std::vector<node*> children; // sorted by the first byte of their label
+		std::uint32_t      label_size;
+		bool               has_value;
+
+		std::string_view label() const noexcept
+		{
+			return std::string_view{ reinterpret_cast<const char*>(this + 1), this->label_size };
+		}
+
+		unsigned char first() const noexcept
+		{
+			return static_cast<unsigned char>(*reinterpret_cast<const char*>(this + 1));
+		}
+	};
+
+	enum class visit_result
+	{
+		more,
+		end_reached,
+		aborted
+	};
+
+	node*       root_;
+	std::size_t size_;
+	std::size_t nodes_;
+	std::size_t label_bytes_;
+	std::size_t key_bytes_;
+
+	// Allocates a node with room for its label, but does not copy the label.
+	node* allocate_node(std::size_t label_size)
+	{
+		auto n = new (::operator new(sizeof(node) + label_size))
+		    node{ .value = Value{}, .children = {}, .label_size = static_cast<std::uint32_t>(label_size), .has_value = false };
+		++this->nodes_;
+		this->label_bytes_ += label_size;
+		return n;
+	}
+
+	node* make_node(const std::string_view& label)
+	{
+		auto n = this->allocate_node(label.size());
+		std::copy(label.begin(), label.end(), reinterpret_cast<char*>(n + 1));
+		return n;
+	}
+
+	// Frees the node, but not its children.
+	void free_node(node* n) noexcept
+	{
+		--this->nodes_;
+		this->label_bytes_ -= n->label_size;
+		n->~node();
+		::operator delete(n);
+	}
+
+	void free_tree(node* n) noexcept
+	{
+		std::for_each(n->children.begin(), n->children.end(), [this](node* child) { this->free_tree(child); });
+		this->free_node(n);
+	}
+
+	static auto child_position(node* n, unsigned char c)
+	{
+		return std::lower_bound(
+		    n->children.begin(), n->children.end(), c, [](const node* child, unsigned char value) { return child->first() < value; });
+	}
+
+	static node* find_node(node* n, std::string_view key)
+	{
+		while (!key.empty())
+		{
+			const auto c  = static_cast<unsigned char>(key.front());
+			const auto it = child_position(n, c);
+			if (it == n->children.end() || (*it)->first() != c || !key.starts_with((*it)->label()))
+			{
+				return nullptr;
+			}
+			n = *it;
+			key.remove_prefix(n->label_size);
+		}
+		return n;
+	}
+
+	// Replaces `n` by a node whose label is the concatenation of the labels of `n` and of its only child.
+	node* merge_with_child(node* n)
+	{
+		auto child = n->children.front();
+		auto label = std::string{ n->label() };
+		label.append(child->label());
+
+		auto merged       = this->make_node(label);
+		merged->value     = std::move(child->value);
+		merged->has_value = child->has_value;
+		merged->children  = std::move(child->children);
+
+		this->free_node(child);
+		this->free_node(n);
+		return merged;
+	}
+
+	template<typename Fn>
+	visit_result visit(const node* n, std::string& path, const std::string_view& begin, const std::string_view& end, Fn& fn) const
+	{
+		if (n->has_value && std::string_view{ path } >= begin)
+		{
+			if (!end.empty() && std::string_view{ path } >= end)
+			{
+				return visit_result::end_reached;
+			}
+			if (!fn(std::string_view{ path }, n->value))
+			{
+				return visit_result::aborted;
+			}
+		}
+
+		const auto length = path.size();
+		for (const auto child : n->children)
+		{
+			path.append(child->label());
+			const auto child_path = std::string_view{ path };
+
+			// Every key in the subtree of the child starts with `child_path`.
+			if (child_path < begin && !begin.starts_with(child_path))
+			{
+				path.resize(length);
+				continue;
+			}
+			if (!end.empty() && child_path >= end)
+			{
+				path.resize(length);
+				return visit_result::end_reached;
+			}
+
+			const auto result = this->visit(child, path, begin, end, fn);
+			path.resize(length);
+			if (result != visit_result::more)
+			{
+				return result;
+			}
+		}
+
+		return visit_result::more;
+	}
+
+public:
+	radix_tree()
+	    : root_{}
+	    , size_{}
+	    , nodes_{}
+	    , label_bytes_{}
+	    , key_bytes_{}
+	{
+		this->root_ = this->allocate_node(0u);
+	}
+
+	~radix_tree() noexcept
+	{
+		this->free_tree(this->root_);
+	}
+
+	radix_tree(radix_tree&&)            = delete;
+	radix_tree& operator=(radix_tree&&) = delete;
+
+	radix_tree(const radix_tree&)            = delete;
+	radix_tree& operator=(const radix_tree&) = delete;
+
+	std::size_t size() const noexcept
+	{
+		return this->size_;
+	}
+
+	/// Total length of all keys.
+	std::size_t key_bytes() const noexcept
+	{
+		return this->key_bytes_;
+	}
+
+	/// Total length of all labels, i.e. the bytes actually used to store the keys.
+	std::size_t label_bytes() const noexcept
+	{
+		return this->label_bytes_;
+	}
+
+	std::size_t memory_usage() const noexcept
+	{
+		// node, label, the pointer in the parent, and an estimated allocator overhead
+		return this->nodes_ * (sizeof(node) + sizeof(node*) + 16u) + this->label_bytes_;
+	}
+
+	const Value* find(const std::string_view& key) const
+	{
+		const auto n = find_node(this->root_, key);
+		return n && n->has_value ? &n->value : nullptr;
+	}
+
+	Value* find(const std::string_view& key)
+	{
+		const auto n = find_node(this->root_, key);
+		return n && n->has_value ? &n->value : nullptr;
+	}
+
+	/// Returns true if the key was inserted, false if the key existed.
+	bool insert_or_assign(const std::string_view& key, Value&& value)
+	{
+		auto n    = this->root_;
+		auto rest = key;
+		for (;;)
+		{
+			if (rest.empty())
+			{
+				n->value            = std::move(value);
+				const auto inserted = !n->has_value;
+				if (inserted)
+				{
+					n->has_value = true;
+					++this->size_;
+					this->key_bytes_ += key.size();
+				}
+				return inserted;
+			}
+
+			const auto c  = static_cast<unsigned char>(rest.front());
+			const auto it = child_position(n, c);
+			if (it == n->children.end() || (*it)->first() != c)
+			{
+				auto leaf       = this->make_node(rest);
+				leaf->value     = std::move(value);
+				leaf->has_value = true;
+				n->children.insert(it, leaf);
+				++this->size_;
+				this->key_bytes_ += key.size();
+				return true;
+			}
+
+			auto       child    = *it;
+			const auto label    = child->label();
+			const auto mismatch = std::mismatch(label.begin(), label.end(), rest.begin(), rest.end());
+			const auto common   = static_cast<std::size_t>(mismatch.first - label.begin());
+			if (common < label.size())
+			{
+				// Split the label of the child.
+				auto head = this->make_node(label.substr(0u, common));
+				auto tail = this->make_node(label.substr(common));
+
+				tail->value     = std::move(child->value);
+				tail->has_value = child->has_value;
+				tail->children  = std::move(child->children);
+				head->children.push_back(tail);
+
+				this->free_node(child);
+				*it   = head;
+				child = head;
+			}
+
+			n = child;
+			rest.remove_prefix(common);
+		}
+	}
+
+	/// Returns true if the key was erased, false if the key did not exist.
+	bool erase(const std::string_view& key)
+	{
+		// The node of the key, its parent and its grandparent, with their position in their parent.
+		auto path = std::vector<std::pair<node*, std::size_t>>{ { this->root_, 0u } };
+		auto rest = key;
+		while (!rest.empty())
+		{
+			const auto n  = path.back().first;
+			const auto c  = static_cast<unsigned char>(rest.front());
+			const auto it = child_position(n, c);
+			if (it == n->children.end() || (*it)->first() != c || !rest.starts_with((*it)->label()))
+			{
+				return false;
+			}
+			path.emplace_back(*it, static_cast<std::size_t>(it - n->children.begin()));
+			rest.remove_prefix((*it)->label_size);
+		}
+
+		const auto [n, index] = path.back();
+		if (!n->has_value)
+		{
+			return false;
+		}
+
+		n->value     = Value{};
+		n->has_value = false;
+		--this->size_;
+		this->key_bytes_ -= key.size();
+
+		if (n == this->root_)
+		{
+			return true;
+		}
+
+		const auto [parent, parent_index] = path[path.size() - 2u];
+		if (n->children.empty())
+		{
+			parent->children.erase(parent->children.begin() + index);
+			this->free_node(n);
+
+			if (parent != this->root_ && !parent->has_value && parent->children.size() == 1u)
+			{
+				const auto grandparent              = path[path.size() - 3u].first;
+				grandparent->children[parent_index] = this->merge_with_child(parent);
+			}
+		}
+		else if (n->children.size() == 1u)
+		{
+			parent->children[index] = this->merge_with_child(n);
+		}
+
+		return true;
+	}
+
+	/// Visits the keys in [begin, end) in key order. An empty `end` means no upper bound.
+	/// Stops and returns false as soon as the callback returns false.
+	template<typename Fn>
+	bool scan(const std::string_view& begin, const std::string_view& end, Fn&& fn) const
+	{
+		auto path = std::string{};
+		return this->visit(this->root_, path, begin, end, fn) != visit_result::aborted;
+	}
+};
+
+} // namespace bitcask
@@ -0,0 +1,160 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "file.h"
+#include "basictypes.h"
+#include "hton.h"
+#include "crc32.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <cstring>
+
+namespace bitcask {
+
+constexpr auto max_ksz          = std::numeric_limits<ksz_type>::max();
+constexpr auto deleted_value_sz = std::numeric_limits<value_sz_type>::max();
+constexpr auto max_value_sz     = deleted_value_sz - 1u;
+
+// The header of a record in a data file, followed by the key and the value. All fields are in network byte order.
+// The CRC covers the other header fields, the key and the value.
+struct record_header
+{
+	crc_type      crc;
+	version_type  version;
+	ksz_type      ksz;
+	value_sz_type value_sz;
+
+	static constexpr auto size = sizeof(crc_type) + sizeof(version_type) + sizeof(ksz_type) + sizeof(value_sz_type);
+
+	// Versions count up from 1, see keydir::next_version. A header with a larger version is garbage.
+	static constexpr auto max_plausible_version = version_type{ 1u } << 48u;
+
+	char buffer[size];
+
+	// Decodes the header from `data`, which holds `size` bytes. `crc` receives the CRC over the header fields.
+	void read(const char* data, crc_type& crc)
+	{
+		this->decode(data);
+		crc = this->header_crc();
+	}
+
+	// Decodes the header from `data`, which holds `size` bytes, without computing a CRC.
+	void decode(const char* data)
+	{
+		std::memcpy(this->buffer, data, size);
+		this->decode_fields();
+	}
+
+	// Reads the header at `position`, without computing a CRC. Returns false if there is no complete header.
+	bool read_at(const file& f, off64_t position)
+	{
+		if (f.read_at(position, this->buffer, size, file::read_mode::any) == size)
+		{
+			this->decode_fields();
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	// The CRC over the header fields, to be continued over the key and the value.
+	crc_type header_crc() const
+	{
+		return crc32_fast(this->buffer + sizeof(this->crc), size - sizeof(this->crc));
+	}
+
+	// A test that rejects most garbage without computing a CRC: could this header start a record that ends within
+	// `remaining` bytes?
+	bool plausible(off64_t remaining) const
+	{
+		return this->version != 0u && this->version < max_plausible_version && this->record_size() <= remaining;
+	}
+
+	// Preallocated space reads as zeros. A valid header is never all zeros, because its CRC covers the other fields.
+	bool is_zero() const
+	{
+		return std::all_of(std::begin(this->buffer), std::end(this->buffer), [](char c) { return c == 0; });
+	}
+
+	// Size of the record on disk.
+	off64_t record_size() const
+	{
+		return static_cast<off64_t>(size) + this->ksz + (this->value_sz == deleted_value_sz ? 0u : this->value_sz);
+	}
+
+	// Decodes the fields from the buffer.
+	void decode_fields()
+	{
+		auto src = this->buffer;
+
+		std::memcpy(&this->crc, src, sizeof(this->crc));
+		src += sizeof(this->crc);
+
+		std::memcpy(&this->version, src, sizeof(this->version));
+		src += sizeof(this->version);
+
+		std::memcpy(&this->ksz, src, sizeof(this->ksz));
+		src += sizeof(this->ksz);
+
+		std::memcpy(&this->value_sz, src, sizeof(this->value_sz));
+
+		this->crc      = ntoh(this->crc);
+		this->version  = ntoh(this->version);
+		this->ksz      = ntoh(this->ksz);
+		this->value_sz = ntoh(this->value_sz);
+	}
+
+	void init_crc()
+	{
+		const auto n_version  = hton(this->version);
+		const auto n_ksz      = hton(this->ksz);
+		const auto n_value_sz = hton(this->value_sz);
+
+		auto begin = this->buffer + sizeof(this->crc);
+		auto dst   = begin;
+
+		std::memcpy(dst, &n_version, sizeof(n_version));
+		dst += sizeof(n_version);
+
+		std::memcpy(dst, &n_ksz, sizeof(n_ksz));
+		dst += sizeof(n_ksz);
+
+		std::memcpy(dst, &n_value_sz, sizeof(n_value_sz));
+
+		this->crc = crc32_fast(begin, size - sizeof(this->crc));
+	}
+
+	// Fills the buffer with the fields in network byte order.
+	void serialize()
+	{
+		const auto n_crc      = hton(this->crc);
+		const auto n_version  = hton(this->version);
+		const auto n_ksz      = hton(this->ksz);
+		const auto n_value_sz = hton(this->value_sz);
+
+		auto dst = this->buffer;
+
+		std::memcpy(dst, &n_crc, sizeof(n_crc));
+		dst += sizeof(n_crc);
+
+		std::memcpy(dst, &n_version, sizeof(n_version));
+		dst += sizeof(n_version);
+
+		std::memcpy(dst, &n_ksz, sizeof(n_ksz));
+		dst += sizeof(n_ksz);
+
+		std::memcpy(dst, &n_value_sz, sizeof(n_value_sz));
+	}
+};
+
+} // namespace bitcask
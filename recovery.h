@@ -0,0 +1,43 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace bitcask {
+
+/// A damaged part of a data file: a record that was cut short by a crash, or whose CRC does not match.
+/// The records in the region are lost. Reading resumes at the next record with a valid CRC.
+struct damaged_region final
+{
+	std::filesystem::path path;
+	off64_t               offset;
+	off64_t               length;
+	bool                  truncated; // the region was at the end of the active file, which has been cut off before it
+};
+
+/// The damage that was found while the keydir was built on open, see bitcask::recovery.
+/// Files with a hint file are not read on open, damage in them is skipped by the merge that reads them.
+struct recovery_report final
+{
+	std::vector<damaged_region> damaged_regions{};
+
+	/// Damaged hint files. They were removed and their data files were scanned instead; no data is lost.
+	/// The hint files are written again in the background.
+	std::vector<std::filesystem::path> discarded_hint_files{};
+
+	bool clean() const noexcept
+	{
+		return this->damaged_regions.empty() && this->discarded_hint_files.empty();
+	}
+};
+
+} // namespace bitcask
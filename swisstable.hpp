@@ -0,0 +1,474 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "basictypes.h"
+
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BITCASK_SWISS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BITCASK_SWISS_NEON
+#endif
+
+namespace bitcask {
+
+namespace swiss_detail {
+
+// Control bytes. A full slot holds the low 7 bits of the hash of its key.
+constexpr auto ctrl_empty   = static_cast<std::int8_t>(-128);
+constexpr auto ctrl_deleted = static_cast<std::int8_t>(-2);
+
+constexpr auto group_size = std::size_t{ 16u };
+
+// Bit mask with one (SSE2, generic) or four (NEON) bits per slot of a group.
+class match_mask final
+{
+	std::uint64_t bits_;
+
+public:
+#if defined(BITCASK_SWISS_NEON)
+	static constexpr auto shift = 2u;
+#else
+	static constexpr auto shift = 0u;
+#endif
+
+	explicit match_mask(std::uint64_t bits) noexcept
+	    : bits_{ bits }
+	{
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return this->bits_ != 0u;
+	}
+
+	std::size_t lowest() const noexcept
+	{
+		return static_cast<std::size_t>(std::countr_zero(this->bits_)) >> shift;
+	}
+
+	/// Number of slots before the first match.
+	std::size_t leading_unmatched() const noexcept
+	{
+		return this->bits_ ? this->lowest() : group_size;
+	}
+
+	/// Number of slots after the last match.
+	std::size_t trailing_unmatched() const noexcept
+	{
+#if defined(BITCASK_SWISS_NEON)
+		return static_cast<std::size_t>(std::countl_zero(this->bits_)) >> shift;
+#else
+		return static_cast<std::size_t>(std::countl_zero(static_cast<std::uint16_t>(this->bits_)));
+#endif
+	}
+
+	void clear_lowest() noexcept
+	{
+#if defined(BITCASK_SWISS_NEON)
+		this->bits_ &= ~(std::uint64_t{ 0xf } << (this->lowest() << shift));
+#else
+		this->bits_ &= this->bits_ - 1u;
+#endif
+	}
+};
+
+// The control bytes of 16 consecutive slots, compared all at once.
+class group final
+{
+#if defined(BITCASK_SWISS_SSE2)
+	__m128i ctrl_;
+
+	match_mask to_mask(__m128i v) const noexcept
+	{
+		return match_mask{ static_cast<std::uint16_t>(_mm_movemask_epi8(v)) };
+	}
+
+public:
+	explicit group(const std::int8_t* pos) noexcept
+	    : ctrl_{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos)) }
+	{
+	}
+
+	match_mask match(std::int8_t h2) const noexcept
+	{
+		return this->to_mask(_mm_cmpeq_epi8(_mm_set1_epi8(h2), this->ctrl_));
+	}
+
+	match_mask match_empty() const noexcept
+	{
+		return this->to_mask(_mm_cmpeq_epi8(_mm_set1_epi8(ctrl_empty), this->ctrl_));
+	}
+
+	match_mask match_empty_or_deleted() const noexcept
+	{
+		return this->to_mask(_mm_cmpgt_epi8(_mm_set1_epi8(-1), this->ctrl_));
+	}
+#elif defined(BITCASK_SWISS_NEON)
+	int8x16_t ctrl_;
+
+	match_mask to_mask(uint8x16_t v) const noexcept
+	{
+		return match_mask{ vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0) };
+	}
+
+public:
+	explicit group(const std::int8_t* pos) noexcept
+	    : ctrl_{ vld1q_s8(pos) }
+	{
+	}
+
+	match_mask match(std::int8_t h2) const noexcept
+	{
+		return this->to_mask(vceqq_s8(vdupq_n_s8(h2), this->ctrl_));
+	}
+
+	match_mask match_empty() const noexcept
+	{
+		return this->to_mask(vceqq_s8(vdupq_n_s8(ctrl_empty), this->ctrl_));
+	}
+
+	match_mask match_empty_or_deleted() const noexcept
+	{
+		return this->to_mask(vcltq_s8(this->ctrl_, vdupq_n_s8(-1)));
+	}
+#else
+	std::int8_t ctrl_[group_size];
+
+	template<typename Pred>
+	match_mask to_mask(Pred&& pred) const noexcept
+	{
+		auto bits = std::uint64_t{};
+		for (auto i = std::size_t{}; i < group_size; ++i)
+		{
+			if (pred(this->ctrl_[i]))
+			{
+				bits |= std::uint64_t{ 1u } << i;
+			}
+		}
+		return match_mask{ bits };
+	}
+
+public:
+	explicit group(const std::int8_t* pos) noexcept
+	{
+		std::memcpy(this->ctrl_, pos, group_size);
+	}
+
+	match_mask match(std::int8_t h2) const noexcept
+	{
+		return this->to_mask([h2](std::int8_t c) { return c == h2; });
+	}
+
+	match_mask match_empty() const noexcept
+	{
+		return this->to_mask([](std::int8_t c) { return c == ctrl_empty; });
+	}
+
+	match_mask match_empty_or_deleted() const noexcept
+	{
+		return this->to_mask([](std::int8_t c) { return c < -1; });
+	}
+#endif
+};
+
+} // namespace swiss_detail
+
+// Open addressing hash table from key to Value in the style of Abseil's Swiss tables.
+// Every slot has a control byte holding 7 bits of the key hash; 16 control bytes are probed at once
+// with SSE2 or NEON, so a probe only touches a slot when the tag matches.
+// Each slot stores the full hash, so growing the table never hashes a key again.
+// The caller computes the hash (see hash.h), which lets other structures reuse it.
+// With an empty Key type the table stores only hashes. Several slots may then have the same hash;
+// find_if and insert let the caller tell them apart.
+// Not thread safe. Pointers to values remain valid until the next insertion.
+template<typename Value, typename Key = key_type>
+class swiss_table final
+{
+public:
+	struct slot final
+	{
+		std::uint64_t             hash;
+		[[no_unique_address]] Key key;
+		Value                     value;
+	};
+
+private:
+	using group = swiss_detail::group;
+
+	static constexpr auto group_size   = swiss_detail::group_size;
+	static constexpr auto min_capacity = std::size_t{ 16u };
+
+	std::size_t                    capacity_;    // power of 2
+	std::size_t                    size_;
+	std::size_t                    growth_left_; // insertions into empty slots before the load factor exceeds 7/8
+	std::unique_ptr<std::int8_t[]> ctrl_;        // capacity_ + group_size; the tail mirrors the first group
+	std::unique_ptr<slot[]>        slots_;
+
+	static std::int8_t h2(std::uint64_t hash) noexcept
+	{
+		return static_cast<std::int8_t>(hash & 0x7fu);
+	}
+
+	static std::size_t max_load(std::size_t capacity) noexcept
+	{
+		return capacity - capacity / 8u;
+	}
+
+	void set_ctrl(std::size_t i, std::int8_t c) noexcept
+	{
+		this->ctrl_[i] = c;
+		if (i < group_size)
+		{
+			this->ctrl_[this->capacity_ + i] = c;
+		}
+	}
+
+	// Calls `fn(index)` for every slot in the probe sequence of `hash`, group by group, until it returns true
+	// or a group with an empty slot has been probed.
+	template<typename Fn>
+	bool probe(std::uint64_t hash, Fn&& fn) const
+	{
+		const auto mask   = this->capacity_ - 1u;
+		auto       offset = static_cast<std::size_t>(hash >> 7) & mask;
+		for (auto step = group_size;; step += group_size)
+		{
+			const auto g = group{ this->ctrl_.get() + offset };
+			for (auto m = g.match(h2(hash)); m; m.clear_lowest())
+			{
+				const auto index = (offset + m.lowest()) & mask;
+				if (fn(index))
+				{
+					return true;
+				}
+			}
+			if (g.match_empty())
+			{
+				return false;
+			}
+			offset = (offset + step) & mask;
+		}
+	}
+
+	std::size_t find_insert_slot(std::uint64_t hash) const noexcept
+	{
+		const auto mask   = this->capacity_ - 1u;
+		auto       offset = static_cast<std::size_t>(hash >> 7) & mask;
+		for (auto step = group_size;; step += group_size)
+		{
+			const auto m = group{ this->ctrl_.get() + offset }.match_empty_or_deleted();
+			if (m)
+			{
+				return (offset + m.lowest()) & mask;
+			}
+			offset = (offset + step) & mask;
+		}
+	}
+
+	void resize(std::size_t capacity)
+	{
+		auto old_capacity = this->capacity_;
+		auto old_ctrl     = std::move(this->ctrl_);
+		auto old_slots    = std::move(this->slots_);
+
+		this->capacity_ = capacity;
+		this->ctrl_     = std::make_unique<std::int8_t[]>(capacity + group_size);
+		this->slots_    = std::make_unique<slot[]>(capacity);
+		std::fill_n(this->ctrl_.get(), capacity + group_size, swiss_detail::ctrl_empty);
+		this->growth_left_ = max_load(capacity) - this->size_;
+
+		for (auto i = std::size_t{}; i < old_capacity; ++i)
+		{
+			if (old_ctrl[i] >= 0)
+			{
+				auto&      s     = old_slots[i];
+				const auto index = this->find_insert_slot(s.hash);
+				this->set_ctrl(index, h2(s.hash));
+				this->slots_[index] = std::move(s);
+			}
+		}
+	}
+
+	void reserve_one()
+	{
+		if (this->growth_left_ == 0u)
+		{
+			// Many deleted slots: rehash in place. Otherwise: grow.
+			this->resize(this->size_ < max_load(this->capacity_) / 2u ? this->capacity_ : this->capacity_ * 2u);
+		}
+	}
+
+public:
+	swiss_table()
+	    : capacity_{}
+	    , size_{}
+	    , growth_left_{}
+	    , ctrl_{}
+	    , slots_{}
+	{
+		this->resize(min_capacity);
+	}
+
+	swiss_table(swiss_table&&)            = default;
+	swiss_table& operator=(swiss_table&&) = default;
+
+	swiss_table(const swiss_table&)            = delete;
+	swiss_table& operator=(const swiss_table&) = delete;
+
+	std::size_t size() const noexcept
+	{
+		return this->size_;
+	}
+
+	bool empty() const noexcept
+	{
+		return this->size_ == 0u;
+	}
+
+	std::size_t capacity() const noexcept
+	{
+		return this->capacity_;
+	}
+
+	/// Returns the first slot with this hash for which `pred(slot)` returns true.
+	template<typename Pred>
+	const slot* find_if(std::uint64_t hash, Pred&& pred) const
+	{
+		auto result = static_cast<const slot*>(nullptr);
+		this->probe(hash, [&](std::size_t index) {
+			const auto& s = this->slots_[index];
+			if (s.hash == hash && pred(s))
+			{
+				result = &s;
+				return true;
+			}
+			return false;
+		});
+		return result;
+	}
+
+	template<typename Pred>
+	slot* find_if(std::uint64_t hash, Pred&& pred)
+	{
+		return const_cast<slot*>(std::as_const(*this).find_if(hash, std::forward<Pred>(pred)));
+	}
+
+	const slot* find(const std::string_view& key, std::uint64_t hash) const
+	{
+		return this->find_if(hash, [&](const slot& s) { return s.key == key; });
+	}
+
+	slot* find(const std::string_view& key, std::uint64_t hash)
+	{
+		return const_cast<slot*>(std::as_const(*this).find(key, hash));
+	}
+
+	/// Inserts a new slot without looking for an existing one.
+	slot* insert(std::uint64_t hash, Key&& key, Value&& value)
+	{
+		this->reserve_one();
+
+		const auto index = this->find_insert_slot(hash);
+		if (this->ctrl_[index] == swiss_detail::ctrl_empty)
+		{
+			--this->growth_left_;
+		}
+		this->set_ctrl(index, h2(hash));
+		this->slots_[index] = slot{ .hash = hash, .key = std::move(key), .value = std::move(value) };
+		++this->size_;
+		return &this->slots_[index];
+	}
+
+	/// Returns true if the key was inserted, false if the key existed.
+	bool insert_or_assign(const std::string_view& key, std::uint64_t hash, Value&& value)
+	{
+		auto existing = this->find(key, hash);
+		if (existing)
+		{
+			existing->value = std::move(value);
+			return false;
+		}
+
+		this->insert(hash, Key{ key }, std::move(value));
+		return true;
+	}
+
+	/// Returns true if the key was erased, false if the key did not exist.
+	bool erase(const std::string_view& key, std::uint64_t hash)
+	{
+		auto s = this->find(key, hash);
+		if (!s)
+		{
+			return false;
+		}
+
+		this->erase(s);
+		return true;
+	}
+
+	void erase(slot* s)
+	{
+		const auto index = static_cast<std::size_t>(s - this->slots_.get());
+		*s               = slot{};
+
+		// The slot can become empty again if no window of 16 slots around it has ever been full,
+		// because then no probe sequence has ever continued past it.
+		const auto mask         = this->capacity_ - 1u;
+		const auto before       = (index - group_size) & mask;
+		const auto empty_after  = group{ this->ctrl_.get() + index }.match_empty();
+		const auto empty_before = group{ this->ctrl_.get() + before }.match_empty();
+		if (empty_before && empty_after && empty_after.leading_unmatched() + empty_before.trailing_unmatched() < group_size)
+		{
+			this->set_ctrl(index, swiss_detail::ctrl_empty);
+			++this->growth_left_;
+		}
+		else
+		{
+			this->set_ctrl(index, swiss_detail::ctrl_deleted);
+		}
+
+		--this->size_;
+	}
+
+	void clear()
+	{
+		this->size_ = 0u;
+		this->resize(min_capacity);
+	}
+
+	/// Stops and returns false as soon as the callback returns false.
+	template<typename Fn>
+	bool traverse(Fn&& fn) const
+	{
+		for (auto i = std::size_t{}; i < this->capacity_; ++i)
+		{
+			if (this->ctrl_[i] >= 0 && !fn(this->slots_[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::size_t memory_usage() const noexcept
+	{
+		return this->capacity_ * (sizeof(slot) + 1u) + group_size;
+	}
+};
+
+} // namespace bitcask
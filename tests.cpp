@@ -0,0 +1,1076 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Tests of the store and of its containers. Runs the test that is named on the command line, or all of them.
+
+#include "bitcask.h"
+#include "datafile.h"
+#include "epoch.hpp"
+#include "keydir.h"
+#include "mpmcqueue.hpp"
+#include "perthread.hpp"
+#include "recordheader.h"
+#include "config.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <latch>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <source_location>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace bitcask::tests {
+
+namespace {
+
+void check(bool condition, std::string_view what, const std::source_location& location = std::source_location::current())
+{
+	if (!condition)
+	{
+		throw std::runtime_error{ fmt::format("{}:{}: check failed: {}", location.file_name(), location.line(), what) };
+	}
+}
+
+// An empty directory for the store of a test
+fs::path make_directory(std::string_view test)
+{
+	const auto directory = fs::temp_directory_path() / "bitcask_tests" / test;
+	fs::remove_all(directory);
+	fs::create_directories(directory);
+	return directory;
+}
+
+std::vector<fs::path> data_files(const fs::path& directory)
+{
+	auto result = std::vector<fs::path>{};
+	for (const auto& entry : fs::directory_iterator{ directory })
+	{
+		if (entry.path().extension() == ".data")
+		{
+			result.push_back(entry.path());
+		}
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+void overwrite(const fs::path& path, off64_t offset, const std::string_view& data)
+{
+	auto f = std::fstream{ path, std::ios::in | std::ios::out | std::ios::binary };
+	f.seekp(offset);
+	f.write(data.data(), static_cast<std::streamsize>(data.size()));
+	check(f.good(), "overwrite");
+}
+
+std::string random_bytes(std::mt19937_64& rng, std::size_t count)
+{
+	auto result = std::string(count, '\0');
+	for (auto& c : result)
+	{
+		c = static_cast<char>(rng());
+	}
+	return result;
+}
+
+// Garbage that looks like records: a header every 64 bytes, with a plausible version and a body of about 1 MB.
+// The bodies do not match the CRCs, and each one ends in the random bytes between two headers.
+std::string fake_records(std::mt19937_64& rng, std::size_t count)
+{
+	constexpr auto period = std::size_t{ 64u };
+
+	auto result = random_bytes(rng, count);
+	for (auto i = std::size_t{}; i + record_header::size <= count; i += period)
+	{
+		auto header     = record_header{};
+		header.crc      = static_cast<crc_type>(rng());
+		header.version  = (version_type{ 1u } << 47u) | (rng() >> 17u);
+		header.ksz      = 16u;
+		header.value_sz = (1u << 20u) + 60u; // the record size is 32 modulo the period
+		header.serialize();
+		std::copy(std::begin(header.buffer), std::end(header.buffer), result.begin() + static_cast<std::ptrdiff_t>(i));
+	}
+	return result;
+}
+
+std::string key_of(std::size_t number)
+{
+	return fmt::format("key{:08}", number);
+}
+
+// A damaged region in the middle of a large data file, full of plausible headers, is skipped in linear time.
+void resync_large_damaged_file()
+{
+	const auto directory = make_directory("resync_large_damaged_file");
+
+	constexpr auto data_size  = off64_t{ 16 } * 1024 * 1024;
+	constexpr auto value_size = std::size_t{ 1000u };
+
+	auto rng   = std::mt19937_64{ 42u };
+	auto count = std::size_t{};
+	{
+		auto db = bitcask{ directory };
+		for (auto size = off64_t{}; size < data_size; size += static_cast<off64_t>(record_header::size + key_of(0).size() + value_size))
+		{
+			db.put(key_of(count++), random_bytes(rng, value_size));
+		}
+	}
+
+	const auto files = data_files(directory);
+	check(files.size() == 1u, "one data file");
+
+	const auto damage_offset = data_size / 4;
+	const auto damage_length = data_size / 2;
+	overwrite(files.front(), damage_offset, fake_records(rng, static_cast<std::size_t>(damage_length)));
+
+	const auto start   = std::chrono::steady_clock::now();
+	auto       db      = bitcask{ directory };
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+
+	const auto report = db.recovery();
+	check(report.damaged_regions.size() == 1u, "one damaged region");
+	check(report.damaged_regions.front().offset <= damage_offset, "the region starts at the damage");
+	check(report.damaged_regions.front().offset + report.damaged_regions.front().length >= damage_offset + damage_length,
+	      "the region covers the damage");
+	check(db.get(key_of(0)).has_value(), "the first key is recovered");
+	check(db.get(key_of(count - 1u)).has_value(), "the last key is recovered");
+	check(db.metrics().keydir.keys >= count / 2u - 2u, "the keys outside the damage are recovered");
+	check(elapsed < std::chrono::seconds{ 10 }, "recovery time");
+}
+
+// Values that end with a zero byte, so that the data files do too
+std::string zero_terminated_value(std::mt19937_64& rng)
+{
+	return random_bytes(rng, 99u).append(1u, '\0');
+}
+
+constexpr auto zero_terminated_record_size = static_cast<off64_t>(record_header::size + 11u + 100u);
+
+// Overwrites the key size of the record with the given number, in a file of zero terminated records
+void damage_header(const fs::path& path, off64_t record)
+{
+	overwrite(path, record * zero_terminated_record_size + 12, std::string(4u, '\xff'));
+}
+
+std::vector<std::uintmax_t> file_sizes(const std::vector<fs::path>& files)
+{
+	auto result = std::vector<std::uintmax_t>{};
+	std::transform(files.begin(), files.end(), std::back_inserter(result), [](const auto& path) { return fs::file_size(path); });
+	return result;
+}
+
+// Files that were never preallocated keep all of their data, also when it ends with zeros and a header before is damaged.
+void zero_terminated_data_is_not_trimmed()
+{
+	const auto directory = make_directory("zero_terminated_data_is_not_trimmed");
+
+	constexpr auto count = std::size_t{ 300u };
+
+	auto rng = std::mt19937_64{ 1u };
+	{
+		auto db = bitcask{ directory };
+		db.max_file_size(100 * zero_terminated_record_size);
+		for (auto i = std::size_t{}; i < count; ++i)
+		{
+			db.put(key_of(i), zero_terminated_value(rng));
+		}
+	}
+
+	const auto files = data_files(directory);
+	check(files.size() == 3u, "three data files");
+	damage_header(files.front(), 50);
+
+	const auto sizes = file_sizes(files);
+	for (auto open = 0; open < 2; ++open)
+	{
+		auto db = bitcask{ directory };
+
+		const auto report = db.recovery();
+		check(report.damaged_regions.size() == 1u, "one damaged region");
+		check(report.damaged_regions.front().path == files.front(), "the damage is in the first file");
+		check(report.damaged_regions.front().offset == 50 * zero_terminated_record_size, "the region starts at the damage");
+		check(report.damaged_regions.front().length == zero_terminated_record_size, "the region is the damaged record");
+		check(!report.damaged_regions.front().truncated, "a sealed file is not truncated");
+		for (auto i = std::size_t{}; i < count; ++i)
+		{
+			check(db.get(key_of(i)).has_value() == (i != 50u), "the records that are not damaged are found");
+		}
+	}
+	check(file_sizes(files) == sizes, "the files are not trimmed");
+}
+
+// The preallocated space is released when the store is closed, and the marker is removed.
+void preallocated_files_are_trimmed()
+{
+	const auto directory = make_directory("preallocated_files_are_trimmed");
+
+	constexpr auto count = std::size_t{ 300u };
+
+	auto rng  = std::mt19937_64{ 2u };
+	auto opts = options{};
+
+	opts.preallocate_data_files = true;
+	{
+		auto db = bitcask{ directory, opts };
+		db.max_file_size(100 * zero_terminated_record_size);
+		for (auto i = std::size_t{}; i < count; ++i)
+		{
+			db.put(key_of(i), zero_terminated_value(rng));
+		}
+	}
+
+	const auto files = data_files(directory);
+	check(files.size() == 3u, "three data files");
+	for (const auto& path : files)
+	{
+		check(!fs::exists(datafile::preallocated_path(path)), "the marker is removed");
+		check(fs::file_size(path) % static_cast<std::uintmax_t>(zero_terminated_record_size) == 0u, "the file is trimmed");
+	}
+
+	auto db = bitcask{ directory, opts };
+	check(db.recovery().clean(), "clean recovery");
+	check(db.metrics().keydir.keys == count, "all keys are found");
+}
+
+// After a crash, the data of a marked file ends at the zeros, and damage before them is reported.
+void preallocated_file_after_crash()
+{
+	const auto directory = make_directory("preallocated_file_after_crash");
+
+	constexpr auto count = std::size_t{ 100u };
+
+	auto rng = std::mt19937_64{ 3u };
+	{
+		auto db = bitcask{ directory };
+		for (auto i = std::size_t{}; i < count; ++i)
+		{
+			db.put(key_of(i), zero_terminated_value(rng));
+		}
+	}
+
+	// what a crash leaves of a preallocated active file
+	const auto files = data_files(directory);
+	check(files.size() == 1u, "one data file");
+	std::ofstream{ datafile::preallocated_path(files.front()) };
+	fs::resize_file(files.front(), fs::file_size(files.front()) + 1024u * 1024u);
+	{
+		auto db = bitcask{ directory };
+		check(db.recovery().clean(), "clean recovery");
+		check(db.metrics().keydir.keys == count, "all keys are found");
+		db.put(key_of(count), zero_terminated_value(rng));
+	}
+
+	damage_header(files.front(), 50);
+	{
+		auto db = bitcask{ directory };
+
+		const auto report = db.recovery();
+		check(report.damaged_regions.size() == 1u, "one damaged region");
+		check(report.damaged_regions.front().offset == 50 * zero_terminated_record_size, "the region starts at the damage");
+		check(report.damaged_regions.front().length == zero_terminated_record_size, "the region is the damaged record");
+		check(!report.damaged_regions.front().truncated, "the region is not a torn append");
+		for (auto i = std::size_t{}; i <= count; ++i)
+		{
+			check(db.get(key_of(i)).has_value() == (i != 50u), "the records that are not damaged are found");
+		}
+	}
+}
+
+// Keys of up to 12 bytes of zeros, 0xff, 'a' and 'b', so that they share prefixes and contain the extreme byte values
+std::vector<std::string> make_keys(std::mt19937_64& rng, std::size_t count)
+{
+	constexpr auto alphabet = std::string_view{ "\0\xff" "ab", 4u };
+
+	auto keys = std::set<std::string>{};
+	while (keys.size() < count)
+	{
+		auto key = std::string(1u + rng() % 12u, '\0');
+		for (auto& c : key)
+		{
+			c = alphabet[rng() % alphabet.size()];
+		}
+		keys.insert(std::move(key));
+	}
+
+	auto result = std::vector<std::string>{ keys.begin(), keys.end() };
+	std::shuffle(result.begin(), result.end(), rng);
+	return result;
+}
+
+bool same(const keydir_info& a, const keydir_info& b)
+{
+	return a.file_id == b.file_id && a.file_index == b.file_index && a.value_sz == b.value_sz && a.ksz == b.ksz
+	       && a.value_pos == b.value_pos && a.version == b.version;
+}
+
+using reference_keydir = std::map<std::string, keydir_info>;
+
+template<typename A, typename B>
+bool same_entries(const A& a, const B& b)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto& x, const auto& y) {
+		return x.first == y.first && same(x.second, y.second);
+	});
+}
+
+// The value position of an entry is the number of its key, so that keydir_mode::hash_only can read the key back.
+keydir_info make_info(const std::vector<std::string>& keys, std::size_t number, version_type version)
+{
+	return keydir_info{ .file_id    = version % 7u,
+		                .file_index = static_cast<file_index_type>(version % 5u),
+		                .value_sz   = static_cast<value_sz_type>(version % 1000u),
+		                .ksz        = static_cast<ksz_type>(keys[number].size()),
+		                .value_pos  = static_cast<value_pos_type>(number),
+		                .version    = version };
+}
+
+keydir_context make_context(const std::vector<std::string>& keys, const fs::path& directory, std::uint64_t fingerprint)
+{
+	return keydir_context{ .directory   = directory,
+		                   .fingerprint = fingerprint,
+		                   .read_key    = [&keys](const keydir_info& info) { return keys[static_cast<std::size_t>(info.value_pos)]; } };
+}
+
+void check_contents(keydir& kd, const reference_keydir& ref, bool ordered, std::mt19937_64& rng)
+{
+	auto visited = reference_keydir{};
+	kd.traverse([&](const std::string_view& key, const keydir_info& info) {
+		check(visited.emplace(std::string{ key }, info).second, "traverse visits each key once");
+		return true;
+	});
+	check(same_entries(visited, ref), "traverse visits the entries of the reference");
+	check(kd.statistics().keys == ref.size(), "the number of keys");
+	check(kd.empty() == ref.empty(), "empty");
+
+	if (!ordered)
+	{
+		return;
+	}
+
+	const auto random_key = [&] {
+		auto it = ref.begin();
+		std::advance(it, static_cast<std::ptrdiff_t>(rng() % (ref.size() + 1u)));
+		if (it == ref.end())
+		{
+			return std::string(13u, '\xff'); // after every key
+		}
+		return it->first.substr(0, 1u + rng() % it->first.size());
+	};
+
+	for (auto i = 0; i < 20; ++i)
+	{
+		auto begin = i == 0 ? std::string{} : random_key();
+		auto end   = i == 1 ? std::string{} : random_key();
+		if (!end.empty() && end < begin)
+		{
+			std::swap(begin, end);
+		}
+
+		auto expected = std::vector<std::pair<std::string, keydir_info>>{};
+		for (auto it = ref.lower_bound(begin); it != ref.end() && (end.empty() || it->first < end); ++it)
+		{
+			expected.emplace_back(*it);
+		}
+
+		auto scanned = std::vector<std::pair<std::string, keydir_info>>{};
+		kd.scan(begin, end, [&](const std::string_view& key, const keydir_info& info) {
+			scanned.emplace_back(std::string{ key }, info);
+			return true;
+		});
+		check(same_entries(scanned, expected), "scan visits the entries of the reference in [begin, end), in key order");
+
+		auto stopped = std::size_t{};
+		kd.scan(begin, end, [&](const std::string_view&, const keydir_info&) { return ++stopped < 3u; });
+		check(stopped == std::min(expected.size(), std::size_t{ 3u }), "scan stops when the callback returns false");
+	}
+}
+
+// Runs puts, deletes, replaces and gets against a keydir and a std::map, growing the keydir well past its first rehashes.
+void check_keydir_mode(keydir_mode mode, std::uint64_t seed)
+{
+	const auto directory = make_directory(fmt::format("keydir_mode_{}", static_cast<int>(mode)));
+	const auto ordered   = mode == keydir_mode::ordered || mode == keydir_mode::compact;
+
+	auto rng  = std::mt19937_64{ seed };
+	auto keys = make_keys(rng, 30000u);
+	auto opts = options{};
+	auto ref  = reference_keydir{};
+
+	opts.keydir = mode;
+
+	auto kd      = keydir{ opts, make_context(keys, directory, 1u) };
+	auto version = version_type{};
+	auto highest = version_type{}; // of the puts, replace keeps the version of a merged record
+
+	for (auto number = std::size_t{}; number < keys.size(); ++number)
+	{
+		auto info = make_info(keys, number, highest = ++version);
+		check(kd.put(keys[number], keydir_info{ info }) == ref.insert_or_assign(keys[number], info).second, "put of a new key");
+	}
+	check_contents(kd, ref, ordered, rng);
+
+	for (auto op = 0; op < 150000; ++op)
+	{
+		const auto  number = static_cast<std::size_t>(rng() % keys.size());
+		const auto& key    = keys[number];
+		const auto  it     = ref.find(key);
+		switch (rng() % 8u)
+		{
+		case 0:
+		case 1:
+		case 2:
+		{
+			auto info = make_info(keys, number, highest = ++version);
+			check(kd.put(key, keydir_info{ info }) == (it == ref.end()), "put returns whether the key is new");
+			ref.insert_or_assign(key, info);
+			break;
+		}
+		case 3:
+		case 4:
+			check(kd.del(key) == (it != ref.end()), "del returns whether the key existed");
+			if (it != ref.end())
+			{
+				ref.erase(it);
+			}
+			break;
+		case 5:
+		{
+			const auto expected = it != ref.end() && rng() % 2u == 0u ? it->second.version : version + 1u;
+			auto       info     = make_info(keys, number, ++version);
+			const auto replaced = kd.replace(key, expected, keydir_info{ info });
+			check(replaced == (it != ref.end() && it->second.version == expected), "replace checks the version");
+			if (replaced)
+			{
+				it->second = info;
+			}
+			break;
+		}
+		default:
+		{
+			const auto info = kd.get(key);
+			check(info.has_value() == (it != ref.end()), "get finds the keys of the reference");
+			check(!info || same(*info, it->second), "get returns the entry of the reference");
+			check(kd.may_contain(key) || it == ref.end(), "may_contain");
+			break;
+		}
+		}
+
+		if (op % 30000 == 0)
+		{
+			check_contents(kd, ref, ordered, rng);
+		}
+	}
+	check_contents(kd, ref, ordered, rng);
+	check(kd.next_version() == highest + 1u, "the next version follows the highest version put");
+}
+
+void keydir_hashed()
+{
+	check_keydir_mode(keydir_mode::hashed, 11u);
+}
+
+void keydir_concurrent()
+{
+	check_keydir_mode(keydir_mode::concurrent, 12u);
+}
+
+void keydir_ordered()
+{
+	check_keydir_mode(keydir_mode::ordered, 13u);
+}
+
+void keydir_compact()
+{
+	check_keydir_mode(keydir_mode::compact, 14u);
+}
+
+void keydir_hash_only()
+{
+	check_keydir_mode(keydir_mode::hash_only, 15u);
+}
+
+void keydir_mapped()
+{
+	check_keydir_mode(keydir_mode::mapped, 16u);
+}
+
+// Readers look up keys without a lock while one writer inserts, overwrites and deletes them, growing the table.
+// A reader must always see a complete entry of the key it looked up.
+void keydir_concurrent_readers()
+{
+	const auto directory = make_directory("keydir_concurrent_readers");
+
+	auto rng  = std::mt19937_64{ 17u };
+	auto keys = make_keys(rng, 50000u);
+	auto opts = options{};
+
+	opts.keydir = keydir_mode::concurrent;
+
+	auto kd        = keydir{ opts, make_context(keys, directory, 1u) };
+	auto done      = std::atomic<bool>{};
+	auto published = std::atomic<version_type>{}; // versions up to this one have been put
+
+	auto failures = std::atomic<std::size_t>{};
+	auto lookups  = std::atomic<std::size_t>{};
+	auto readers  = std::vector<std::thread>{};
+	for (auto r = 0u; r < 3u; ++r)
+	{
+		readers.emplace_back([&, r] {
+			auto reader_rng = std::mt19937_64{ r };
+			auto n          = std::size_t{};
+			while (!done.load(std::memory_order_acquire))
+			{
+				const auto number = static_cast<std::size_t>(reader_rng() % keys.size());
+				const auto info   = kd.get(keys[number]);
+				const auto latest = published.load(std::memory_order_acquire);
+				if (info && (info->version > latest + 1u || !same(*info, make_info(keys, number, info->version))))
+				{
+					failures.fetch_add(1u, std::memory_order_relaxed);
+				}
+				++n;
+			}
+			lookups.fetch_add(n, std::memory_order_relaxed);
+		});
+	}
+
+	auto ref     = reference_keydir{};
+	auto version = version_type{};
+	for (auto round = 0; round < 3; ++round)
+	{
+		for (auto number = std::size_t{}; number < keys.size(); ++number)
+		{
+			const auto info = make_info(keys, number, ++version);
+			kd.put(keys[number], keydir_info{ info });
+			ref.insert_or_assign(keys[number], info);
+			published.store(version, std::memory_order_release);
+
+			if (number % 3u == 0u)
+			{
+				const auto victim = static_cast<std::size_t>(rng() % keys.size());
+				kd.del(keys[victim]);
+				ref.erase(keys[victim]);
+			}
+		}
+	}
+
+	done.store(true, std::memory_order_release);
+	std::for_each(readers.begin(), readers.end(), [](auto& t) { t.join(); });
+
+	check(failures.load() == 0u, "the readers see complete entries");
+	check(lookups.load() > 0u, "the readers ran");
+	check_contents(kd, ref, false, rng);
+}
+
+// A mapped keydir is reused only if it was persisted, and with the fingerprint of the data files it is opened with.
+void keydir_mapped_reopen()
+{
+	const auto directory = make_directory("keydir_mapped_reopen");
+
+	auto rng  = std::mt19937_64{ 18u };
+	auto keys = make_keys(rng, 20000u);
+	auto opts = options{};
+	auto ref  = reference_keydir{};
+
+	opts.keydir = keydir_mode::mapped;
+
+	const auto fill = [&](keydir& kd) {
+		ref.clear();
+		for (auto number = std::size_t{}; number < keys.size(); ++number)
+		{
+			const auto info = make_info(keys, number, kd.next_version());
+			kd.put(keys[number], keydir_info{ info });
+			ref.insert_or_assign(keys[number], info);
+		}
+	};
+
+	{
+		auto kd = keydir{ opts, make_context(keys, directory, 1u) };
+		check(!kd.restored(), "a new keydir is not restored");
+		fill(kd);
+		kd.persist(1u);
+	}
+	{
+		auto kd = keydir{ opts, make_context(keys, directory, 1u) };
+		check(kd.restored(), "a persisted keydir is restored");
+		check_contents(kd, ref, false, rng);
+		check(kd.next_version() == keys.size() + 1u, "the versions continue after the restored ones");
+		// closed without persist, as by a crash: the dirty flag stays set
+	}
+	{
+		auto kd = keydir{ opts, make_context(keys, directory, 1u) };
+		check(!kd.restored(), "a keydir that was not persisted after its last open is not restored");
+		check_contents(kd, reference_keydir{}, false, rng);
+		fill(kd);
+		kd.persist(1u);
+	}
+	{
+		auto kd = keydir{ opts, make_context(keys, directory, 2u) };
+		check(!kd.restored(), "a keydir of other data files is not restored");
+		check_contents(kd, reference_keydir{}, false, rng);
+	}
+}
+
+// Open descriptors of files that have been removed
+std::size_t removed_files_open()
+{
+	auto result = std::size_t{};
+	for (const auto& entry : fs::directory_iterator{ "/proc/self/fd" })
+	{
+		auto ec = std::error_code{};
+		if (fs::read_symlink(entry.path(), ec).string().ends_with(" (deleted)"))
+		{
+			++result;
+		}
+	}
+	return result;
+}
+
+// Retired Bloom filters and data files are freed as soon as no reader uses them, not once 64 objects are pending,
+// and a closed store leaves nothing in the epoch domain.
+void epoch_retired_objects_are_freed()
+{
+	const auto directory = make_directory("epoch_retired_objects_are_freed");
+
+	auto& domain = epoch_domain::instance();
+	auto  rng    = std::mt19937_64{ 19u };
+	auto  opts   = options{};
+
+	opts.negative_lookup_filter = true;
+	{
+		// the filter is rebuilt every 513 deletes
+		auto db = bitcask{ directory, opts };
+		for (auto i = std::size_t{}; i < 1000u; ++i)
+		{
+			db.put(key_of(i), random_bytes(rng, 10u));
+		}
+		domain.collect();
+		for (auto i = std::size_t{}; i < 3000u; ++i)
+		{
+			db.del(key_of(i % 1000u));
+			check(domain.pending() == 0u, "a rebuilt filter is freed at once");
+			db.put(key_of(i % 1000u), random_bytes(rng, 10u));
+		}
+	}
+
+	opts.keydir = keydir_mode::concurrent;
+	{
+		const auto removed = removed_files_open();
+
+		auto db = bitcask{ directory, opts };
+		db.max_file_size(100000);
+		for (auto round = 0; round < 3; ++round)
+		{
+			for (auto i = std::size_t{}; i < 2000u; ++i)
+			{
+				db.put(key_of(i), random_bytes(rng, 100u));
+			}
+		}
+		check(data_files(directory).size() > 3u, "several data files");
+
+		db.merge();
+		check(removed_files_open() == removed, "the merged files are closed");
+
+		// an overwrite retires the old node of the key
+		for (auto i = std::size_t{}; i < 10u; ++i)
+		{
+			db.put(key_of(i), random_bytes(rng, 100u));
+		}
+		check(domain.pending() > 0u, "overwritten nodes are pending");
+	}
+	check(domain.pending() == 0u, "a closed store leaves nothing behind");
+}
+
+// A mapped keydir that is restored after a merge has the file indexes of the previous open. They are corrected,
+// so that reads find their files without the datadir lock.
+void mapped_keydir_after_merge()
+{
+	const auto directory = make_directory("mapped_keydir_after_merge");
+
+	constexpr auto count = std::size_t{ 2000u };
+
+	auto rng    = std::mt19937_64{ 20u };
+	auto opts   = options{};
+	auto values = std::vector<std::string>(count);
+
+	opts.keydir = keydir_mode::mapped;
+	{
+		auto db = bitcask{ directory, opts };
+		db.max_file_size(50000);
+		for (auto round = 0; round < 3; ++round)
+		{
+			for (auto i = std::size_t{}; i < count; ++i)
+			{
+				values[i] = random_bytes(rng, 50u);
+				db.put(key_of(i), values[i]);
+			}
+		}
+		db.merge();
+	}
+
+	auto db = bitcask{ directory, opts };
+	check(db.recovery().clean(), "clean recovery");
+	for (auto i = std::size_t{}; i < count; ++i)
+	{
+		const auto value = db.get(key_of(i));
+		check(value && *value == values[i], "the values are found");
+	}
+	check(db.metrics().data.locked_file_lookups == 0u, "the files are found without the lock");
+}
+
+// Puts and deletes of several threads, applied in batches by the writer thread.
+void writer_thread_applies_requests()
+{
+	const auto directory = make_directory("writer_thread_applies_requests");
+
+	auto opts = options{};
+
+	opts.writer_thread = true;
+#ifndef BITCASK_THREAD_SAFE
+	auto thrown = false;
+	try
+	{
+		auto db = bitcask{ directory, opts };
+	}
+	catch (const std::runtime_error&)
+	{
+		thrown = true;
+	}
+	check(thrown, "the writer thread requires a thread safe build");
+#else
+	constexpr auto threads = std::size_t{ 4u };
+	constexpr auto count   = std::size_t{ 5000u };
+	{
+		auto db       = bitcask{ directory, opts };
+		auto failures = std::atomic<std::size_t>{};
+		auto writers  = std::vector<std::thread>{};
+		for (auto t = std::size_t{}; t < threads; ++t)
+		{
+			writers.emplace_back([&, t] {
+				auto puts = std::vector<std::future<bool>>{};
+				auto dels = std::vector<std::future<bool>>{};
+				for (auto i = t * count; i < (t + 1u) * count; ++i)
+				{
+					puts.push_back(db.put_async(key_of(i), key_of(i)));
+					if (i % 3u == 0u)
+					{
+						dels.push_back(db.del_async(key_of(i)));
+						dels.push_back(db.del_async(key_of(i)));
+					}
+				}
+				for (auto& f : puts)
+				{
+					failures.fetch_add(f.get() ? 0u : 1u, std::memory_order_relaxed);
+				}
+				for (auto i = std::size_t{}; i < dels.size(); i += 2u)
+				{
+					failures.fetch_add(dels[i].get() && !dels[i + 1u].get() ? 0u : 1u, std::memory_order_relaxed);
+				}
+			});
+		}
+		std::for_each(writers.begin(), writers.end(), [](auto& t) { t.join(); });
+		check(failures.load() == 0u, "each put inserts a key, and of two deletes only the first finds it");
+	}
+
+	auto db = bitcask{ directory };
+	for (auto i = std::size_t{}; i < threads * count; ++i)
+	{
+		const auto value = db.get(key_of(i));
+		check(i % 3u == 0u ? !value : value && *value == key_of(i), "the requests are applied in order");
+	}
+#endif
+}
+
+// What one thread pushes or pops, in the order of the operations.
+using pushed_values = std::vector<std::unique_ptr<std::uint32_t>>;
+
+void mpmc_queue_operations()
+{
+	auto queue = mpmc_queue<std::unique_ptr<std::uint32_t>>{ 5u };
+	check(queue.capacity() == 8u, "the capacity is rounded up to a power of two");
+
+	for (auto i = 0u; i < 6u; ++i)
+	{
+		check(queue.try_push(std::make_unique<std::uint32_t>(i)), "try_push succeeds while there is room");
+	}
+	auto values = pushed_values{};
+	for (auto i = 6u; i < 10u; ++i)
+	{
+		values.push_back(std::make_unique<std::uint32_t>(i));
+	}
+	check(queue.try_push_batch(values.begin(), values.end()) == 2u, "a batch is pushed as far as it fits");
+	check(!values[1] && values[2] && values[3], "only the pushed elements are moved");
+	auto rejected = std::make_unique<std::uint32_t>(10u);
+	check(!queue.try_push(std::move(rejected)) && rejected, "try_push fails on a full queue and leaves the element");
+	check(queue.size() == 8u, "size");
+
+	auto popped = pushed_values{};
+	check(queue.try_pop_batch(std::back_inserter(popped), 3u) == 3u, "try_pop_batch pops up to the maximum");
+	popped.push_back(*queue.try_pop());
+	check(queue.pop_batch(std::back_inserter(popped), 100u) == 4u, "pop_batch pops what is there");
+	check(!queue.try_pop() && queue.empty(), "the queue is empty");
+	for (auto i = 0u; i < popped.size(); ++i)
+	{
+		check(*popped[i] == i, "elements are popped in the order they were pushed");
+	}
+
+	check(queue.push(std::make_unique<std::uint32_t>(11u)), "push");
+	queue.close();
+	check(!queue.try_push(std::make_unique<std::uint32_t>(12u)), "try_push fails on a closed queue");
+	check(!queue.push(std::move(rejected)) && rejected, "push fails on a closed queue and leaves the element");
+	check(queue.push_batch(values.begin(), values.end()) == 0u, "push_batch fails on a closed queue");
+	const auto last = queue.pop();
+	check(last && **last == 11u, "a closed queue still returns its elements");
+	check(!queue.pop(), "pop fails on a closed and empty queue");
+	check(queue.pop_batch(std::back_inserter(popped), 10u) == 0u, "pop_batch fails on a closed and empty queue");
+}
+
+// Producers and consumers that use every kind of push and pop, on a queue that is small enough to be full and empty often.
+void mpmc_queue_concurrent()
+{
+	constexpr auto producers = 4u;
+	constexpr auto consumers = 4u;
+	constexpr auto count     = 50000u; // per producer
+
+	auto queue = mpmc_queue<std::unique_ptr<std::uint32_t>>{ 16u };
+
+	auto popped  = std::vector<pushed_values>(consumers);
+	auto threads = std::vector<std::thread>{};
+	for (auto c = 0u; c < consumers; ++c)
+	{
+		threads.emplace_back([&, c] {
+			auto& out = popped[c];
+			if (c % 2u)
+			{
+				while (queue.pop_batch(std::back_inserter(out), 1u + c))
+				{
+				}
+			}
+			else
+			{
+				for (auto value = queue.pop(); value; value = queue.pop())
+				{
+					out.push_back(std::move(*value));
+				}
+			}
+		});
+	}
+
+	auto producer_threads = std::vector<std::thread>{};
+	for (auto p = 0u; p < producers; ++p)
+	{
+		producer_threads.emplace_back([&, p] {
+			auto values = pushed_values{};
+			for (auto i = 0u; i < count; ++i)
+			{
+				values.push_back(std::make_unique<std::uint32_t>(p * count + i));
+			}
+			if (p % 2u)
+			{
+				check(queue.push_batch(values.begin(), values.end()) == count, "push_batch pushes all elements");
+			}
+			else
+			{
+				std::for_each(values.begin(), values.end(), [&](auto& v) { check(queue.push(std::move(v)), "push"); });
+			}
+		});
+	}
+	std::for_each(producer_threads.begin(), producer_threads.end(), [](auto& t) { t.join(); });
+	queue.close();
+	std::for_each(threads.begin(), threads.end(), [](auto& t) { t.join(); });
+
+	auto seen = std::vector<bool>(producers * count);
+	for (const auto& out : popped)
+	{
+		// the elements of one producer reach each consumer in the order they were pushed
+		auto next = std::vector<std::uint32_t>(producers);
+		for (const auto& value : out)
+		{
+			const auto p = *value / count;
+			check(*value >= p * count + next[p], "a consumer sees the elements of a producer in order");
+			next[p] = *value - p * count + 1u;
+			check(!seen[*value], "no element is popped twice");
+			seen[*value] = true;
+		}
+	}
+	check(std::all_of(seen.begin(), seen.end(), [](bool b) { return b; }), "every element is popped");
+}
+
+void mpmc_queue_close_wakes_blocked_threads()
+{
+	auto queue   = mpmc_queue<std::unique_ptr<std::uint32_t>>{ 2u };
+	auto results = std::vector<std::future<bool>>{};
+	for (auto i = 0u; i < 2u; ++i)
+	{
+		results.push_back(std::async(std::launch::async, [&] { return !queue.pop(); }));
+		results.push_back(std::async(std::launch::async, [&] {
+			auto out = pushed_values{};
+			return queue.pop_batch(std::back_inserter(out), 4u) == 0u;
+		}));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+	const auto blocked = [](auto& r) { return r.wait_for(std::chrono::seconds{}) == std::future_status::timeout; };
+	check(std::all_of(results.begin(), results.end(), blocked), "pops block on an empty queue");
+	queue.close();
+	check(std::all_of(results.begin(), results.end(), [](auto& r) { return r.get(); }), "close wakes the blocked pops");
+
+	auto full = mpmc_queue<std::unique_ptr<std::uint32_t>>{ 2u };
+	check(full.push(std::make_unique<std::uint32_t>(0u)) && full.push(std::make_unique<std::uint32_t>(1u)), "push");
+	auto element = std::make_unique<std::uint32_t>(2u);
+	auto pushed  = std::async(std::launch::async, [&] { return full.push(std::move(element)); });
+	auto values  = pushed_values(3u);
+	auto batch   = std::async(std::launch::async, [&] { return full.push_batch(values.begin(), values.end()); });
+	std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+	check(blocked(pushed), "push blocks on a full queue");
+	check(blocked(batch), "push_batch blocks on a full queue");
+	full.close();
+	check(!pushed.get() && element, "close wakes a blocked push, which leaves the element");
+	check(batch.get() == 0u, "close wakes a blocked push_batch");
+	check(full.size() == 2u, "a closed queue keeps its elements");
+}
+
+// Runs `fn` on `count` threads that are all alive at the same time.
+template<typename Fn>
+void on_simultaneous_threads(std::size_t count, Fn&& fn)
+{
+	auto started = std::latch{ static_cast<std::ptrdiff_t>(count) };
+	auto threads = std::vector<std::thread>{};
+	for (auto i = std::size_t{}; i < count; ++i)
+	{
+		threads.emplace_back([&] {
+			fn();
+			started.arrive_and_wait();
+		});
+	}
+	std::for_each(threads.begin(), threads.end(), [](auto& t) { t.join(); });
+}
+
+void per_thread_instances_are_recycled()
+{
+	using counters_type = per_thread<local_counter>;
+
+	auto counters = counters_type{};
+	for (auto i = 0u; i < 100u; ++i)
+	{
+		std::thread{ [&] { counters.local().add(); } }.join();
+	}
+	on_simultaneous_threads(4u, [&] { counters.local().add(); });
+	on_simultaneous_threads(3u, [&] { counters.local().add(); });
+
+	auto instances = 0u;
+	auto total     = std::uint64_t{};
+	counters.for_each([&](const local_counter& c) {
+		++instances;
+		total += c.get();
+	});
+	check(instances == 4u, "threads get the instances of the threads that have exited");
+	check(total == 107u, "the counts of threads that have exited are kept");
+
+	// like a thread that opens and closes one store after the other
+	const auto cached = counters_type::cached();
+	for (auto i = 0u; i < 1000u; ++i)
+	{
+		auto other = counters_type{};
+		other.local().add();
+	}
+	check(counters_type::cached() <= cached + 1u, "destroyed objects are dropped from the cache of the thread");
+
+	// a thread that exits after the object it used was destroyed
+	auto other     = std::make_unique<counters_type>();
+	auto used      = std::latch{ 1 };
+	auto destroyed = std::latch{ 1 };
+	auto thread    = std::thread{ [&] {
+		other->local().add();
+		used.count_down();
+		destroyed.wait();
+	} };
+	used.wait();
+	other.reset();
+	destroyed.count_down();
+	thread.join();
+}
+
+struct test final
+{
+	std::string_view      name;
+	std::function<void()> run;
+};
+
+const auto all_tests = std::vector<test>{
+	{ "resync_large_damaged_file", resync_large_damaged_file },
+	{ "zero_terminated_data_is_not_trimmed", zero_terminated_data_is_not_trimmed },
+	{ "preallocated_files_are_trimmed", preallocated_files_are_trimmed },
+	{ "preallocated_file_after_crash", preallocated_file_after_crash },
+	{ "keydir_hashed", keydir_hashed },
+	{ "keydir_concurrent", keydir_concurrent },
+	{ "keydir_ordered", keydir_ordered },
+	{ "keydir_compact", keydir_compact },
+	{ "keydir_hash_only", keydir_hash_only },
+	{ "keydir_mapped", keydir_mapped },
+	{ "keydir_concurrent_readers", keydir_concurrent_readers },
+	{ "keydir_mapped_reopen", keydir_mapped_reopen },
+	{ "epoch_retired_objects_are_freed", epoch_retired_objects_are_freed },
+	{ "mapped_keydir_after_merge", mapped_keydir_after_merge },
+	{ "writer_thread_applies_requests", writer_thread_applies_requests },
+	{ "mpmc_queue_operations", mpmc_queue_operations },
+	{ "mpmc_queue_concurrent", mpmc_queue_concurrent },
+	{ "mpmc_queue_close_wakes_blocked_threads", mpmc_queue_close_wakes_blocked_threads },
+	{ "per_thread_instances_are_recycled", per_thread_instances_are_recycled },
+};
+
+} // namespace
+
+int run(std::string_view name)
+{
+	auto failed = 0;
+	auto found  = false;
+	for (const auto& t : all_tests)
+	{
+		if (name.empty() || name == t.name)
+		{
+			found = true;
+			try
+			{
+				t.run();
+				std::cout << "passed: " << t.name << std::endl;
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "FAILED: " << t.name << ": " << e.what() << std::endl;
+				++failed;
+			}
+		}
+	}
+	if (!found)
+	{
+		std::cerr << "no test named " << name << std::endl;
+		return 1;
+	}
+	return failed == 0 ? 0 : 1;
+}
+
+} // namespace bitcask::tests
+
+int main(int argc, char** argv)
+{
+	return bitcask::tests::run(argc > 1 ? argv[1] : "");
+}
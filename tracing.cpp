@@ -0,0 +1,160 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "tracing.h"
+#include "file.h"
+
+#include <fmt/format.h>
+
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bitcask {
+
+namespace {
+
+// Keys are arbitrary bytes; anything that is not printable ASCII is escaped, so that the JSON stays valid.
+void append_json_string(std::string& out, std::string_view s)
+{
+	out.push_back('"');
+	for (const auto c : s)
+	{
+		const auto u = static_cast<unsigned char>(c);
+		if (c == '"' || c == '\\')
+		{
+			out.push_back('\\');
+			out.push_back(c);
+		}
+		else if (u < 0x20u || u >= 0x7fu)
+		{
+			fmt::format_to(std::back_inserter(out), "\\u{:04x}", u);
+		}
+		else
+		{
+			out.push_back(c);
+		}
+	}
+	out.push_back('"');
+}
+
+double microseconds(std::chrono::nanoseconds ns)
+{
+	return static_cast<double>(ns.count()) / 1e3;
+}
+
+} // namespace
+
+const char* to_string(trace_phase phase) noexcept
+{
+	switch (phase)
+	{
+	case trace_phase::keydir:
+		return "keydir";
+	case trace_phase::cache:
+		return "cache";
+	case trace_phase::file_lookup:
+		return "file_lookup";
+	case trace_phase::lock:
+		return "lock";
+	case trace_phase::io:
+		return "io";
+	case trace_phase::checksum:
+		return "checksum";
+	case trace_phase::copy:
+		return "copy";
+	case trace_phase::queue:
+		return "queue";
+	}
+	return "unknown";
+}
+
+class chrome_trace_writer::impl final
+{
+	std::unique_ptr<file> file_;
+	bool                  empty_; // no event written yet, guarded by the file lock
+	int                   pid_;
+
+public:
+	explicit impl(const std::filesystem::path& path)
+	    : file_{ file::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664) }
+	    , empty_{ true }
+	    , pid_{ static_cast<int>(::getpid()) }
+	{
+		constexpr auto header = std::string_view{ "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" };
+		this->file_->write(header.data(), header.size());
+	}
+
+	~impl() noexcept
+	{
+		try
+		{
+			constexpr auto footer = std::string_view{ "\n]}\n" };
+			this->file_->write(footer.data(), footer.size());
+		}
+		catch (...)
+		{
+			// the trace viewers also accept a file without the closing brackets
+		}
+	}
+
+	impl(const impl&)            = delete;
+	impl& operator=(const impl&) = delete;
+
+	void write(const operation_trace& op)
+	{
+		const auto ts = std::chrono::duration_cast<std::chrono::nanoseconds>(op.start.time_since_epoch());
+
+		auto text = std::string{};
+		fmt::format_to(std::back_inserter(text),
+		               "\n{{\"name\":\"{}\",\"cat\":\"operation\",\"ph\":\"X\","
+		               "\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},\"tid\":{},\"args\":{{\"key\":",
+		               op.operation,
+		               microseconds(ts),
+		               microseconds(op.duration),
+		               this->pid_,
+		               op.thread);
+		append_json_string(text, op.key);
+		text.append("}}");
+
+		for (const auto& span : op.spans)
+		{
+			fmt::format_to(std::back_inserter(text),
+			               ",\n{{\"name\":\"{}\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},\"tid\":{}}}",
+			               to_string(span.phase),
+			               microseconds(ts + span.start),
+			               microseconds(span.duration),
+			               this->pid_,
+			               op.thread);
+		}
+
+		const auto lock = this->file_->lock();
+		if (!this->empty_)
+		{
+			this->file_->locked_write(lock, ",", 1u);
+		}
+		this->file_->locked_write(lock, text.data(), text.size());
+		this->empty_ = false;
+	}
+};
+
+chrome_trace_writer::chrome_trace_writer(const std::filesystem::path& path)
+    : pimpl_{ std::make_unique<impl>(path) }
+{
+}
+
+chrome_trace_writer::~chrome_trace_writer() noexcept
+{
+}
+
+void chrome_trace_writer::on_operation(const operation_trace& op)
+{
+	return this->pimpl_->write(op);
+}
+
+} // namespace bitcask
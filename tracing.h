@@ -0,0 +1,144 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace bitcask {
+
+/// The parts of an operation that are timed when the operation is traced.
+enum class trace_phase : std::uint8_t
+{
+	keydir,      // lookup or update of the key in the keydir, including its lock
+	cache,       // lookup or insertion in the value cache
+	file_lookup, // finding the data file of a keydir entry
+	lock,        // acquiring a lock, nested in the phase that takes it
+	io,          // reading or writing a data file
+	checksum,    // computing the CRC of a record
+	copy,        // allocating and filling buffers
+	queue,       // waiting for the writer thread, see options::writer_thread
+};
+
+const char* to_string(trace_phase phase) noexcept;
+
+struct trace_span final
+{
+	trace_phase              phase;
+	std::chrono::nanoseconds start; // since the start of the operation
+	std::chrono::nanoseconds duration;
+};
+
+/// A traced get, put or del, see options::tracer.
+struct operation_trace final
+{
+	std::string_view                      operation; // "get", "put" or "del"
+	std::string                           key;
+	std::uint32_t                         thread;    // small number that identifies the thread
+	std::chrono::steady_clock::time_point start;
+	std::chrono::nanoseconds              duration;
+	std::vector<trace_span>               spans; // in the order they ended, so a nested span precedes its parent
+};
+
+/// Receives the traces of sampled operations, see options::tracer. Called on the thread that ran the operation,
+/// after it completed, possibly by several threads at once. Exceptions thrown by on_operation are ignored.
+/// The work that the writer thread does for a put or del is not traced, only the time spent waiting for it.
+class trace_hook
+{
+public:
+	virtual ~trace_hook() = default;
+
+	virtual void on_operation(const operation_trace& op) = 0;
+};
+
+/// Writes the traces as Chrome trace event JSON, to be opened in chrome://tracing or https://ui.perfetto.dev.
+/// Each operation is an event, with its phases nested in it. The file is complete once the writer is destroyed.
+class chrome_trace_writer final : public trace_hook
+{
+	class impl;
+	std::unique_ptr<impl> pimpl_;
+
+public:
+	explicit chrome_trace_writer(const std::filesystem::path& path);
+	~chrome_trace_writer() noexcept override;
+
+	chrome_trace_writer(const chrome_trace_writer&)            = delete;
+	chrome_trace_writer& operator=(const chrome_trace_writer&) = delete;
+
+	void on_operation(const operation_trace& op) override;
+};
+
+// The trace of the operation that the current thread runs, if it is sampled.
+inline operation_trace*& current_trace() noexcept
+{
+	thread_local operation_trace* trace{};
+	return trace;
+}
+
+// Adds a span for a phase to the trace of the current thread, if there is one. Costs a thread local read otherwise.
+// The span ends when the timer is destroyed or stopped.
+class phase_timer final
+{
+	operation_trace*                      trace_;
+	trace_phase                           phase_;
+	std::chrono::steady_clock::time_point start_;
+
+public:
+	explicit phase_timer(trace_phase phase) noexcept
+	    : trace_{ current_trace() }
+	    , phase_{ phase }
+	    , start_{}
+	{
+		if (this->trace_)
+		{
+			this->start_ = std::chrono::steady_clock::now();
+		}
+	}
+
+	~phase_timer() noexcept
+	{
+		this->stop();
+	}
+
+	phase_timer(const phase_timer&)            = delete;
+	phase_timer& operator=(const phase_timer&) = delete;
+
+	void stop() noexcept
+	{
+		if (this->trace_)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			try
+			{
+				this->trace_->spans.push_back(trace_span{ .phase    = this->phase_,
+				                                          .start    = this->start_ - this->trace_->start,
+				                                          .duration = now - this->start_ });
+			}
+			catch (...)
+			{
+				// the span is missing from the trace
+			}
+			this->trace_ = nullptr;
+		}
+	}
+};
+
+/// Runs `fn` as a phase of the traced operation of this thread, if there is one.
+template<typename Fn>
+auto traced_phase(trace_phase phase, Fn&& fn)
+{
+	const auto timer = phase_timer{ phase };
+	return fn();
+}
+
+} // namespace bitcask
@@ -0,0 +1,351 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "valuecache.h"
+#include "locktypes.hpp"
+
+#include <unordered_map>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <bit>
+
+namespace bitcask {
+
+namespace {
+
+// Power of two, the top bits of the key hash select the shard.
+constexpr auto shard_bits  = 4u;
+constexpr auto shard_count = std::size_t{ 1 } << shard_bits;
+
+// Approximate bookkeeping cost of one entry (slot, index node, string header).
+constexpr auto entry_overhead = std::size_t{ 96u };
+
+struct cache_key final
+{
+	file_id_type   file_id;
+	value_pos_type value_pos;
+
+	bool operator==(const cache_key&) const = default;
+};
+
+std::uint64_t mix(std::uint64_t x)
+{
+	// splitmix64 finalizer
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+std::uint64_t hash_key(const cache_key& key)
+{
+	return mix(key.file_id ^ mix(static_cast<std::uint64_t>(key.value_pos)));
+}
+
+struct cache_key_hash
+{
+	std::size_t operator()(const cache_key& key) const
+	{
+		return hash_key(key);
+	}
+};
+
+// Count-min sketch with 4 rows of saturating 4-bit counters.
+// All counters are halved periodically, so that the sketch tracks recent popularity.
+class frequency_sketch final
+{
+	static constexpr auto rows        = 4u;
+	static constexpr auto max_counter = std::uint8_t{ 15u };
+
+	std::vector<std::uint8_t> table_;
+	std::size_t               width_;
+	std::size_t               additions_;
+	std::size_t               sample_size_;
+
+	std::size_t index(std::uint64_t hash, unsigned row) const
+	{
+		static constexpr auto seeds =
+		    std::array<std::uint64_t, rows>{ 0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull, 0x9ae16a3b2f90404full, 0xcbf29ce484222325ull };
+		return row * this->width_ + (mix(hash + seeds[row]) & (this->width_ - 1u));
+	}
+
+	void age()
+	{
+		std::for_each(this->table_.begin(), this->table_.end(), [](auto& counter) { counter >>= 1; });
+		this->additions_ /= 2u;
+	}
+
+public:
+	explicit frequency_sketch(std::size_t width)
+	    : table_{}
+	    , width_{ std::bit_ceil(std::max(width, std::size_t{ 64u })) }
+	    , additions_{}
+	    , sample_size_{ 10u * this->width_ }
+	{
+		this->table_.resize(rows * this->width_);
+	}
+
+	void increment(std::uint64_t hash)
+	{
+		for (auto row = 0u; row < rows; ++row)
+		{
+			auto& counter = this->table_[this->index(hash, row)];
+			if (counter < max_counter)
+			{
+				++counter;
+			}
+		}
+		if (++this->additions_ >= this->sample_size_)
+		{
+			this->age();
+		}
+	}
+
+	unsigned estimate(std::uint64_t hash) const
+	{
+		auto result = static_cast<unsigned>(max_counter);
+		for (auto row = 0u; row < rows; ++row)
+		{
+			result = std::min(result, static_cast<unsigned>(this->table_[this->index(hash, row)]));
+		}
+		return result;
+	}
+};
+
+class shard final
+{
+	struct slot final
+	{
+		cache_key  key;
+		value_type value;
+		bool       referenced;
+		bool       occupied;
+	};
+
+	std::unordered_map<cache_key, std::size_t, cache_key_hash> index_;
+	std::vector<slot>                                          slots_;
+	std::vector<std::size_t>                                   free_slots_;
+	std::size_t                                                hand_;
+	std::size_t                                                size_;
+	std::size_t                                                capacity_;
+	frequency_sketch                                           sketch_;
+	std::uint64_t                                              hits_;
+	std::uint64_t                                              misses_;
+	std::uint64_t                                              insertions_;
+	std::uint64_t                                              rejections_;
+	std::uint64_t                                              evictions_;
+	mutable locker                                             locker_;
+
+	std::size_t find_victim()
+	{
+		for (;;)
+		{
+			if (this->hand_ >= this->slots_.size())
+			{
+				this->hand_ = 0u;
+			}
+			auto& s = this->slots_[this->hand_];
+			if (s.occupied)
+			{
+				if (s.referenced)
+				{
+					s.referenced = false;
+				}
+				else
+				{
+					return this->hand_;
+				}
+			}
+			++this->hand_;
+		}
+	}
+
+	void evict(std::size_t index)
+	{
+		auto& s = this->slots_[index];
+		this->index_.erase(s.key);
+		this->size_ -= s.value.size() + entry_overhead;
+		s.value    = value_type{};
+		s.occupied = false;
+		this->free_slots_.push_back(index);
+		++this->evictions_;
+	}
+
+public:
+	explicit shard(std::size_t capacity)
+	    : index_{}
+	    , slots_{}
+	    , free_slots_{}
+	    , hand_{}
+	    , size_{}
+	    , capacity_{ capacity }
+	    , sketch_{ capacity / (2u * entry_overhead) }
+	    , hits_{}
+	    , misses_{}
+	    , insertions_{}
+	    , rejections_{}
+	    , evictions_{}
+	    , locker_{ "valuecache" }
+	{
+	}
+
+	std::optional<value_type> get(const cache_key& key, std::uint64_t hash)
+	{
+		const auto lock = this->locker_.lock();
+		(void)(lock);
+
+		this->sketch_.increment(hash);
+
+		const auto it = this->index_.find(key);
+		if (it == this->index_.end())
+		{
+			++this->misses_;
+			return std::nullopt;
+		}
+		else
+		{
+			++this->hits_;
+			auto& s      = this->slots_[it->second];
+			s.referenced = true;
+			return s.value;
+		}
+	}
+
+	void put(const cache_key& key, std::uint64_t hash, const value_type& value)
+	{
+		const auto charge = value.size() + entry_overhead;
+
+		// Do not let one huge value flush the whole shard.
+		if (charge > this->capacity_ / 8u)
+		{
+			return;
+		}
+
+		const auto lock = this->locker_.lock();
+		(void)(lock);
+
+		if (this->index_.contains(key))
+		{
+			return;
+		}
+
+		while (this->size_ + charge > this->capacity_)
+		{
+			const auto victim = this->find_victim();
+			if (this->sketch_.estimate(hash) <= this->sketch_.estimate(hash_key(this->slots_[victim].key)))
+			{
+				++this->rejections_;
+				return;
+			}
+			this->evict(victim);
+		}
+
+		auto index = std::size_t{};
+		if (this->free_slots_.empty())
+		{
+			index = this->slots_.size();
+			this->slots_.push_back(slot{ .key = key, .value = value, .referenced = false, .occupied = true });
+		}
+		else
+		{
+			index = this->free_slots_.back();
+			this->free_slots_.pop_back();
+			this->slots_[index] = slot{ .key = key, .value = value, .referenced = false, .occupied = true };
+		}
+
+		this->index_.emplace(key, index);
+		this->size_ += charge;
+		++this->insertions_;
+	}
+
+	void add_statistics(valuecache::stats& st) const
+	{
+		const auto lock = this->locker_.lock();
+		(void)(lock);
+
+		st.hits += this->hits_;
+		st.misses += this->misses_;
+		st.insertions += this->insertions_;
+		st.rejections += this->rejections_;
+		st.evictions += this->evictions_;
+		st.entries += this->index_.size();
+		st.size += this->size_;
+		st.capacity += this->capacity_;
+	}
+};
+
+} // namespace
+
+class valuecache::impl final
+{
+	std::vector<std::unique_ptr<shard>> shards_;
+
+	shard& shard_for(std::uint64_t hash)
+	{
+		return *this->shards_[hash >> (64u - shard_bits)];
+	}
+
+public:
+	explicit impl(std::size_t capacity)
+	    : shards_{}
+	{
+		while (this->shards_.size() < shard_count)
+		{
+			this->shards_.push_back(std::make_unique<shard>(capacity / shard_count));
+		}
+	}
+
+	std::optional<value_type> get(file_id_type file_id, value_pos_type value_pos)
+	{
+		const auto key  = cache_key{ .file_id = file_id, .value_pos = value_pos };
+		const auto hash = hash_key(key);
+		return this->shard_for(hash).get(key, hash);
+	}
+
+	void put(file_id_type file_id, value_pos_type value_pos, const value_type& value)
+	{
+		const auto key  = cache_key{ .file_id = file_id, .value_pos = value_pos };
+		const auto hash = hash_key(key);
+		this->shard_for(hash).put(key, hash, value);
+	}
+
+	valuecache::stats statistics() const
+	{
+		auto st = valuecache::stats{};
+		std::for_each(this->shards_.begin(), this->shards_.end(), [&](const auto& s) { s->add_statistics(st); });
+		return st;
+	}
+};
+
+valuecache::valuecache(std::size_t capacity)
+    : pimpl_{ std::make_unique<impl>(capacity) }
+{
+}
+
+valuecache::~valuecache() noexcept
+{
+}
+
+std::optional<value_type> valuecache::get(file_id_type file_id, value_pos_type value_pos)
+{
+	return this->pimpl_->get(file_id, value_pos);
+}
+
+void valuecache::put(file_id_type file_id, value_pos_type value_pos, const value_type& value)
+{
+	this->pimpl_->put(file_id, value_pos, value);
+}
+
+valuecache::stats valuecache::statistics() const
+{
+	return this->pimpl_->statistics();
+}
+
+} // namespace bitcask
@@ -0,0 +1,57 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "basictypes.h"
+
+#include <memory>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+namespace bitcask {
+
+/// Sharded, memory bounded cache of values, keyed by their location in the data files.
+/// Records are never overwritten in place, so a location always refers to the same value and
+/// cached entries never need to be invalidated. Entries of files removed by a merge simply age out.
+/// Eviction uses the CLOCK algorithm, admission is guarded by a TinyLFU frequency sketch
+/// so that a burst of one-off reads cannot flush the hot entries.
+class valuecache final
+{
+	class impl;
+	std::unique_ptr<impl> pimpl_;
+
+public:
+	struct stats final
+	{
+		std::uint64_t hits;
+		std::uint64_t misses;
+		std::uint64_t insertions;
+		std::uint64_t rejections; // not admitted because the entry was not used frequently enough
+		std::uint64_t evictions;
+		std::size_t   entries;
+		std::size_t   size; // bytes, including the bookkeeping overhead
+		std::size_t   capacity;
+	};
+
+	explicit valuecache(std::size_t capacity);
+	~valuecache() noexcept;
+
+	valuecache(valuecache&&)            = default;
+	valuecache& operator=(valuecache&&) = default;
+
+	valuecache(const valuecache&)            = delete;
+	valuecache& operator=(const valuecache&) = delete;
+
+	std::optional<value_type> get(file_id_type file_id, value_pos_type value_pos);
+	void                      put(file_id_type file_id, value_pos_type value_pos, const value_type& value);
+
+	stats statistics() const;
+};
+
+} // namespace bitcask
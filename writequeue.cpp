@@ -0,0 +1,228 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "writequeue.h"
+#include "mpscqueue.hpp"
+#include "config.h"
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <unordered_set>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+namespace bitcask {
+
+class write_queue::impl final
+{
+	struct request final
+	{
+		key_type                  key{};
+		std::optional<value_type> value{}; // none for a delete
+		std::promise<bool>        result{};
+	};
+
+	static constexpr auto queue_capacity = std::size_t{ 4096u };
+	static constexpr auto max_batch_size = std::size_t{ 256u };
+
+	datadir&                   datadir_;
+	keydir&                    keydir_;
+	mpsc_queue<request>        queue_;
+	std::atomic<std::uint32_t> submitted_; // bumped after every push, the writer waits on it while the queue is empty
+	std::atomic<bool>          stopping_;
+	std::thread                thread_;
+
+	std::future<bool> submit(request&& r)
+	{
+		auto result = r.result.get_future();
+		while (!this->queue_.try_push(std::move(r)))
+		{
+			// full, let the writer catch up
+			std::this_thread::yield();
+		}
+		this->submitted_.fetch_add(1u, std::memory_order_release);
+		this->submitted_.notify_one();
+		return result;
+	}
+
+	void complete(request& r, keydir::info&& info)
+	{
+		try
+		{
+			r.result.set_value(r.value ? this->keydir_.put(r.key, std::move(info)) : this->keydir_.del(r.key));
+		}
+		catch (...)
+		{
+			r.result.set_exception(std::current_exception());
+		}
+	}
+
+	// Used when the batch could not be appended, so that only the offending requests fail.
+	void apply_one(request& r, version_type version)
+	{
+		try
+		{
+			if (r.value)
+			{
+				r.result.set_value(this->keydir_.put(r.key, this->datadir_.put(r.key, r.value.value(), version)));
+			}
+			else
+			{
+				this->datadir_.del(r.key, version);
+				r.result.set_value(this->keydir_.del(r.key));
+			}
+		}
+		catch (...)
+		{
+			r.result.set_exception(std::current_exception());
+		}
+	}
+
+	void apply(std::vector<request>& batch)
+	{
+		auto ops     = std::vector<write_op>{};
+		auto pending = std::vector<request*>{};
+		auto puts    = std::unordered_set<std::string_view>{};
+
+		for (auto& r : batch)
+		{
+			// No need to write a tombstone for a key that is known to be absent, unless it is put earlier in this batch.
+			if (!r.value && !this->keydir_.may_contain(r.key) && !puts.contains(r.key))
+			{
+				r.result.set_value(false);
+				continue;
+			}
+
+			if (r.value)
+			{
+				puts.insert(r.key);
+			}
+			ops.push_back(write_op{ .key     = r.key,
+			                        .value   = r.value ? std::optional<std::string_view>{ r.value.value() } : std::nullopt,
+			                        .version = this->keydir_.next_version() });
+			pending.push_back(&r);
+		}
+
+		if (ops.empty())
+		{
+			return;
+		}
+
+		auto infos = std::vector<keydir::info>{};
+		try
+		{
+			infos = this->datadir_.append(ops);
+		}
+		catch (...)
+		{
+			for (auto i = std::size_t{}; i < pending.size(); ++i)
+			{
+				this->apply_one(*pending[i], ops[i].version);
+			}
+			return;
+		}
+
+		for (auto i = std::size_t{}; i < pending.size(); ++i)
+		{
+			this->complete(*pending[i], std::move(infos[i]));
+		}
+	}
+
+	void run()
+	{
+		auto batch = std::vector<request>{};
+		batch.reserve(max_batch_size);
+
+		for (;;)
+		{
+			const auto submitted = this->submitted_.load(std::memory_order_acquire);
+
+			while (batch.size() < max_batch_size)
+			{
+				auto r = this->queue_.try_pop();
+				if (!r)
+				{
+					break;
+				}
+				batch.push_back(std::move(*r));
+			}
+
+			if (batch.empty())
+			{
+				if (this->stopping_.load(std::memory_order_acquire))
+				{
+					return;
+				}
+				this->submitted_.wait(submitted, std::memory_order_acquire);
+				continue;
+			}
+
+			this->apply(batch);
+			batch.clear();
+		}
+	}
+
+public:
+	impl(datadir& dd, keydir& kd)
+	    : datadir_{ dd }
+	    , keydir_{ kd }
+	    , queue_{ queue_capacity }
+	    , submitted_{}
+	    , stopping_{}
+	    , thread_{}
+	{
+#ifndef BITCASK_THREAD_SAFE
+		throw std::runtime_error{ "The writer thread requires a build with BITCASK_THREAD_SAFE" };
+#endif
+		this->thread_ = std::thread{ [this] { this->run(); } };
+	}
+
+	~impl() noexcept
+	{
+		this->stopping_.store(true, std::memory_order_release);
+		this->submitted_.fetch_add(1u, std::memory_order_release);
+		this->submitted_.notify_one();
+		this->thread_.join();
+	}
+
+	impl(const impl&)            = delete;
+	impl& operator=(const impl&) = delete;
+
+	std::future<bool> put(const std::string_view& key, const std::string_view& value)
+	{
+		return this->submit(request{ .key = key_type{ key }, .value = value_type{ value }, .result = {} });
+	}
+
+	std::future<bool> del(const std::string_view& key)
+	{
+		return this->submit(request{ .key = key_type{ key }, .value = std::nullopt, .result = {} });
+	}
+};
+
+write_queue::write_queue(datadir& dd, keydir& kd)
+    : pimpl_{ std::make_unique<impl>(dd, kd) }
+{
+}
+
+write_queue::~write_queue() noexcept
+{
+}
+
+std::future<bool> write_queue::put(const std::string_view& key, const std::string_view& value)
+{
+	return this->pimpl_->put(key, value);
+}
+
+std::future<bool> write_queue::del(const std::string_view& key)
+{
+	return this->pimpl_->del(key);
+}
+
+} // namespace bitcask
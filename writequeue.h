@@ -0,0 +1,45 @@
+//
+// Copyright (C) 2024 Patrick Rotsaert
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#pragma once
+
+#include "datadir.h"
+#include "keydir.h"
+
+#include <memory>
+#include <future>
+#include <string_view>
+
+namespace bitcask {
+
+/// Puts and deletes applied by a single writer thread (see options::writer_thread).
+/// Any thread can submit requests. The writer takes all requests that are queued, appends them to the active
+/// file with a single write, then updates the keydir in submission order and completes the futures.
+/// Under contention, threads that would otherwise wait for each other's appends thus share a write.
+class write_queue final
+{
+	class impl;
+	std::unique_ptr<impl> pimpl_;
+
+public:
+	/// Starts the writer thread.
+	write_queue(datadir& dd, keydir& kd);
+
+	/// Applies the requests that are still queued, then stops the writer thread.
+	~write_queue() noexcept;
+
+	write_queue(const write_queue&)            = delete;
+	write_queue& operator=(const write_queue&) = delete;
+
+	/// The result is true if the key was inserted, false if the key existed.
+	std::future<bool> put(const std::string_view& key, const std::string_view& value);
+
+	/// The result is true if the key was deleted, false if the key did not exist.
+	std::future<bool> del(const std::string_view& key);
+};
+
+} // namespace bitcask